@@ -0,0 +1,972 @@
+#include "ArrowIpc.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using std::ifstream;
+using std::int16_t;
+using std::int32_t;
+using std::int64_t;
+using std::ios;
+using std::map;
+using std::ofstream;
+using std::string;
+using std::uint16_t;
+using std::uint32_t;
+using std::uint8_t;
+using std::vector;
+
+// The flatbuffer metadata and the column buffers are written using the
+// native byte order, Arrow IPC (like the collection file format) assumes
+// a little endian host
+
+/// <summary>
+/// Metadata version written to messages (MetadataVersion::V5)
+/// </summary>
+static const int16_t METADATA_VERSION = 4;
+
+/// <summary>
+/// MessageHeader union type tags
+/// </summary>
+static const uint8_t HEADER_SCHEMA = 1;
+static const uint8_t HEADER_RECORD_BATCH = 3;
+
+/// <summary>
+/// Type union type tags for the supported column types
+/// </summary>
+static const uint8_t TYPE_INT = 2;
+static const uint8_t TYPE_FLOATING_POINT = 3;
+static const uint8_t TYPE_UTF8 = 5;
+
+/// <summary>
+/// FloatingPoint precision values
+/// </summary>
+static const int16_t PRECISION_SINGLE = 1;
+static const int16_t PRECISION_DOUBLE = 2;
+
+/// <summary>
+/// Marker written before each encapsulated message
+/// </summary>
+static const uint32_t CONTINUATION = 0xFFFFFFFF;
+
+/// <summary>
+/// Magic bytes at the start (padded to 8 bytes) and end of IPC files
+/// </summary>
+static const char FILE_MAGIC[8] = {'A', 'R', 'R', 'O', 'W', '1', 0, 0};
+static const size_t FILE_MAGIC_LENGTH = 6;
+
+/// <summary>
+/// Field within a flatbuffer table that is being built. Fields either
+/// hold inline scalar bytes or a child object which is written after
+/// the table and referenced by offset
+/// </summary>
+struct FlatField {
+  uint16_t id;
+  vector<uint8_t> scalar;
+  std::function<uint32_t()> child;
+};
+
+template <typename T>
+static FlatField scalarField(uint16_t id, T value) {
+  FlatField field;
+  field.id = id;
+  field.scalar.resize(sizeof(T));
+  memcpy(field.scalar.data(), &value, sizeof(T));
+  return field;
+}
+
+static FlatField offsetField(uint16_t id, std::function<uint32_t()> child) {
+  FlatField field;
+  field.id = id;
+  field.child = child;
+  return field;
+}
+
+/// <summary>
+/// Minimal flatbuffer builder for the Arrow metadata. Unlike the
+/// official builder this writes front to back, tables are written
+/// before the objects they reference so that all the unsigned offsets
+/// point forwards
+/// </summary>
+class FlatBuilder {
+ public:
+  vector<uint8_t> buffer;
+
+  /// <summary>
+  /// Pads the buffer with zeros to the provided alignment
+  /// </summary>
+  void pad(size_t alignment) {
+    while (buffer.size() % alignment != 0) {
+      buffer.push_back(0);
+    }
+  }
+
+  template <typename T>
+  void put(T value) {
+    size_t pos = buffer.size();
+    buffer.resize(pos + sizeof(T));
+    memcpy(&buffer[pos], &value, sizeof(T));
+  }
+
+  template <typename T>
+  void patch(size_t pos, T value) {
+    memcpy(&buffer[pos], &value, sizeof(T));
+  }
+
+  /// <summary>
+  /// Writes a table with its vtable returning the table position
+  /// </summary>
+  uint32_t table(const vector<FlatField>& fields) {
+    uint16_t slots = 0;
+    for (const FlatField& field : fields) {
+      slots = std::max<uint16_t>(slots, field.id + 1);
+    }
+
+    // Order the inline fields largest first so each one is naturally
+    // aligned without any padding between them
+    vector<const FlatField*> ordered;
+    for (const FlatField& field : fields) {
+      ordered.push_back(&field);
+    }
+    std::stable_sort(ordered.begin(), ordered.end(),
+                     [](const FlatField* a, const FlatField* b) {
+                       return inlineSize(*a) > inlineSize(*b);
+                     });
+
+    // Reserve the vtable, it is filled in once the layout is known
+    pad(2);
+    size_t vtable = buffer.size();
+    buffer.resize(vtable + 4 + 2 * slots, 0);
+
+    // Align the table so the fields after the soffset are 8 byte aligned
+    while ((buffer.size() + 4) % 8 != 0) {
+      buffer.push_back(0);
+    }
+    size_t table = buffer.size();
+    put<int32_t>(static_cast<int32_t>(table - vtable));
+
+    vector<std::pair<size_t, const FlatField*>> pending;
+    for (const FlatField* field : ordered) {
+      pad(inlineSize(*field));
+      size_t pos = buffer.size();
+      patch<uint16_t>(vtable + 4 + 2 * field->id,
+                      static_cast<uint16_t>(pos - table));
+      if (field->child) {
+        put<uint32_t>(0);
+        pending.push_back(std::make_pair(pos, field));
+      } else {
+        buffer.insert(buffer.end(), field->scalar.begin(),
+                      field->scalar.end());
+      }
+    }
+
+    patch<uint16_t>(vtable, static_cast<uint16_t>(4 + 2 * slots));
+    patch<uint16_t>(vtable + 2, static_cast<uint16_t>(buffer.size() - table));
+
+    // Write the referenced objects and point the slots at them
+    for (const std::pair<size_t, const FlatField*>& slot : pending) {
+      uint32_t pos = slot.second->child();
+      patch<uint32_t>(slot.first, static_cast<uint32_t>(pos - slot.first));
+    }
+
+    return static_cast<uint32_t>(table);
+  }
+
+  /// <summary>
+  /// Writes a null terminated string returning its position
+  /// </summary>
+  uint32_t str(const std::string& value) {
+    pad(4);
+    size_t pos = buffer.size();
+    put<uint32_t>(static_cast<uint32_t>(value.size()));
+    buffer.insert(buffer.end(), value.begin(), value.end());
+    buffer.push_back(0);
+    return static_cast<uint32_t>(pos);
+  }
+
+  /// <summary>
+  /// Writes a vector of structs from their raw bytes returning its
+  /// position
+  /// </summary>
+  uint32_t structVector(const vector<uint8_t>& bytes, uint32_t count,
+                        size_t alignment) {
+    while ((buffer.size() + 4) % alignment != 0) {
+      buffer.push_back(0);
+    }
+    size_t pos = buffer.size();
+    put<uint32_t>(count);
+    buffer.insert(buffer.end(), bytes.begin(), bytes.end());
+    return static_cast<uint32_t>(pos);
+  }
+
+  /// <summary>
+  /// Writes a vector of tables returning its position
+  /// </summary>
+  uint32_t tableVector(const vector<std::function<uint32_t()>>& tables) {
+    pad(4);
+    size_t pos = buffer.size();
+    put<uint32_t>(static_cast<uint32_t>(tables.size()));
+    size_t slots = buffer.size();
+    buffer.resize(slots + 4 * tables.size(), 0);
+    for (size_t i = 0; i < tables.size(); i++) {
+      size_t slot = slots + 4 * i;
+      uint32_t child = tables[i]();
+      patch<uint32_t>(slot, static_cast<uint32_t>(child - slot));
+    }
+    return static_cast<uint32_t>(pos);
+  }
+
+  /// <summary>
+  /// Writes the root offset and root table provided by the writer,
+  /// the finished buffer is padded to 8 bytes
+  /// </summary>
+  vector<uint8_t> finish(const std::function<uint32_t()>& root) {
+    buffer.assign(4, 0);
+    patch<uint32_t>(0, root());
+    pad(8);
+    return buffer;
+  }
+
+ private:
+  static size_t inlineSize(const FlatField& field) {
+    return field.child ? 4 : field.scalar.size();
+  }
+};
+
+/// <summary>
+/// Bounds checked reader for flatbuffer encoded metadata
+/// </summary>
+class FlatReader {
+ public:
+  FlatReader(const vector<uint8_t>& data) : data(data) {}
+
+  template <typename T>
+  T read(size_t pos) const {
+    if (pos > data.size() || data.size() - pos < sizeof(T)) {
+      throw std::runtime_error("Arrow metadata is truncated");
+    }
+    T value;
+    memcpy(&value, &data[pos], sizeof(T));
+    return value;
+  }
+
+  size_t root() const { return read<uint32_t>(0); }
+
+  /// <summary>
+  /// Provides the position of a field within a table or zero if the
+  /// field is not present
+  /// </summary>
+  size_t field(size_t table, uint16_t id) const {
+    int64_t vtable = static_cast<int64_t>(table) - read<int32_t>(table);
+    if (vtable < 0) {
+      throw std::runtime_error("Arrow metadata has an invalid vtable");
+    }
+    uint16_t vtableSize = read<uint16_t>(static_cast<size_t>(vtable));
+    size_t entry = 4 + 2 * static_cast<size_t>(id);
+    if (entry + 2 > vtableSize) {
+      return 0;
+    }
+    uint16_t offset = read<uint16_t>(static_cast<size_t>(vtable) + entry);
+    return offset == 0 ? 0 : table + offset;
+  }
+
+  template <typename T>
+  T scalar(size_t table, uint16_t id, T fallback) const {
+    size_t pos = field(table, id);
+    return pos == 0 ? fallback : read<T>(pos);
+  }
+
+  /// <summary>
+  /// Provides the position of the object referenced by a field or zero
+  /// if the field is not present
+  /// </summary>
+  size_t offset(size_t table, uint16_t id) const {
+    size_t pos = field(table, id);
+    return pos == 0 ? 0 : pos + read<uint32_t>(pos);
+  }
+
+  string str(size_t table, uint16_t id) const {
+    size_t pos = offset(table, id);
+    if (pos == 0) {
+      return string();
+    }
+    uint32_t length = read<uint32_t>(pos);
+    if (data.size() - pos - 4 < length) {
+      throw std::runtime_error("Arrow metadata is truncated");
+    }
+    return string(reinterpret_cast<const char*>(&data[pos + 4]), length);
+  }
+
+  /// <summary>
+  /// Provides the position of the table at the provided index within a
+  /// vector of tables
+  /// </summary>
+  size_t element(size_t vector, uint32_t index) const {
+    size_t slot = vector + 4 + 4 * static_cast<size_t>(index);
+    return slot + read<uint32_t>(slot);
+  }
+
+ private:
+  const vector<uint8_t>& data;
+};
+
+/// <summary>
+/// Column of an exported collection
+/// </summary>
+struct ExportColumn {
+  string name;
+  DataValue::Type type;
+};
+
+/// <summary>
+/// Arrow Block struct describing a message location within a file
+/// </summary>
+struct ArrowBlock {
+  int64_t offset;
+  int32_t metaDataLength;
+  int64_t bodyLength;
+};
+
+/// <summary>
+/// Determines the columns for the collection, failing if any key holds
+/// more than one type of value
+/// </summary>
+static vector<ExportColumn> inferColumns(
+    const DataObjectCollection& collection) {
+  map<string, DataValue::Type> types;
+  for (const DataObject& object : collection.getObjects()) {
+    for (const std::pair<const string, DataValue>& entry :
+         object.getEntries()) {
+      DataValue::Type type = entry.second.getType();
+      map<string, DataValue::Type>::iterator existing =
+          types.find(entry.first);
+      if (existing == types.end()) {
+        types[entry.first] = type;
+      } else if (existing->second != type) {
+        throw std::runtime_error(
+            "Collection is not schema-homogeneous, key \"" + entry.first +
+            "\" holds multiple value types");
+      }
+    }
+  }
+
+  vector<ExportColumn> columns;
+  for (const std::pair<const string, DataValue::Type>& type : types) {
+    columns.push_back(ExportColumn{type.first, type.second});
+  }
+  return columns;
+}
+
+static uint32_t writeField(FlatBuilder& builder, const ExportColumn& column) {
+  uint8_t typeType;
+  std::function<uint32_t()> typeTable;
+  switch (column.type) {
+    case DataValue::STRING:
+      typeType = TYPE_UTF8;
+      typeTable = [&builder] { return builder.table({}); };
+      break;
+    case DataValue::INTEGER:
+      typeType = TYPE_INT;
+      typeTable = [&builder] {
+        return builder.table(
+            {scalarField<int32_t>(0, 32), scalarField<uint8_t>(1, 1)});
+      };
+      break;
+    case DataValue::FLOAT:
+    default:
+      typeType = TYPE_FLOATING_POINT;
+      typeTable = [&builder] {
+        return builder.table({scalarField<int16_t>(0, PRECISION_SINGLE)});
+      };
+      break;
+  }
+
+  return builder.table({
+      offsetField(0, [&] { return builder.str(column.name); }),
+      scalarField<uint8_t>(1, 1),
+      scalarField<uint8_t>(2, typeType),
+      offsetField(3, typeTable),
+      offsetField(5, [&] { return builder.tableVector({}); }),
+  });
+}
+
+static uint32_t writeSchema(FlatBuilder& builder,
+                            const vector<ExportColumn>& columns) {
+  return builder.table({
+      scalarField<int16_t>(0, 0),
+      offsetField(1,
+                  [&] {
+                    vector<std::function<uint32_t()>> fields;
+                    for (const ExportColumn& column : columns) {
+                      fields.push_back([&builder, &column] {
+                        return writeField(builder, column);
+                      });
+                    }
+                    return builder.tableVector(fields);
+                  }),
+  });
+}
+
+static vector<uint8_t> buildMessage(
+    uint8_t headerType, const std::function<uint32_t(FlatBuilder&)>& header,
+    int64_t bodyLength) {
+  FlatBuilder builder;
+  return builder.finish([&] {
+    return builder.table({
+        scalarField<int16_t>(0, METADATA_VERSION),
+        scalarField<uint8_t>(1, headerType),
+        offsetField(2, [&] { return header(builder); }),
+        scalarField<int64_t>(3, bodyLength),
+    });
+  });
+}
+
+/// <summary>
+/// Writes encapsulated messages to a stream keeping track of the
+/// position and location of each message
+/// </summary>
+class IpcWriter {
+ public:
+  IpcWriter(std::ostream& stream) : stream(stream), position(0) {}
+
+  void write(const void* data, size_t length) {
+    stream.write(reinterpret_cast<const char*>(data), length);
+    if (stream.fail()) {
+      throw std::runtime_error("Error while writing Arrow IPC data");
+    }
+    position += length;
+  }
+
+  ArrowBlock writeMessage(const vector<uint8_t>& metadata,
+                     const vector<uint8_t>& body) {
+    ArrowBlock block;
+    block.offset = static_cast<int64_t>(position);
+    block.metaDataLength = static_cast<int32_t>(8 + metadata.size());
+    block.bodyLength = static_cast<int64_t>(body.size());
+
+    int32_t length = static_cast<int32_t>(metadata.size());
+    write(&CONTINUATION, sizeof(CONTINUATION));
+    write(&length, sizeof(length));
+    write(metadata.data(), metadata.size());
+    write(body.data(), body.size());
+    return block;
+  }
+
+  void writeEnd() {
+    int32_t zero = 0;
+    write(&CONTINUATION, sizeof(CONTINUATION));
+    write(&zero, sizeof(zero));
+  }
+
+  std::ostream& stream;
+  uint64_t position;
+};
+
+/// <summary>
+/// Record batch body under construction
+/// </summary>
+struct BatchBody {
+  vector<uint8_t> bytes;
+  vector<int64_t> nodes;
+  vector<int64_t> buffers;
+
+  void appendBuffer(const void* data, size_t length) {
+    buffers.push_back(static_cast<int64_t>(bytes.size()));
+    buffers.push_back(static_cast<int64_t>(length));
+    const uint8_t* start = reinterpret_cast<const uint8_t*>(data);
+    bytes.insert(bytes.end(), start, start + length);
+    while (bytes.size() % 8 != 0) {
+      bytes.push_back(0);
+    }
+  }
+};
+
+static void writeBatch(IpcWriter& writer, vector<ArrowBlock>& blocks,
+                       const vector<DataObject>& objects, size_t begin,
+                       size_t end, const vector<ExportColumn>& columns) {
+  size_t rows = end - begin;
+  BatchBody body;
+
+  for (const ExportColumn& column : columns) {
+    vector<uint8_t> validity((rows + 7) / 8, 0);
+    int64_t nullCount = 0;
+    vector<int32_t> offsets;
+    string chars;
+    vector<int32_t> ints;
+    vector<float> floats;
+
+    if (column.type == DataValue::STRING) {
+      offsets.reserve(rows + 1);
+      offsets.push_back(0);
+    } else if (column.type == DataValue::INTEGER) {
+      ints.assign(rows, 0);
+    } else {
+      floats.assign(rows, 0.0f);
+    }
+
+    for (size_t row = 0; row < rows; row++) {
+      const EntryMap& entries = objects[begin + row].getEntries();
+      EntryMap::const_iterator value = entries.find(column.name);
+      bool present = value != entries.end();
+      if (present) {
+        validity[row / 8] |= static_cast<uint8_t>(1 << (row % 8));
+      } else {
+        nullCount++;
+      }
+
+      if (column.type == DataValue::STRING) {
+        if (present) {
+          chars += *value->second.asString();
+          if (chars.size() > static_cast<size_t>(
+                                 std::numeric_limits<int32_t>::max())) {
+            throw std::runtime_error(
+                "Arrow string column exceeds the 2GB batch limit");
+          }
+        }
+        offsets.push_back(static_cast<int32_t>(chars.size()));
+      } else if (present && column.type == DataValue::INTEGER) {
+        ints[row] = *value->second.asInt();
+      } else if (present) {
+        floats[row] = *value->second.asFloat();
+      }
+    }
+
+    body.nodes.push_back(static_cast<int64_t>(rows));
+    body.nodes.push_back(nullCount);
+
+    // The validity bitmap can be omitted when there are no nulls
+    body.appendBuffer(validity.data(), nullCount == 0 ? 0 : validity.size());
+    if (column.type == DataValue::STRING) {
+      body.appendBuffer(offsets.data(), offsets.size() * sizeof(int32_t));
+      body.appendBuffer(chars.data(), chars.size());
+    } else if (column.type == DataValue::INTEGER) {
+      body.appendBuffer(ints.data(), ints.size() * sizeof(int32_t));
+    } else {
+      body.appendBuffer(floats.data(), floats.size() * sizeof(float));
+    }
+  }
+
+  vector<uint8_t> nodeBytes(body.nodes.size() * sizeof(int64_t));
+  memcpy(nodeBytes.data(), body.nodes.data(), nodeBytes.size());
+  vector<uint8_t> bufferBytes(body.buffers.size() * sizeof(int64_t));
+  memcpy(bufferBytes.data(), body.buffers.data(), bufferBytes.size());
+
+  vector<uint8_t> metadata = buildMessage(
+      HEADER_RECORD_BATCH,
+      [&](FlatBuilder& builder) {
+        return builder.table({
+            scalarField<int64_t>(0, static_cast<int64_t>(rows)),
+            offsetField(1,
+                        [&] {
+                          return builder.structVector(
+                              nodeBytes,
+                              static_cast<uint32_t>(body.nodes.size() / 2), 8);
+                        }),
+            offsetField(2,
+                        [&] {
+                          return builder.structVector(
+                              bufferBytes,
+                              static_cast<uint32_t>(body.buffers.size() / 2),
+                              8);
+                        }),
+        });
+      },
+      static_cast<int64_t>(body.bytes.size()));
+
+  blocks.push_back(writer.writeMessage(metadata, body.bytes));
+}
+
+/// <summary>
+/// Writes the schema message followed by the record batches, the
+/// locations of the record batches are stored in the provided blocks
+/// </summary>
+static vector<ExportColumn> writeMessages(
+    IpcWriter& writer, const DataObjectCollection& collection,
+    uint32_t batchRows, vector<ArrowBlock>& blocks) {
+  if (batchRows == 0) {
+    throw std::invalid_argument("Arrow batch rows must be greater than zero");
+  }
+
+  vector<ExportColumn> columns = inferColumns(collection);
+
+  vector<uint8_t> schema = buildMessage(
+      HEADER_SCHEMA,
+      [&](FlatBuilder& builder) { return writeSchema(builder, columns); }, 0);
+  writer.writeMessage(schema, vector<uint8_t>());
+
+  const vector<DataObject>& objects = collection.getObjects();
+  for (size_t begin = 0; begin < objects.size(); begin += batchRows) {
+    size_t end = std::min(objects.size(), begin + batchRows);
+    writeBatch(writer, blocks, objects, begin, end, columns);
+  }
+
+  writer.writeEnd();
+  return columns;
+}
+
+/// <summary>
+/// Column of an imported Arrow schema
+/// </summary>
+struct ImportColumn {
+  string name;
+  uint8_t type;
+  int32_t bitWidth;
+  bool isSigned;
+  int16_t precision;
+};
+
+static vector<ImportColumn> readSchema(const FlatReader& reader,
+                                       size_t schema) {
+  vector<ImportColumn> columns;
+  size_t fields = reader.offset(schema, 1);
+  if (fields == 0) {
+    return columns;
+  }
+
+  uint32_t count = reader.read<uint32_t>(fields);
+  for (uint32_t i = 0; i < count; i++) {
+    size_t field = reader.element(fields, i);
+
+    if (reader.offset(field, 4) != 0) {
+      throw std::runtime_error("Dictionary encoded Arrow columns are not "
+                               "supported");
+    }
+
+    ImportColumn column;
+    column.name = reader.str(field, 0);
+    column.type = reader.scalar<uint8_t>(field, 2, 0);
+    column.bitWidth = 0;
+    column.isSigned = false;
+    column.precision = 0;
+
+    size_t type = reader.offset(field, 3);
+    if (column.type == TYPE_INT) {
+      column.bitWidth = reader.scalar<int32_t>(type, 0, 0);
+      column.isSigned = reader.scalar<uint8_t>(type, 1, 0) != 0;
+      if (column.bitWidth != 8 && column.bitWidth != 16 &&
+          column.bitWidth != 32 && column.bitWidth != 64) {
+        throw std::runtime_error("Unsupported Arrow integer width");
+      }
+    } else if (column.type == TYPE_FLOATING_POINT) {
+      column.precision = reader.scalar<int16_t>(type, 0, 0);
+      if (column.precision != PRECISION_SINGLE &&
+          column.precision != PRECISION_DOUBLE) {
+        throw std::runtime_error("Unsupported Arrow floating point precision");
+      }
+    } else if (column.type != TYPE_UTF8) {
+      throw std::runtime_error("Unsupported Arrow column type for column \"" +
+                               column.name + "\"");
+    }
+
+    columns.push_back(column);
+  }
+  return columns;
+}
+
+/// <summary>
+/// Location of a column buffer within a record batch body
+/// </summary>
+struct BufferSpan {
+  const uint8_t* data;
+  size_t length;
+};
+
+/// <summary>
+/// Reads a value from a buffer at the provided element index
+/// </summary>
+template <typename T>
+static T readElement(const BufferSpan& buffer, size_t index) {
+  if ((index + 1) * sizeof(T) > buffer.length) {
+    throw std::runtime_error("Arrow column buffer is truncated");
+  }
+  T value;
+  memcpy(&value, buffer.data + index * sizeof(T), sizeof(T));
+  return value;
+}
+
+static int32_t readInteger(const ImportColumn& column,
+                           const BufferSpan& buffer, size_t row) {
+  int64_t value;
+  switch (column.bitWidth) {
+    case 8:
+      value = column.isSigned ? readElement<int8_t>(buffer, row)
+                              : readElement<uint8_t>(buffer, row);
+      break;
+    case 16:
+      value = column.isSigned ? readElement<int16_t>(buffer, row)
+                              : readElement<uint16_t>(buffer, row);
+      break;
+    case 32:
+      value = column.isSigned ? readElement<int32_t>(buffer, row)
+                              : readElement<uint32_t>(buffer, row);
+      break;
+    default: {
+      uint64_t raw = readElement<uint64_t>(buffer, row);
+      if (!column.isSigned &&
+          raw > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+        throw std::out_of_range("Arrow integer does not fit in an INTEGER");
+      }
+      value = static_cast<int64_t>(raw);
+      break;
+    }
+  }
+
+  if (value < std::numeric_limits<int32_t>::min() ||
+      value > std::numeric_limits<int32_t>::max()) {
+    throw std::out_of_range("Arrow integer does not fit in an INTEGER");
+  }
+  return static_cast<int32_t>(value);
+}
+
+static size_t readBatch(DataObjectCollection& collection,
+                        const FlatReader& reader, size_t batch,
+                        const vector<uint8_t>& body,
+                        const vector<ImportColumn>& columns) {
+  if (reader.offset(batch, 3) != 0) {
+    throw std::runtime_error("Compressed Arrow record batches are not "
+                             "supported");
+  }
+
+  int64_t length = reader.scalar<int64_t>(batch, 0, 0);
+  size_t nodes = reader.offset(batch, 1);
+  size_t buffers = reader.offset(batch, 2);
+  if (length < 0 || nodes == 0 || buffers == 0 ||
+      reader.read<uint32_t>(nodes) < columns.size()) {
+    throw std::runtime_error("Arrow record batch is malformed");
+  }
+
+  uint32_t bufferCount = reader.read<uint32_t>(buffers);
+  uint32_t nextBuffer = 0;
+
+  // Resolve the validity and data buffers for each column
+  vector<vector<BufferSpan>> spans(columns.size());
+  for (size_t i = 0; i < columns.size(); i++) {
+    size_t needed = columns[i].type == TYPE_UTF8 ? 3 : 2;
+    for (size_t j = 0; j < needed; j++) {
+      if (nextBuffer >= bufferCount) {
+        throw std::runtime_error("Arrow record batch is missing buffers");
+      }
+      size_t entry = buffers + 4 + 16 * static_cast<size_t>(nextBuffer++);
+      int64_t offset = reader.read<int64_t>(entry);
+      int64_t size = reader.read<int64_t>(entry + 8);
+      if (offset < 0 || size < 0 ||
+          static_cast<uint64_t>(offset) + static_cast<uint64_t>(size) >
+              body.size()) {
+        throw std::runtime_error("Arrow buffer is outside the message body");
+      }
+      spans[i].push_back(BufferSpan{body.data() + offset,
+                                    static_cast<size_t>(size)});
+    }
+  }
+
+  size_t rows = static_cast<size_t>(length);
+  for (size_t row = 0; row < rows; row++) {
+    DataObject* object = collection.createObject();
+
+    for (size_t i = 0; i < columns.size(); i++) {
+      const ImportColumn& column = columns[i];
+      const vector<BufferSpan>& span = spans[i];
+
+      // Empty validity buffers mean every value is present
+      if (span[0].length != 0) {
+        uint8_t bits = readElement<uint8_t>(span[0], row / 8);
+        if ((bits & (1 << (row % 8))) == 0) {
+          continue;
+        }
+      }
+
+      if (column.type == TYPE_UTF8) {
+        int32_t start = readElement<int32_t>(span[1], row);
+        int32_t end = readElement<int32_t>(span[1], row + 1);
+        if (start < 0 || end < start ||
+            static_cast<size_t>(end) > span[2].length) {
+          throw std::runtime_error("Arrow string offsets are invalid");
+        }
+        object->setEntry(
+            column.name,
+            DataValue(string(
+                reinterpret_cast<const char*>(span[2].data) + start,
+                static_cast<size_t>(end - start))));
+      } else if (column.type == TYPE_INT) {
+        object->setEntry(column.name,
+                         DataValue(readInteger(column, span[1], row)));
+      } else if (column.precision == PRECISION_SINGLE) {
+        object->setEntry(column.name,
+                         DataValue(readElement<float>(span[1], row)));
+      } else {
+        object->setEntry(column.name,
+                         DataValue(static_cast<float>(
+                             readElement<double>(span[1], row))));
+      }
+    }
+  }
+
+  return rows;
+}
+
+/// <summary>
+/// Reads encapsulated messages from the stream until the end of stream
+/// marker is reached, creating objects for each row
+/// </summary>
+static size_t readMessages(DataObjectCollection& collection,
+                           std::istream& stream) {
+  vector<ImportColumn> columns;
+  bool hasSchema = false;
+  size_t created = 0;
+
+  while (true) {
+    uint32_t marker;
+    stream.read(reinterpret_cast<char*>(&marker), sizeof(marker));
+    if (stream.eof()) {
+      break;
+    }
+
+    // Messages written before the continuation marker was introduced
+    // start directly with the metadata length
+    int32_t length = static_cast<int32_t>(marker);
+    if (marker == CONTINUATION) {
+      stream.read(reinterpret_cast<char*>(&length), sizeof(length));
+    }
+
+    if (stream.fail() || length < 0) {
+      throw std::runtime_error("Error while reading Arrow message length");
+    }
+
+    // A zero length marks the end of the stream
+    if (length == 0) {
+      break;
+    }
+
+    vector<uint8_t> metadata(static_cast<size_t>(length));
+    stream.read(reinterpret_cast<char*>(metadata.data()), length);
+    if (stream.fail()) {
+      throw std::runtime_error("Error while reading Arrow message metadata");
+    }
+
+    FlatReader reader(metadata);
+    size_t message = reader.root();
+    uint8_t headerType = reader.scalar<uint8_t>(message, 1, 0);
+    size_t header = reader.offset(message, 2);
+    int64_t bodyLength = reader.scalar<int64_t>(message, 3, 0);
+    if (bodyLength < 0 || header == 0) {
+      throw std::runtime_error("Arrow message is malformed");
+    }
+
+    vector<uint8_t> body(static_cast<size_t>(bodyLength));
+    stream.read(reinterpret_cast<char*>(body.data()), bodyLength);
+    if (stream.fail()) {
+      throw std::runtime_error("Error while reading Arrow message body");
+    }
+
+    if (headerType == HEADER_SCHEMA) {
+      columns = readSchema(reader, header);
+      hasSchema = true;
+    } else if (headerType == HEADER_RECORD_BATCH) {
+      if (!hasSchema) {
+        throw std::runtime_error("Arrow record batch received before schema");
+      }
+      created += readBatch(collection, reader, header, body, columns);
+    } else {
+      throw std::runtime_error("Unsupported Arrow message type");
+    }
+  }
+
+  return created;
+}
+
+void ArrowIpc::exportStream(const DataObjectCollection& collection,
+                            std::ostream& stream,
+                            uint32_t batchRows) {
+  IpcWriter writer(stream);
+  vector<ArrowBlock> blocks;
+  writeMessages(writer, collection, batchRows, blocks);
+}
+
+void ArrowIpc::exportFile(const DataObjectCollection& collection,
+                          const string& path,
+                          uint32_t batchRows) {
+  ofstream stream(path.c_str(), ios::binary | ios::trunc);
+
+  if (!stream.is_open()) {
+    throw std::runtime_error("Failed to open stream to Arrow file");
+  }
+
+  IpcWriter writer(stream);
+  writer.write(FILE_MAGIC, sizeof(FILE_MAGIC));
+
+  vector<ArrowBlock> blocks;
+  vector<ExportColumn> columns =
+      writeMessages(writer, collection, batchRows, blocks);
+
+  // Footer repeats the schema and indexes the record batches
+  vector<uint8_t> blockBytes;
+  for (const ArrowBlock& block : blocks) {
+    uint8_t bytes[24] = {0};
+    memcpy(bytes, &block.offset, 8);
+    memcpy(bytes + 8, &block.metaDataLength, 4);
+    memcpy(bytes + 16, &block.bodyLength, 8);
+    blockBytes.insert(blockBytes.end(), bytes, bytes + sizeof(bytes));
+  }
+
+  FlatBuilder builder;
+  vector<uint8_t> footer = builder.finish([&] {
+    return builder.table({
+        scalarField<int16_t>(0, METADATA_VERSION),
+        offsetField(1, [&] { return writeSchema(builder, columns); }),
+        offsetField(2,
+                    [&] {
+                      return builder.structVector(vector<uint8_t>(), 0, 8);
+                    }),
+        offsetField(3,
+                    [&] {
+                      return builder.structVector(
+                          blockBytes, static_cast<uint32_t>(blocks.size()), 8);
+                    }),
+    });
+  });
+
+  int32_t footerLength = static_cast<int32_t>(footer.size());
+  writer.write(footer.data(), footer.size());
+  writer.write(&footerLength, sizeof(footerLength));
+  writer.write(FILE_MAGIC, FILE_MAGIC_LENGTH);
+
+  // Close the finished stream
+  stream.close();
+}
+
+size_t ArrowIpc::importStream(DataObjectCollection& collection,
+                              std::istream& stream) {
+  size_t created = readMessages(collection, stream);
+
+  // Save the database
+  collection.save();
+
+  return created;
+}
+
+size_t ArrowIpc::importFile(DataObjectCollection& collection,
+                            const string& path) {
+  ifstream stream(path, ios::binary);
+
+  if (!stream.is_open()) {
+    throw std::runtime_error("Failed to open stream to Arrow file");
+  }
+
+  char magic[sizeof(FILE_MAGIC)];
+  stream.read(magic, sizeof(magic));
+  if (stream.fail() || memcmp(magic, FILE_MAGIC, FILE_MAGIC_LENGTH) != 0) {
+    throw std::runtime_error("File is not an Arrow IPC file");
+  }
+
+  // The file body is a complete IPC stream, the footer follows the end
+  // of stream marker
+  return importStream(collection, stream);
+}
@@ -0,0 +1,83 @@
+#ifndef ARROW_IPC
+#define ARROW_IPC 1
+
+#include <iostream>
+#include <stdint.h>
+#include <string>
+
+#include "DataObject.hpp"
+
+using std::string;
+using std::uint32_t;
+
+/// <summary>
+/// Import and export of DataObjectCollections using the Apache Arrow
+/// IPC stream and file formats.
+///
+/// The collection must be schema-homogeneous to be exported, every key
+/// must always hold the same type of value. Objects missing a key are
+/// written as a null value for that column.
+///
+/// Values are mapped to the following Arrow types:
+///   STRING  -> Utf8
+///   INTEGER -> Int(32, signed)
+///   FLOAT   -> FloatingPoint(SINGLE)
+///
+/// Importing additionally accepts the narrower and wider integer and
+/// floating point types that common Arrow tools produce, these are
+/// converted to the closest DataValue type.
+/// </summary>
+class ArrowIpc {
+ public:
+  /// <summary>
+  /// Default number of rows written per record batch
+  /// </summary>
+  static const uint32_t DEFAULT_BATCH_ROWS = 65536;
+
+  /// <summary>
+  /// Writes the objects from the provided collection to the provided
+  /// stream in the Arrow IPC stream format
+  /// </summary>
+  /// <param name="collection">The collection to export</param>
+  /// <param name="stream">The stream to write to</param>
+  /// <param name="batchRows">The maximum rows per record batch</param>
+  static void exportStream(const DataObjectCollection& collection,
+                           std::ostream& stream,
+                           uint32_t batchRows = DEFAULT_BATCH_ROWS);
+
+  /// <summary>
+  /// Writes the objects from the provided collection to a file at the
+  /// provided path in the Arrow IPC file format
+  /// </summary>
+  /// <param name="collection">The collection to export</param>
+  /// <param name="path">The path of the file to write</param>
+  /// <param name="batchRows">The maximum rows per record batch</param>
+  static void exportFile(const DataObjectCollection& collection,
+                         const string& path,
+                         uint32_t batchRows = DEFAULT_BATCH_ROWS);
+
+  /// <summary>
+  /// Reads rows from an Arrow IPC stream creating a new object in the
+  /// provided collection for each row. Null values are not stored as
+  /// entries.
+  ///
+  /// Saves the object collection once all the rows are imported
+  /// </summary>
+  /// <param name="collection">The collection to import into</param>
+  /// <param name="stream">The stream to read from</param>
+  /// <returns>The number of objects created</returns>
+  static size_t importStream(DataObjectCollection& collection,
+                             std::istream& stream);
+
+  /// <summary>
+  /// Reads rows from an Arrow IPC file at the provided path, see
+  /// importStream
+  /// </summary>
+  /// <param name="collection">The collection to import into</param>
+  /// <param name="path">The path of the file to read</param>
+  /// <returns>The number of objects created</returns>
+  static size_t importFile(DataObjectCollection& collection,
+                           const string& path);
+};
+
+#endif
@@ -0,0 +1,374 @@
+#include "BitPackedIntColumn.hpp"
+
+#include <algorithm>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BIT_PACKED_SSE2 1
+#endif
+
+using std::int32_t;
+using std::int64_t;
+using std::istream;
+using std::map;
+using std::ostream;
+using std::string;
+using std::uint32_t;
+using std::uint64_t;
+using std::uint8_t;
+using std::vector;
+
+/// <summary>
+/// Number of interleaved lanes each block is packed into
+/// </summary>
+static const uint32_t LANES = 4;
+
+/// <summary>
+/// Number of values packed into each lane of a block
+/// </summary>
+static const uint32_t LANE_VALUES = BitPackedIntColumn::BLOCK_SIZE / LANES;
+
+/// <summary>
+/// Provides the number of bits needed to store the provided value
+/// </summary>
+static uint32_t bitWidth(uint32_t value) {
+  uint32_t width = 0;
+  while (value != 0) {
+    value >>= 1;
+    width++;
+  }
+  return width;
+}
+
+/// <summary>
+/// Packs a full block of offsets. Value i is stored in lane i % 4 and
+/// lane words are interleaved, so word k of every lane forms one 128 bit
+/// vector
+/// </summary>
+static void packBlock(const uint32_t* offsets, uint32_t width, uint32_t* out) {
+  for (uint32_t lane = 0; lane < LANES; lane++) {
+    uint32_t bit = 0;
+    uint32_t word = 0;
+
+    for (uint32_t i = 0; i < LANE_VALUES; i++) {
+      uint32_t value = offsets[i * LANES + lane];
+      out[word * LANES + lane] |= value << bit;
+
+      // Value continues into the next word
+      if (bit + width > 32) {
+        out[(word + 1) * LANES + lane] |= value >> (32 - bit);
+      }
+
+      bit += width;
+      if (bit >= 32) {
+        bit -= 32;
+        word++;
+      }
+    }
+  }
+}
+
+/// <summary>
+/// Unpacks a full block of offsets adding the frame of reference
+/// </summary>
+static void unpackOffsets(const uint32_t* in, uint32_t width, int32_t base,
+                          int32_t* out) {
+  if (width == 0) {
+    std::fill(out, out + BitPackedIntColumn::BLOCK_SIZE, base);
+    return;
+  }
+
+  uint32_t mask = width == 32 ? 0xFFFFFFFFu : (1u << width) - 1;
+
+#ifdef BIT_PACKED_SSE2
+  const __m128i* vectors = reinterpret_cast<const __m128i*>(in);
+  __m128i maskVector = _mm_set1_epi32(static_cast<int32_t>(mask));
+  __m128i baseVector = _mm_set1_epi32(base);
+  __m128i current = _mm_loadu_si128(vectors);
+  uint32_t bit = 0;
+  uint32_t word = 0;
+
+  for (uint32_t i = 0; i < LANE_VALUES; i++) {
+    __m128i value = _mm_srl_epi32(current, _mm_cvtsi32_si128(bit));
+
+    // Value continues into the next word
+    if (bit + width > 32) {
+      __m128i next = _mm_loadu_si128(vectors + word + 1);
+      value = _mm_or_si128(
+          value, _mm_sll_epi32(next, _mm_cvtsi32_si128(32 - bit)));
+    }
+
+    value = _mm_add_epi32(_mm_and_si128(value, maskVector), baseVector);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * LANES), value);
+
+    bit += width;
+    if (bit >= 32) {
+      bit -= 32;
+      word++;
+      if (word < width) {
+        current = _mm_loadu_si128(vectors + word);
+      }
+    }
+  }
+#else
+  uint32_t bit = 0;
+  uint32_t word = 0;
+
+  for (uint32_t i = 0; i < LANE_VALUES; i++) {
+    // Same offsets for every lane, the inner loop vectorizes
+    for (uint32_t lane = 0; lane < LANES; lane++) {
+      uint32_t value = in[word * LANES + lane] >> bit;
+      if (bit + width > 32) {
+        value |= in[(word + 1) * LANES + lane] << (32 - bit);
+      }
+      out[i * LANES + lane] = static_cast<int32_t>(
+          (value & mask) + static_cast<uint32_t>(base));
+    }
+
+    bit += width;
+    if (bit >= 32) {
+      bit -= 32;
+      word++;
+    }
+  }
+#endif
+}
+
+BitPackedIntColumn::BitPackedIntColumn() : count(0), blocks{}, words{} {}
+
+BitPackedIntColumn::BitPackedIntColumn(const vector<int32_t>& values)
+    : count(values.size()), blocks{}, words{} {
+  uint32_t offsets[BLOCK_SIZE];
+
+  for (size_t start = 0; start < values.size(); start += BLOCK_SIZE) {
+    size_t end = std::min(values.size(), start + BLOCK_SIZE);
+
+    BitPackedBlock block;
+    block.min = *std::min_element(values.begin() + start, values.begin() + end);
+    block.max = *std::max_element(values.begin() + start, values.begin() + end);
+    block.width = bitWidth(static_cast<uint32_t>(block.max) -
+                           static_cast<uint32_t>(block.min));
+    block.offset = static_cast<uint32_t>(words.size());
+
+    // Partial blocks are padded with the minimum
+    std::fill(offsets, offsets + BLOCK_SIZE, 0);
+    for (size_t i = start; i < end; i++) {
+      offsets[i - start] = static_cast<uint32_t>(values[i]) -
+                           static_cast<uint32_t>(block.min);
+    }
+
+    // Constant blocks have no packed words
+    if (block.width > 0) {
+      words.resize(words.size() + block.width * LANES, 0);
+      packBlock(offsets, block.width, words.data() + block.offset);
+    }
+    blocks.push_back(block);
+  }
+}
+
+BitPackedIntColumn BitPackedIntColumn::fromCollection(
+    const DataObjectCollection& collection, const string& key) {
+  vector<int32_t> values;
+  values.reserve(collection.getObjects().size());
+
+  for (const DataObject& object : collection.getObjects()) {
+    const EntryMap& entries = object.getEntries();
+    EntryMap::const_iterator entry = entries.find(key);
+    if (entry != entries.end() && entry->second.asInt() != nullptr) {
+      values.push_back(*entry->second.asInt());
+    }
+  }
+
+  return BitPackedIntColumn(values);
+}
+
+size_t BitPackedIntColumn::size() const {
+  return count;
+}
+
+size_t BitPackedIntColumn::getEncodedSize() const {
+  return words.size() * sizeof(uint32_t) +
+         blocks.size() * sizeof(BitPackedBlock);
+}
+
+size_t BitPackedIntColumn::getBlockCount(size_t block) const {
+  return std::min<size_t>(BLOCK_SIZE, count - block * BLOCK_SIZE);
+}
+
+int32_t BitPackedIntColumn::get(size_t index) const {
+  if (index >= count) {
+    throw std::out_of_range("Bit packed column index out of range");
+  }
+
+  const BitPackedBlock& block = blocks[index / BLOCK_SIZE];
+  if (block.width == 0) {
+    return block.min;
+  }
+
+  // Locate the bits of the value within its lane
+  uint32_t position = static_cast<uint32_t>(index % BLOCK_SIZE);
+  uint32_t lane = position % LANES;
+  uint32_t start = (position / LANES) * block.width;
+  uint32_t word = start / 32;
+  uint32_t bit = start % 32;
+
+  const uint32_t* in = words.data() + block.offset;
+  uint32_t value = in[word * LANES + lane] >> bit;
+  if (bit + block.width > 32) {
+    value |= in[(word + 1) * LANES + lane] << (32 - bit);
+  }
+
+  uint32_t mask = block.width == 32 ? 0xFFFFFFFFu : (1u << block.width) - 1;
+  return static_cast<int32_t>((value & mask) +
+                              static_cast<uint32_t>(block.min));
+}
+
+void BitPackedIntColumn::unpackBlock(size_t block, int32_t* out) const {
+  const BitPackedBlock& header = blocks[block];
+  unpackOffsets(words.data() + header.offset, header.width, header.min, out);
+}
+
+vector<int32_t> BitPackedIntColumn::decode() const {
+  vector<int32_t> values(blocks.size() * BLOCK_SIZE);
+  for (size_t block = 0; block < blocks.size(); block++) {
+    unpackBlock(block, values.data() + block * BLOCK_SIZE);
+  }
+
+  // Drop the padding from the last block
+  values.resize(count);
+  return values;
+}
+
+int64_t BitPackedIntColumn::sum() const {
+  int32_t values[BLOCK_SIZE];
+  int64_t total = 0;
+
+  for (size_t block = 0; block < blocks.size(); block++) {
+    size_t size = getBlockCount(block);
+
+    // Constant blocks don't need unpacking
+    if (blocks[block].width == 0) {
+      total += static_cast<int64_t>(blocks[block].min) * size;
+      continue;
+    }
+
+    unpackBlock(block, values);
+    for (size_t i = 0; i < size; i++) {
+      total += values[i];
+    }
+  }
+
+  return total;
+}
+
+int32_t BitPackedIntColumn::min() const {
+  if (blocks.empty()) {
+    throw std::out_of_range("Bit packed column is empty");
+  }
+
+  int32_t result = blocks[0].min;
+  for (const BitPackedBlock& block : blocks) {
+    result = std::min(result, block.min);
+  }
+  return result;
+}
+
+int32_t BitPackedIntColumn::max() const {
+  if (blocks.empty()) {
+    throw std::out_of_range("Bit packed column is empty");
+  }
+
+  int32_t result = blocks[0].max;
+  for (const BitPackedBlock& block : blocks) {
+    result = std::max(result, block.max);
+  }
+  return result;
+}
+
+size_t BitPackedIntColumn::countInRange(int32_t low, int32_t high) const {
+  int32_t values[BLOCK_SIZE];
+  size_t total = 0;
+
+  for (size_t block = 0; block < blocks.size(); block++) {
+    const BitPackedBlock& header = blocks[block];
+    size_t size = getBlockCount(block);
+
+    if (header.max < low || header.min > high) {
+      continue;
+    }
+    if (header.min >= low && header.max <= high) {
+      total += size;
+      continue;
+    }
+
+    unpackBlock(block, values);
+    for (size_t i = 0; i < size; i++) {
+      total += values[i] >= low && values[i] <= high;
+    }
+  }
+
+  return total;
+}
+
+void BitPackedIntColumn::serialize(ostream& stream) const {
+  uint64_t size = count;
+  stream.write(reinterpret_cast<const char*>(&size), sizeof(size));
+
+  // Block headers, offsets are recomputed from the widths when reading
+  for (const BitPackedBlock& block : blocks) {
+    uint8_t width = static_cast<uint8_t>(block.width);
+    stream.write(reinterpret_cast<const char*>(&block.min), sizeof(block.min));
+    stream.write(reinterpret_cast<const char*>(&block.max), sizeof(block.max));
+    stream.write(reinterpret_cast<const char*>(&width), sizeof(width));
+  }
+
+  stream.write(reinterpret_cast<const char*>(words.data()),
+               words.size() * sizeof(uint32_t));
+}
+
+void BitPackedIntColumn::deserialize(istream& stream) {
+  uint64_t size = 0;
+  stream.read(reinterpret_cast<char*>(&size), sizeof(size));
+
+  count = static_cast<size_t>(size);
+  blocks.clear();
+  words.clear();
+
+  size_t blockCount = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  uint32_t offset = 0;
+  for (size_t i = 0; i < blockCount && !stream.fail(); i++) {
+    BitPackedBlock block;
+    uint8_t width = 0;
+    stream.read(reinterpret_cast<char*>(&block.min), sizeof(block.min));
+    stream.read(reinterpret_cast<char*>(&block.max), sizeof(block.max));
+    stream.read(reinterpret_cast<char*>(&width), sizeof(width));
+
+    if (width > 32) {
+      throw std::runtime_error("Invalid bit packed column block width");
+    }
+
+    block.width = width;
+    block.offset = offset;
+    offset += block.width * LANES;
+    blocks.push_back(block);
+  }
+
+  if (stream.fail()) {
+    throw std::runtime_error("Error while reading bit packed column");
+  }
+
+  words.resize(offset);
+  stream.read(reinterpret_cast<char*>(words.data()),
+              words.size() * sizeof(uint32_t));
+
+  if (stream.fail()) {
+    throw std::runtime_error("Error while reading bit packed column");
+  }
+}
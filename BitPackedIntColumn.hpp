@@ -0,0 +1,174 @@
+#ifndef BIT_PACKED_INT_COLUMN
+#define BIT_PACKED_INT_COLUMN 1
+
+#include <istream>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "DataObject.hpp"
+
+using std::int32_t;
+using std::int64_t;
+using std::istream;
+using std::ostream;
+using std::string;
+using std::uint32_t;
+using std::uint8_t;
+using std::vector;
+
+/// <summary>
+/// Header describing a single packed block of a BitPackedIntColumn
+/// </summary>
+struct BitPackedBlock {
+  /// <summary>
+  /// The smallest value in the block, used as the frame of reference
+  /// </summary>
+  int32_t min;
+  /// <summary>
+  /// The largest value in the block
+  /// </summary>
+  int32_t max;
+  /// <summary>
+  /// The number of bits used for each value
+  /// </summary>
+  uint32_t width;
+  /// <summary>
+  /// The index of the first packed word of the block
+  /// </summary>
+  uint32_t offset;
+};
+
+/// <summary>
+/// Immutable column of INTEGER values compressed with frame-of-reference
+/// bit packing in blocks of 128 values.
+///
+/// Each block stores its values as offsets from the block minimum using
+/// only as many bits as the largest offset needs. Values are laid out in
+/// four interleaved lanes so a block is unpacked four values at a time
+/// with SSE2, without any per value type checks.
+///
+/// Block minimums and maximums allow aggregates and range counts to skip
+/// or answer whole blocks without unpacking them.
+/// </summary>
+class BitPackedIntColumn {
+ private:
+  /// <summary>
+  /// The number of values in the column
+  /// </summary>
+  size_t count;
+  /// <summary>
+  /// Headers for each block
+  /// </summary>
+  vector<BitPackedBlock> blocks;
+  /// <summary>
+  /// The packed words for all the blocks
+  /// </summary>
+  vector<uint32_t> words;
+
+  /// <summary>
+  /// Provides the number of values stored in the provided block
+  /// </summary>
+  size_t getBlockCount(size_t block) const;
+
+ public:
+  /// <summary>
+  /// The number of values in each block
+  /// </summary>
+  static const uint32_t BLOCK_SIZE = 128;
+
+  /// <summary>
+  /// Creates an empty column
+  /// </summary>
+  BitPackedIntColumn();
+
+  /// <summary>
+  /// Creates a column from the provided values
+  /// </summary>
+  /// <param name="values">The values to pack</param>
+  BitPackedIntColumn(const vector<int32_t>& values);
+
+  /// <summary>
+  /// Creates a column from the INTEGER values stored at the provided
+  /// key, in object ID order. Objects without an INTEGER at the key are
+  /// skipped
+  /// </summary>
+  /// <param name="collection">The collection to read from</param>
+  /// <param name="key">The entry key</param>
+  /// <returns>The packed column</returns>
+  static BitPackedIntColumn fromCollection(
+      const DataObjectCollection& collection, const string& key);
+
+  /// <summary>
+  /// Provides the number of values in the column
+  /// </summary>
+  size_t size() const;
+
+  /// <summary>
+  /// Provides the number of bytes used by the packed values and headers
+  /// </summary>
+  size_t getEncodedSize() const;
+
+  /// <summary>
+  /// Provides the value at the provided index, only the bits of that
+  /// value are read
+  /// </summary>
+  /// <param name="index">The index of the value</param>
+  /// <returns>The value</returns>
+  int32_t get(size_t index) const;
+
+  /// <summary>
+  /// Unpacks a full block of values into the provided output, which
+  /// must have room for BLOCK_SIZE values
+  /// </summary>
+  /// <param name="block">The index of the block</param>
+  /// <param name="out">The output values</param>
+  void unpackBlock(size_t block, int32_t* out) const;
+
+  /// <summary>
+  /// Unpacks every value in the column
+  /// </summary>
+  /// <returns>The values</returns>
+  vector<int32_t> decode() const;
+
+  /// <summary>
+  /// Provides the sum of all the values
+  /// </summary>
+  int64_t sum() const;
+
+  /// <summary>
+  /// Provides the smallest value, from the block headers alone. The
+  /// column must not be empty
+  /// </summary>
+  int32_t min() const;
+
+  /// <summary>
+  /// Provides the largest value, from the block headers alone. The
+  /// column must not be empty
+  /// </summary>
+  int32_t max() const;
+
+  /// <summary>
+  /// Counts the values within the inclusive range, blocks entirely
+  /// inside or outside the range are not unpacked
+  /// </summary>
+  /// <param name="low">The lowest value to count</param>
+  /// <param name="high">The highest value to count</param>
+  /// <returns>The number of values in the range</returns>
+  size_t countInRange(int32_t low, int32_t high) const;
+
+  /// <summary>
+  /// Serializes the column to the provided stream
+  /// </summary>
+  /// <param name="stream">The stream to write to</param>
+  void serialize(ostream& stream) const;
+
+  /// <summary>
+  /// Deserializes the column from the provided stream
+  /// </summary>
+  /// <param name="stream">The stream to read from</param>
+  void deserialize(istream& stream);
+};
+
+#endif
@@ -0,0 +1,326 @@
+#include "CollectionClient.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+using std::string;
+using std::uint32_t;
+using std::uint8_t;
+using std::vector;
+
+/// <summary>
+/// Buffered request bytes written without waiting for flush
+/// </summary>
+static const size_t FLUSH_THRESHOLD = 64 * 1024;
+
+/// <summary>
+/// Size of each read from the server
+/// </summary>
+static const size_t READ_CHUNK_SIZE = 64 * 1024;
+
+CollectionClient::CollectionClient(string path)
+    : descriptor(-1), output(), input(), inputOffset(0), pending(0) {
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw std::invalid_argument("Socket path is too long");
+  }
+  std::memcpy(address.sun_path, path.c_str(), path.size());
+
+  descriptor = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (descriptor < 0) {
+    throw std::runtime_error("Failed to create client socket");
+  }
+  if (::connect(descriptor, reinterpret_cast<sockaddr*>(&address),
+                sizeof(address)) != 0) {
+    ::close(descriptor);
+    throw std::runtime_error("Failed to connect to collection server");
+  }
+}
+
+CollectionClient::~CollectionClient() {
+  ::close(descriptor);
+}
+
+size_t CollectionClient::beginRequest(CollectionOperation operation) {
+  size_t offset = output.size();
+  appendU32(output, 0);
+  output.push_back(static_cast<uint8_t>(operation));
+  return offset;
+}
+
+void CollectionClient::finishRequest(size_t offset) {
+  uint32_t size =
+      static_cast<uint32_t>(output.size() - offset - COLLECTION_REQUEST_HEADER);
+  std::memcpy(output.data() + offset, &size, sizeof(size));
+  pending++;
+
+  if (output.size() >= FLUSH_THRESHOLD) {
+    flush();
+  }
+}
+
+void CollectionClient::sendGet(uint32_t id) {
+  size_t offset = beginRequest(CollectionOperation::GET);
+  appendU32(output, id);
+  finishRequest(offset);
+}
+
+void CollectionClient::sendStore(const DataObject& object) {
+  size_t offset = beginRequest(CollectionOperation::STORE);
+  object.encodeTo(output);
+  finishRequest(offset);
+}
+
+void CollectionClient::sendSet(const DataObject& object) {
+  size_t offset = beginRequest(CollectionOperation::SET);
+  object.encodeTo(output);
+  finishRequest(offset);
+}
+
+void CollectionClient::sendRemove(uint32_t id) {
+  size_t offset = beginRequest(CollectionOperation::REMOVE);
+  appendU32(output, id);
+  finishRequest(offset);
+}
+
+void CollectionClient::sendQuery(const DataObject& example, uint32_t limit) {
+  size_t offset = beginRequest(CollectionOperation::QUERY);
+  appendU32(output, limit);
+  example.encodeTo(output);
+  finishRequest(offset);
+}
+
+void CollectionClient::flush() {
+  size_t written = 0;
+  while (written < output.size()) {
+    ssize_t sent = ::send(descriptor, output.data() + written,
+                          output.size() - written,
+                          MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent > 0) {
+      written += static_cast<size_t>(sent);
+      continue;
+    }
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      waitWritable();
+      continue;
+    }
+    throw std::runtime_error("Failed to send requests to collection server");
+  }
+  output.clear();
+}
+
+void CollectionClient::waitWritable() {
+  pollfd events;
+  events.fd = descriptor;
+  events.events = POLLIN | POLLOUT;
+  events.revents = 0;
+  if (::poll(&events, 1, -1) < 0) {
+    if (errno == EINTR) {
+      return;
+    }
+    throw std::runtime_error("Failed to wait for collection server");
+  }
+
+  // The server stops reading requests while its responses aren't read,
+  // so buffer them until they are received
+  if ((events.revents & POLLIN) != 0) {
+    bufferResponses();
+  }
+}
+
+void CollectionClient::bufferResponses() {
+  if (inputOffset > 0) {
+    input.erase(input.begin(), input.begin() + inputOffset);
+    inputOffset = 0;
+  }
+
+  while (true) {
+    size_t offset = input.size();
+    input.resize(offset + READ_CHUNK_SIZE);
+    ssize_t received = ::recv(descriptor, input.data() + offset,
+                              READ_CHUNK_SIZE, MSG_DONTWAIT);
+    input.resize(offset + (received > 0 ? received : 0));
+    if (received > 0) {
+      continue;
+    }
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    throw std::runtime_error("Connection to collection server was lost");
+  }
+}
+
+void CollectionClient::receive(CollectionResponse& out) {
+  if (pending == 0) {
+    throw std::logic_error("No request is waiting for a response");
+  }
+  flush();
+
+  // Read until the buffer holds the whole frame, the header tells how
+  // much is needed once it has been read
+  size_t needed = COLLECTION_RESPONSE_HEADER;
+  while (true) {
+    size_t available = input.size() - inputOffset;
+    if (available >= COLLECTION_RESPONSE_HEADER) {
+      uint32_t size = readU32(input.data() + inputOffset);
+      if (size > COLLECTION_MAX_FRAME) {
+        throw std::runtime_error("Collection server response is too large");
+      }
+      needed = COLLECTION_RESPONSE_HEADER + size;
+    }
+    if (available >= needed) {
+      break;
+    }
+
+    // Drop the received responses before growing the buffer
+    if (inputOffset > 0) {
+      input.erase(input.begin(), input.begin() + inputOffset);
+      inputOffset = 0;
+    }
+    size_t offset = input.size();
+    input.resize(offset + READ_CHUNK_SIZE);
+    ssize_t received =
+        ::recv(descriptor, input.data() + offset, READ_CHUNK_SIZE, 0);
+    input.resize(offset + (received > 0 ? received : 0));
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      throw std::runtime_error("Connection to collection server was lost");
+    }
+  }
+
+  const uint8_t* frame = input.data() + inputOffset;
+  const uint8_t* body = frame + COLLECTION_RESPONSE_HEADER;
+  size_t size = needed - COLLECTION_RESPONSE_HEADER;
+  inputOffset += needed;
+  pending--;
+
+  out.operation = static_cast<CollectionOperation>(frame[sizeof(uint32_t)]);
+  out.status = static_cast<CollectionStatus>(frame[sizeof(uint32_t) + 1]);
+  out.id = 0;
+  out.version = 0;
+  out.objects.clear();
+  out.error.clear();
+
+  if (out.status == CollectionStatus::FAILED) {
+    out.error.assign(reinterpret_cast<const char*>(body), size);
+    return;
+  }
+  if (out.status != CollectionStatus::OK &&
+      out.status != CollectionStatus::TRUNCATED) {
+    return;
+  }
+
+  switch (out.operation) {
+    case CollectionOperation::GET: {
+      out.objects.resize(1);
+      out.objects[0].decodeFrom(body, size);
+      break;
+    }
+    case CollectionOperation::STORE:
+    case CollectionOperation::SET: {
+      if (size < 2 * sizeof(uint32_t)) {
+        throw std::runtime_error("Malformed collection server response");
+      }
+      out.id = readU32(body);
+      out.version = readU32(body + sizeof(uint32_t));
+      break;
+    }
+    case CollectionOperation::QUERY: {
+      if (size < sizeof(uint32_t)) {
+        throw std::runtime_error("Malformed collection server response");
+      }
+      uint32_t count = readU32(body);
+      out.objects.resize(count);
+      size_t position = sizeof(uint32_t);
+      for (uint32_t i = 0; i < count; i++) {
+        position += out.objects[i].decodeFrom(body + position, size - position);
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+size_t CollectionClient::getPendingCount() const {
+  return pending;
+}
+
+void CollectionClient::checkIdle() const {
+  if (pending != 0) {
+    throw std::logic_error("Responses to pipelined requests are pending");
+  }
+}
+
+void CollectionClient::receiveChecked(CollectionResponse& out) {
+  receive(out);
+  if (out.status == CollectionStatus::FAILED) {
+    throw std::runtime_error(out.error);
+  }
+}
+
+bool CollectionClient::get(uint32_t id, DataObject& out) {
+  checkIdle();
+  CollectionResponse response;
+  sendGet(id);
+  receiveChecked(response);
+  if (response.status != CollectionStatus::OK) {
+    return false;
+  }
+  out = std::move(response.objects[0]);
+  return true;
+}
+
+uint32_t CollectionClient::store(const DataObject& object) {
+  checkIdle();
+  CollectionResponse response;
+  sendStore(object);
+  receiveChecked(response);
+  return response.id;
+}
+
+bool CollectionClient::set(const DataObject& object) {
+  checkIdle();
+  CollectionResponse response;
+  sendSet(object);
+  receiveChecked(response);
+  return response.status == CollectionStatus::OK;
+}
+
+bool CollectionClient::remove(uint32_t id) {
+  checkIdle();
+  CollectionResponse response;
+  sendRemove(id);
+  receiveChecked(response);
+  return response.status == CollectionStatus::OK;
+}
+
+vector<DataObject> CollectionClient::query(const DataObject& example,
+                                           uint32_t limit) {
+  checkIdle();
+  CollectionResponse response;
+  sendQuery(example, limit);
+  receiveChecked(response);
+  if (response.status == CollectionStatus::TRUNCATED) {
+    throw std::runtime_error(
+        "Query results don't fit in a response, provide a limit");
+  }
+  return std::move(response.objects);
+}
@@ -0,0 +1,189 @@
+#ifndef COLLECTION_CLIENT
+#define COLLECTION_CLIENT 1
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "CollectionProtocol.hpp"
+#include "DataObject.hpp"
+
+using std::string;
+using std::uint32_t;
+using std::uint8_t;
+using std::vector;
+
+/// <summary>
+/// Response to a request sent with CollectionClient
+/// </summary>
+struct CollectionResponse {
+  /// <summary>
+  /// The operation of the request
+  /// </summary>
+  CollectionOperation operation;
+  CollectionStatus status;
+  /// <summary>
+  /// The ID and version of the object after a store or set
+  /// </summary>
+  uint32_t id;
+  uint32_t version;
+  /// <summary>
+  /// The object of a get or the objects of a query
+  /// </summary>
+  vector<DataObject> objects;
+  /// <summary>
+  /// The error message when the status is FAILED
+  /// </summary>
+  string error;
+};
+
+/// <summary>
+/// Client for a collection served by a CollectionServer.
+///
+/// Requests can be pipelined: the send functions only buffer requests,
+/// which are written together by flush (or once enough are buffered),
+/// and receive provides the responses in the order the requests were
+/// sent. The remaining functions send a single request and wait for its
+/// response, and can only be used once every pipelined response has
+/// been received. Not thread safe, each thread should use its own client
+/// </summary>
+class CollectionClient {
+ private:
+  int descriptor;
+  /// <summary>
+  /// Requests waiting to be written
+  /// </summary>
+  vector<uint8_t> output;
+  /// <summary>
+  /// Bytes read from inputOffset that haven't been received yet
+  /// </summary>
+  vector<uint8_t> input;
+  size_t inputOffset;
+  /// <summary>
+  /// The number of requests sent without their response received
+  /// </summary>
+  size_t pending;
+
+  /// <summary>
+  /// Starts a request, the body size is filled in by finishRequest
+  /// </summary>
+  /// <returns>The offset of the request</returns>
+  size_t beginRequest(CollectionOperation operation);
+  void finishRequest(size_t offset);
+
+  /// <summary>
+  /// Waits until requests can be sent, buffering the responses that
+  /// arrive meanwhile
+  /// </summary>
+  void waitWritable();
+
+  /// <summary>
+  /// Reads the responses available without waiting into the input
+  /// </summary>
+  void bufferResponses();
+
+  /// <summary>
+  /// Throws if responses to pipelined requests haven't been received,
+  /// since they would be mistaken for the response of the next request
+  /// </summary>
+  void checkIdle() const;
+
+  /// <summary>
+  /// Receives a response and throws if it failed
+  /// </summary>
+  void receiveChecked(CollectionResponse& out);
+
+ public:
+  /// <summary>
+  /// Connects to the server listening on the socket at the provided path
+  /// </summary>
+  /// <param name="path">The path of the socket</param>
+  CollectionClient(string path);
+
+  ~CollectionClient();
+
+  /// <summary>
+  /// Buffers a request for the object with the provided ID
+  /// </summary>
+  void sendGet(uint32_t id);
+
+  /// <summary>
+  /// Buffers a request creating an object with the entries of the
+  /// provided object
+  /// </summary>
+  void sendStore(const DataObject& object);
+
+  /// <summary>
+  /// Buffers a request replacing the entries of the object with the ID
+  /// of the provided object
+  /// </summary>
+  void sendSet(const DataObject& object);
+
+  /// <summary>
+  /// Buffers a request removing the object with the provided ID
+  /// </summary>
+  void sendRemove(uint32_t id);
+
+  /// <summary>
+  /// Buffers a request for the objects having every entry of the example
+  /// </summary>
+  /// <param name="example">The entries to match</param>
+  /// <param name="limit">The most objects to provide, 0 for all</param>
+  void sendQuery(const DataObject& example, uint32_t limit = 0);
+
+  /// <summary>
+  /// Writes the buffered requests. Responses arriving while the socket
+  /// is full are buffered, since the server stops reading requests
+  /// while too many of its responses are waiting to be read
+  /// </summary>
+  void flush();
+
+  /// <summary>
+  /// Waits for the response to the oldest request without one, writing
+  /// any buffered requests first
+  /// </summary>
+  /// <param name="out">The response</param>
+  void receive(CollectionResponse& out);
+
+  /// <summary>
+  /// Provides the number of requests sent without their response
+  /// received
+  /// </summary>
+  size_t getPendingCount() const;
+
+  /// <summary>
+  /// Provides the object with the provided ID
+  /// </summary>
+  /// <returns>Whether the object exists</returns>
+  bool get(uint32_t id, DataObject& out);
+
+  /// <summary>
+  /// Creates an object with the entries of the provided object
+  /// </summary>
+  /// <returns>The ID of the created object</returns>
+  uint32_t store(const DataObject& object);
+
+  /// <summary>
+  /// Replaces the entries of the object with the ID of the provided
+  /// object
+  /// </summary>
+  /// <returns>Whether the object exists</returns>
+  bool set(const DataObject& object);
+
+  /// <summary>
+  /// Removes the object with the provided ID
+  /// </summary>
+  /// <returns>Whether the object existed</returns>
+  bool remove(uint32_t id);
+
+  /// <summary>
+  /// Provides the objects having every entry of the example. Throws
+  /// when the matching objects don't fit in a response, sendQuery and
+  /// receive provide the objects that fit with the TRUNCATED status
+  /// </summary>
+  /// <param name="example">The entries to match</param>
+  /// <param name="limit">The most objects to provide, 0 for all</param>
+  vector<DataObject> query(const DataObject& example, uint32_t limit = 0);
+};
+
+#endif
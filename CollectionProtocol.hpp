@@ -0,0 +1,80 @@
+#ifndef COLLECTION_PROTOCOL
+#define COLLECTION_PROTOCOL 1
+
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+using std::uint32_t;
+using std::uint8_t;
+using std::vector;
+
+// Binary protocol spoken between CollectionServer and CollectionClient
+// over a Unix domain socket, using the native byte order like the
+// collection file format.
+//
+// Requests are framed as [u32 body size][u8 operation][body] and each
+// request receives one response, in request order, framed as
+// [u32 body size][u8 operation][u8 status][body]. Clients may send any
+// number of requests before reading responses (pipelining), and the
+// server writes the responses to all the requests it has read at once.
+//
+// Objects are sent using the DataObject::encodeTo encoding.
+//
+//   GET     request: u32 id
+//           response: object
+//   STORE   request: object, its ID is ignored
+//           response: u32 id, u32 version
+//   SET     request: object, replacing the entries of the object with
+//           the same ID
+//           response: u32 id, u32 version
+//   REMOVE  request: u32 id
+//           response: empty
+//   QUERY   request: u32 limit (0 for no limit), example object
+//           response: u32 count, objects having every entry of the
+//           example. When more objects match than fit in a frame the
+//           status is TRUNCATED and the response holds those that fit
+//
+// Responses with the NOT_FOUND status have an empty body and those
+// with the FAILED status hold the error message.
+
+/// <summary>
+/// Operations served by a CollectionServer
+/// </summary>
+enum class CollectionOperation : uint8_t { GET, STORE, SET, REMOVE, QUERY };
+
+/// <summary>
+/// Outcome of a request
+/// </summary>
+enum class CollectionStatus : uint8_t { OK, NOT_FOUND, FAILED, TRUNCATED };
+
+/// <summary>
+/// Size of the frame header of requests and responses
+/// </summary>
+static const size_t COLLECTION_REQUEST_HEADER = sizeof(uint32_t) + 1;
+static const size_t COLLECTION_RESPONSE_HEADER = sizeof(uint32_t) + 2;
+
+/// <summary>
+/// Largest frame body accepted, larger frames close the connection
+/// </summary>
+static const uint32_t COLLECTION_MAX_FRAME = 64 << 20;
+
+/// <summary>
+/// Appends a 32 bit value to the buffer
+/// </summary>
+inline void appendU32(vector<uint8_t>& buffer, uint32_t value) {
+  size_t offset = buffer.size();
+  buffer.resize(offset + sizeof(value));
+  std::memcpy(buffer.data() + offset, &value, sizeof(value));
+}
+
+/// <summary>
+/// Reads a 32 bit value from the buffer
+/// </summary>
+inline uint32_t readU32(const uint8_t* data) {
+  uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+#endif
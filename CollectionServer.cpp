@@ -0,0 +1,508 @@
+#include "CollectionServer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+using std::string;
+using std::uint32_t;
+using std::uint8_t;
+using std::vector;
+
+/// <summary>
+/// Size of each read from a connection
+/// </summary>
+static const size_t READ_CHUNK_SIZE = 64 * 1024;
+
+/// <summary>
+/// Most bytes read from a connection per event, the rest is read on the
+/// next wait so one client can't grow its buffer without bound
+/// </summary>
+static const size_t MAX_READ_PER_EVENT = 16 * READ_CHUNK_SIZE;
+
+/// <summary>
+/// Buffered response bytes at which a connection stops being read and
+/// its remaining requests wait, until the client reads the responses
+/// </summary>
+static const size_t MAX_BUFFERED_OUTPUT = 4 << 20;
+
+/// <summary>
+/// Most events handled per wait of the event loop
+/// </summary>
+static const int MAX_EVENTS = 64;
+
+/// <summary>
+/// Structure storing the entries of a decoded object, used to make
+/// changes through the struct functions of the collection so they are
+/// persisted, versioned and tracked like changes made in process
+/// </summary>
+class EncodedObjectStructure : public DataObjectStructure {
+ private:
+  const DataObject& source;
+
+ public:
+  EncodedObjectStructure(const DataObject& source) : source(source) {}
+
+  uint32_t getObjectId() override { return source.getId(); }
+
+  void populateObject(DataObject* object) override {
+    for (const std::pair<const string, DataValue>& entry :
+         source.getEntries()) {
+      object->setEntry(entry.first, entry.second);
+    }
+  }
+
+  void fromObject(DataObject* /* object */) override {}
+};
+
+/// <summary>
+/// Provides whether the object has every entry of the example
+/// </summary>
+static bool matchesExample(const DataObject& object,
+                           const DataObject& example) {
+  const EntryMap& entries = object.getEntries();
+  for (const std::pair<const string, DataValue>& condition :
+       example.getEntries()) {
+    EntryMap::const_iterator entry = entries.find(condition.first);
+    if (entry == entries.end() || !(entry->second == condition.second)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// <summary>
+/// Starts a response, the body size is filled in by finishResponse
+/// </summary>
+/// <returns>The offset of the response</returns>
+static size_t beginResponse(vector<uint8_t>& output,
+                            CollectionOperation operation,
+                            CollectionStatus status) {
+  size_t offset = output.size();
+  appendU32(output, 0);
+  output.push_back(static_cast<uint8_t>(operation));
+  output.push_back(static_cast<uint8_t>(status));
+  return offset;
+}
+
+/// <summary>
+/// Changes the status of the response started at the offset
+/// </summary>
+static void setStatus(vector<uint8_t>& output, size_t offset,
+                      CollectionStatus status) {
+  output[offset + sizeof(uint32_t) + 1] = static_cast<uint8_t>(status);
+}
+
+/// <summary>
+/// Fills in the body size of the response started at the offset
+/// </summary>
+static void finishResponse(vector<uint8_t>& output, size_t offset) {
+  uint32_t size = static_cast<uint32_t>(output.size() - offset -
+                                        COLLECTION_RESPONSE_HEADER);
+  std::memcpy(output.data() + offset, &size, sizeof(size));
+}
+
+CollectionServer::CollectionServer(DataObjectCollection* collection,
+                                   string path)
+    : collection(collection),
+      path(path),
+      listener(-1),
+      poller(-1),
+      wakeup(-1),
+      running(true),
+      connections() {
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw std::invalid_argument("Socket path is too long");
+  }
+  std::memcpy(address.sun_path, path.c_str(), path.size());
+
+  listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  poller = ::epoll_create1(EPOLL_CLOEXEC);
+  wakeup = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (listener < 0 || poller < 0 || wakeup < 0) {
+    release();
+    throw std::runtime_error("Failed to create server socket");
+  }
+
+  // A socket left by a server that didn't shut down cleanly would
+  // prevent binding, anything else at the path is left for bind to fail
+  struct stat existing;
+  if (::lstat(path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode)) {
+    ::unlink(path.c_str());
+  }
+  if (::bind(listener, reinterpret_cast<sockaddr*>(&address),
+             sizeof(address)) != 0) {
+    // Nothing was created at the path, so release leaves it alone
+    ::close(listener);
+    listener = -1;
+    release();
+    throw std::runtime_error("Failed to listen on server socket");
+  }
+  if (::listen(listener, SOMAXCONN) != 0) {
+    release();
+    throw std::runtime_error("Failed to listen on server socket");
+  }
+
+  epoll_event event;
+  std::memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = listener;
+  ::epoll_ctl(poller, EPOLL_CTL_ADD, listener, &event);
+  event.data.fd = wakeup;
+  ::epoll_ctl(poller, EPOLL_CTL_ADD, wakeup, &event);
+}
+
+CollectionServer::~CollectionServer() {
+  release();
+}
+
+void CollectionServer::release() {
+  for (const std::pair<const int, std::unique_ptr<Connection>>& connection :
+       connections) {
+    ::close(connection.first);
+  }
+  connections.clear();
+
+  if (listener >= 0) {
+    ::close(listener);
+    ::unlink(path.c_str());
+    listener = -1;
+  }
+  if (poller >= 0) {
+    ::close(poller);
+    poller = -1;
+  }
+  if (wakeup >= 0) {
+    ::close(wakeup);
+    wakeup = -1;
+  }
+}
+
+void CollectionServer::run() {
+  epoll_event events[MAX_EVENTS];
+
+  while (running) {
+    int count = ::epoll_wait(poller, events, MAX_EVENTS, -1);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("Failed to wait for server events");
+    }
+
+    for (int i = 0; i < count; i++) {
+      int descriptor = events[i].data.fd;
+      if (descriptor == wakeup) {
+        uint64_t value;
+        while (::read(wakeup, &value, sizeof(value)) > 0) {
+        }
+        continue;
+      }
+      if (descriptor == listener) {
+        accept();
+        continue;
+      }
+
+      map<int, std::unique_ptr<Connection>>::iterator connection =
+          connections.find(descriptor);
+      if (connection == connections.end()) {
+        continue;
+      }
+
+      bool open = (events[i].events & (EPOLLERR | EPOLLHUP)) == 0 ||
+                  (events[i].events & EPOLLIN) != 0;
+      if (open && (events[i].events & EPOLLIN) != 0) {
+        open = read(*connection->second);
+      }
+      if (open && (events[i].events & EPOLLOUT) != 0) {
+        open = write(*connection->second);
+      }
+      if (!open) {
+        close(descriptor);
+      }
+    }
+  }
+}
+
+void CollectionServer::stop() {
+  running = false;
+  uint64_t value = 1;
+  ssize_t written = ::write(wakeup, &value, sizeof(value));
+  (void)written;
+}
+
+void CollectionServer::accept() {
+  while (true) {
+    int descriptor =
+        ::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (descriptor < 0) {
+      return;
+    }
+
+    epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = descriptor;
+    if (::epoll_ctl(poller, EPOLL_CTL_ADD, descriptor, &event) != 0) {
+      ::close(descriptor);
+      continue;
+    }
+
+    std::unique_ptr<Connection> connection(new Connection());
+    connection->descriptor = descriptor;
+    connection->outputOffset = 0;
+    connection->events = EPOLLIN;
+    connection->throttled = false;
+    connections[descriptor] = std::move(connection);
+  }
+}
+
+bool CollectionServer::read(Connection& connection) {
+  // Read everything available, up to the limit, so all pipelined
+  // requests are answered together
+  size_t limit = connection.input.size() + MAX_READ_PER_EVENT;
+  bool closed = false;
+  while (connection.input.size() < limit) {
+    size_t offset = connection.input.size();
+    size_t chunk = std::min(READ_CHUNK_SIZE, limit - offset);
+    connection.input.resize(offset + chunk);
+    ssize_t received = ::recv(connection.descriptor,
+                              connection.input.data() + offset, chunk, 0);
+    connection.input.resize(offset + (received > 0 ? received : 0));
+
+    if (received > 0) {
+      continue;
+    }
+    if (received == 0) {
+      closed = true;
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      return false;
+    }
+    break;
+  }
+
+  if (!handleRequests(connection) || !write(connection)) {
+    return false;
+  }
+  return !closed;
+}
+
+bool CollectionServer::handleRequests(Connection& connection) {
+  // Drop the written responses before appending more
+  if (connection.outputOffset > 0) {
+    connection.output.erase(
+        connection.output.begin(),
+        connection.output.begin() + connection.outputOffset);
+    connection.outputOffset = 0;
+  }
+
+  size_t position = 0;
+  const uint8_t* data = connection.input.data();
+  size_t available = connection.input.size();
+  connection.throttled = false;
+  while (available - position >= COLLECTION_REQUEST_HEADER) {
+    if (connection.output.size() >= MAX_BUFFERED_OUTPUT) {
+      connection.throttled = true;
+      break;
+    }
+
+    uint32_t size = readU32(data + position);
+    if (size > COLLECTION_MAX_FRAME) {
+      return false;
+    }
+    if (available - position - COLLECTION_REQUEST_HEADER < size) {
+      break;
+    }
+
+    CollectionOperation operation =
+        static_cast<CollectionOperation>(data[position + sizeof(uint32_t)]);
+    handle(operation, data + position + COLLECTION_REQUEST_HEADER, size,
+           connection.output);
+    position += COLLECTION_REQUEST_HEADER + size;
+  }
+  connection.input.erase(connection.input.begin(),
+                         connection.input.begin() + position);
+  return true;
+}
+
+bool CollectionServer::write(Connection& connection) {
+  while (true) {
+    while (connection.outputOffset < connection.output.size()) {
+      ssize_t sent =
+          ::send(connection.descriptor,
+                 connection.output.data() + connection.outputOffset,
+                 connection.output.size() - connection.outputOffset,
+                 MSG_NOSIGNAL);
+      if (sent > 0) {
+        connection.outputOffset += static_cast<size_t>(sent);
+        continue;
+      }
+      if (sent < 0 && errno == EINTR) {
+        continue;
+      }
+      if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        break;
+      }
+      return false;
+    }
+
+    if (connection.outputOffset == connection.output.size()) {
+      connection.output.clear();
+      connection.outputOffset = 0;
+    }
+
+    // Requests held back by the limit are handled once the client has
+    // read enough of the responses
+    size_t buffered = connection.output.size() - connection.outputOffset;
+    if (!connection.throttled || buffered >= MAX_BUFFERED_OUTPUT) {
+      break;
+    }
+    if (!handleRequests(connection)) {
+      return false;
+    }
+  }
+
+  // Wait for the socket to be writable while responses are pending, and
+  // stop reading while too many of them are buffered
+  size_t buffered = connection.output.size() - connection.outputOffset;
+  uint32_t events = 0;
+  if (buffered < MAX_BUFFERED_OUTPUT) {
+    events |= EPOLLIN;
+  }
+  if (buffered > 0) {
+    events |= EPOLLOUT;
+  }
+  if (events != connection.events) {
+    epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = connection.descriptor;
+    ::epoll_ctl(poller, EPOLL_CTL_MOD, connection.descriptor, &event);
+    connection.events = events;
+  }
+  return true;
+}
+
+void CollectionServer::close(int descriptor) {
+  ::epoll_ctl(poller, EPOLL_CTL_DEL, descriptor, nullptr);
+  ::close(descriptor);
+  connections.erase(descriptor);
+}
+
+void CollectionServer::handle(CollectionOperation operation,
+                              const uint8_t* body, size_t size,
+                              vector<uint8_t>& output) {
+  size_t response = beginResponse(output, operation, CollectionStatus::OK);
+
+  try {
+    switch (operation) {
+      case CollectionOperation::GET: {
+        if (size != sizeof(uint32_t)) {
+          throw std::invalid_argument("Malformed get request");
+        }
+
+        DataObject* object = collection->getObject(readU32(body));
+        if (object == nullptr) {
+          setStatus(output, response, CollectionStatus::NOT_FOUND);
+          break;
+        }
+        object->encodeTo(output);
+        break;
+      }
+      case CollectionOperation::STORE:
+      case CollectionOperation::SET: {
+        DataObject decoded;
+        if (decoded.decodeFrom(body, size) != size) {
+          throw std::invalid_argument("Malformed object in request");
+        }
+
+        EncodedObjectStructure structure(decoded);
+        DataObject* object = operation == CollectionOperation::STORE
+                                 ? collection->storeStruct(&structure)
+                                 : collection->saveStruct(&structure);
+        if (object == nullptr) {
+          setStatus(output, response, CollectionStatus::NOT_FOUND);
+          break;
+        }
+        appendU32(output, object->getId());
+        appendU32(output, object->getVersion());
+        break;
+      }
+      case CollectionOperation::REMOVE: {
+        if (size != sizeof(uint32_t)) {
+          throw std::invalid_argument("Malformed remove request");
+        }
+
+        if (!collection->removeObject(readU32(body))) {
+          setStatus(output, response, CollectionStatus::NOT_FOUND);
+        }
+        break;
+      }
+      case CollectionOperation::QUERY: {
+        if (size < sizeof(uint32_t)) {
+          throw std::invalid_argument("Malformed query request");
+        }
+
+        uint32_t limit = readU32(body);
+        DataObject example;
+        if (example.decodeFrom(body + sizeof(uint32_t),
+                               size - sizeof(uint32_t)) !=
+            size - sizeof(uint32_t)) {
+          throw std::invalid_argument("Malformed object in request");
+        }
+
+        size_t countOffset = output.size();
+        appendU32(output, 0);
+        uint32_t count = 0;
+        collection->visitObjects([&output, &count, &example, limit,
+                                  response](const DataObject& object) {
+          if (limit != 0 && count == limit) {
+            return false;
+          }
+          if (!matchesExample(object, example)) {
+            return true;
+          }
+
+          // Stop with the objects that fit when the frame is full
+          size_t previous = output.size();
+          object.encodeTo(output);
+          if (output.size() - response - COLLECTION_RESPONSE_HEADER >
+              COLLECTION_MAX_FRAME) {
+            output.resize(previous);
+            setStatus(output, response, CollectionStatus::TRUNCATED);
+            return false;
+          }
+          count++;
+          return true;
+        });
+        std::memcpy(output.data() + countOffset, &count, sizeof(count));
+        break;
+      }
+      default:
+        throw std::invalid_argument("Unknown operation");
+    }
+  } catch (const std::exception& error) {
+    // Replace any partial body with the error message
+    output.resize(response);
+    beginResponse(output, operation, CollectionStatus::FAILED);
+    const char* message = error.what();
+    output.insert(output.end(), message, message + std::strlen(message));
+  }
+
+  finishResponse(output, response);
+}
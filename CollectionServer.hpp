@@ -0,0 +1,150 @@
+#ifndef COLLECTION_SERVER
+#define COLLECTION_SERVER 1
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "CollectionProtocol.hpp"
+#include "DataObject.hpp"
+
+using std::map;
+using std::string;
+using std::uint32_t;
+using std::uint8_t;
+using std::vector;
+
+/// <summary>
+/// Serves a DataObjectCollection to other processes over a Unix domain
+/// socket, so several processes can share one collection instead of
+/// each embedding its own. See CollectionProtocol.hpp for the protocol
+/// and CollectionClient for the client.
+///
+/// A single thread runs an epoll event loop. Every complete request
+/// read from a connection is handled before the responses are written
+/// back together, so pipelined requests are answered with one write.
+/// A client that doesn't read its responses stops being read once its
+/// buffered responses reach a limit, bounding the memory it can use.
+/// Changes go through the struct functions of the collection and are
+/// persisted the same way as changes made in process
+/// </summary>
+class CollectionServer {
+ private:
+  /// <summary>
+  /// Client connection and its buffered bytes
+  /// </summary>
+  struct Connection {
+    int descriptor;
+    /// <summary>
+    /// Bytes read that don't yet form a complete request
+    /// </summary>
+    vector<uint8_t> input;
+    /// <summary>
+    /// Responses waiting to be written, from outputOffset
+    /// </summary>
+    vector<uint8_t> output;
+    size_t outputOffset;
+    /// <summary>
+    /// The epoll events the connection is waiting for
+    /// </summary>
+    uint32_t events;
+    /// <summary>
+    /// Whether complete requests were left in the input because too many
+    /// responses are buffered
+    /// </summary>
+    bool throttled;
+  };
+
+  /// <summary>
+  /// The collection being served
+  /// </summary>
+  DataObjectCollection* collection;
+  /// <summary>
+  /// The path of the socket
+  /// </summary>
+  string path;
+  int listener;
+  int poller;
+  /// <summary>
+  /// Event used to wake the event loop when stopping
+  /// </summary>
+  int wakeup;
+  std::atomic<bool> running;
+  map<int, std::unique_ptr<Connection>> connections;
+
+  /// <summary>
+  /// Accepts every pending connection
+  /// </summary>
+  void accept();
+
+  /// <summary>
+  /// Reads the available bytes, up to a limit, and handles the complete
+  /// requests
+  /// </summary>
+  /// <returns>Whether the connection is still open</returns>
+  bool read(Connection& connection);
+
+  /// <summary>
+  /// Handles the complete requests in the input until the buffered
+  /// responses reach the output limit, leaving the rest in the input
+  /// </summary>
+  /// <returns>Whether the requests were well formed</returns>
+  bool handleRequests(Connection& connection);
+
+  /// <summary>
+  /// Writes as much of the buffered responses as the socket accepts,
+  /// waiting for the socket to be writable for the rest. Requests held
+  /// back by the output limit are handled as the responses drain, and
+  /// the connection isn't read while the limit is reached
+  /// </summary>
+  /// <returns>Whether the connection is still open</returns>
+  bool write(Connection& connection);
+
+  /// <summary>
+  /// Closes and forgets the connection
+  /// </summary>
+  void close(int descriptor);
+
+  /// <summary>
+  /// Closes every descriptor of the server and removes the socket
+  /// </summary>
+  void release();
+
+  /// <summary>
+  /// Handles a single request, appending its response to the output
+  /// </summary>
+  void handle(CollectionOperation operation, const uint8_t* body,
+              size_t size, vector<uint8_t>& output);
+
+ public:
+  /// <summary>
+  /// Creates a server listening on the socket at the provided path,
+  /// replacing a stale socket left at the path. Any other file at the
+  /// path is left in place and the server fails to listen
+  /// </summary>
+  /// <param name="collection">The collection to serve, which must
+  /// outlive the server</param>
+  /// <param name="path">The path of the socket</param>
+  CollectionServer(DataObjectCollection* collection, string path);
+
+  /// <summary>
+  /// Closes every connection and removes the socket
+  /// </summary>
+  ~CollectionServer();
+
+  /// <summary>
+  /// Runs the event loop on the calling thread until stop is called
+  /// </summary>
+  void run();
+
+  /// <summary>
+  /// Stops the event loop, can be called from any thread. A server
+  /// that has been stopped doesn't run again
+  /// </summary>
+  void stop();
+};
+
+#endif
@@ -0,0 +1,100 @@
+#include "ContentHash.hpp"
+
+#include <cstring>
+#include <cstdint>
+
+using std::uint32_t;
+using std::uint64_t;
+using std::uint8_t;
+
+static const uint64_t PRIME_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME_3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME_5 = 0x27D4EB2F165667C5ULL;
+
+static uint64_t rotateLeft(uint64_t value, uint32_t count) {
+  return (value << count) | (value >> (64 - count));
+}
+
+static uint64_t read64(const uint8_t* data) {
+  uint64_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static uint32_t read32(const uint8_t* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static uint64_t mixRound(uint64_t accumulator, uint64_t input) {
+  accumulator += input * PRIME_2;
+  accumulator = rotateLeft(accumulator, 31);
+  return accumulator * PRIME_1;
+}
+
+static uint64_t mergeRound(uint64_t hash, uint64_t accumulator) {
+  hash ^= mixRound(0, accumulator);
+  return hash * PRIME_1 + PRIME_4;
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed) {
+  const uint8_t* input = reinterpret_cast<const uint8_t*>(data);
+  const uint8_t* end = input + size;
+  uint64_t hash;
+
+  if (size >= 32) {
+    // Four independent lanes over 32 byte stripes
+    uint64_t v1 = seed + PRIME_1 + PRIME_2;
+    uint64_t v2 = seed + PRIME_2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - PRIME_1;
+
+    const uint8_t* limit = end - 32;
+    do {
+      v1 = mixRound(v1, read64(input));
+      v2 = mixRound(v2, read64(input + 8));
+      v3 = mixRound(v3, read64(input + 16));
+      v4 = mixRound(v4, read64(input + 24));
+      input += 32;
+    } while (input <= limit);
+
+    hash = rotateLeft(v1, 1) + rotateLeft(v2, 7) + rotateLeft(v3, 12) +
+           rotateLeft(v4, 18);
+    hash = mergeRound(hash, v1);
+    hash = mergeRound(hash, v2);
+    hash = mergeRound(hash, v3);
+    hash = mergeRound(hash, v4);
+  } else {
+    hash = seed + PRIME_5;
+  }
+
+  hash += static_cast<uint64_t>(size);
+
+  // Remaining bytes
+  while (end - input >= 8) {
+    hash ^= mixRound(0, read64(input));
+    hash = rotateLeft(hash, 27) * PRIME_1 + PRIME_4;
+    input += 8;
+  }
+  if (end - input >= 4) {
+    hash ^= static_cast<uint64_t>(read32(input)) * PRIME_1;
+    hash = rotateLeft(hash, 23) * PRIME_2 + PRIME_3;
+    input += 4;
+  }
+  while (input < end) {
+    hash ^= static_cast<uint64_t>(*input) * PRIME_5;
+    hash = rotateLeft(hash, 11) * PRIME_1;
+    input++;
+  }
+
+  // Final avalanche
+  hash ^= hash >> 33;
+  hash *= PRIME_2;
+  hash ^= hash >> 29;
+  hash *= PRIME_3;
+  hash ^= hash >> 32;
+  return hash;
+}
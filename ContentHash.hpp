@@ -0,0 +1,20 @@
+#ifndef CONTENT_HASH
+#define CONTENT_HASH 1
+
+#include <cstddef>
+#include <cstdint>
+
+using std::uint64_t;
+
+/// <summary>
+/// Computes the 64 bit xxHash (XXH64) of the provided bytes. Used for
+/// cheap change detection of object contents, not for security
+/// </summary>
+/// <param name="data">The bytes to hash</param>
+/// <param name="size">The number of bytes</param>
+/// <param name="seed">The seed, hashes can be chained by passing the
+/// previous hash as the seed</param>
+/// <returns>The hash</returns>
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+#endif
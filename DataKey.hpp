@@ -0,0 +1,46 @@
+#ifndef DATA_KEY
+#define DATA_KEY 1
+
+#include <cstddef>
+#include <string_view>
+
+/// <summary>
+/// Entry key known at compile time, created with the _key literal
+/// ("username"_key). The length is computed by the compiler and entries
+/// are found by comparing against the literal in place, so using a
+/// DataKey never constructs a std::string or scans for the terminator
+/// </summary>
+class DataKey {
+ private:
+  const char* data;
+  size_t length;
+
+ public:
+  /// <summary>
+  /// Creates a key for the provided characters, which must outlive the
+  /// key. String literals live for the whole program
+  /// </summary>
+  constexpr DataKey(const char* data, size_t length)
+      : data(data), length(length) {}
+
+  /// <summary>
+  /// Provides the characters of the key
+  /// </summary>
+  constexpr std::string_view getView() const {
+    return std::string_view(data, length);
+  }
+
+  /// <summary>
+  /// Provides the length of the key
+  /// </summary>
+  constexpr size_t size() const { return length; }
+};
+
+/// <summary>
+/// Creates a DataKey from a string literal
+/// </summary>
+constexpr DataKey operator""_key(const char* data, size_t length) {
+  return DataKey(data, length);
+}
+
+#endif
@@ -1,57 +1,105 @@
 #include "DataObject.hpp"
 
+#include "ContentHash.hpp"
+#include "DataObjectHistory.hpp"
+#include "DataSchema.hpp"
+#include "Database.hpp"
+#include "IncrementalSnapshot.hpp"
+#include "StorageBackend.hpp"
+#include "FrontCodedBlock.hpp"
+
 #include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <map>
 #include <stdint.h>
 #include <string>
+#include <stdexcept>
 #include <sys/stat.h>
 #include <vector>
 
 using std::ifstream;
 using std::int32_t;
+using std::istream;
 using std::ios;
 using std::map;
 using std::ofstream;
+using std::ostream;
 using std::string;
 using std::uint32_t;
 using std::vector;
 
-DataObjectCollection::DataObjectCollection(string path) {
+/// <summary>
+/// Magic value written at the start of collection files ("DOBJ"). Files
+/// written before the format was versioned start directly with nextId
+/// </summary>
+static const uint32_t FILE_MAGIC = 0x4A424F44;
+
+/// <summary>
+/// Collection file format versions
+///   1: Legacy unversioned format
+///   2: Adds the per object version
+///   3: Object entries are stored as a front coded block
+/// </summary>
+static const uint32_t LEGACY_FORMAT_VERSION = 1;
+static const uint32_t FORMAT_VERSION = 3;
+
+/// <summary>
+/// Orders objects by their ID
+/// </summary>
+static bool compareObjectIds(const DataObject& a, const DataObject& b) {
+  return a.getId() < b.getId();
+}
+
+/// <summary>
+/// Compares an object ID against a searched for ID
+/// </summary>
+static bool compareObjectId(const DataObject& object, uint32_t id) {
+  return object.getId() < id;
+}
+
+DataObjectCollection::DataObjectCollection(string path)
+    : DataObjectCollection(
+          path, std::unique_ptr<StorageBackend>(new FileStorageBackend(path))) {
+}
+
+DataObjectCollection::DataObjectCollection(
+    string path, std::unique_ptr<StorageBackend> storage)
+    : storage(std::move(storage)) {
   DataObjectCollection::path = path;
   DataObjectCollection::nextId = 1;
   DataObjectCollection::objects = {};
+  DataObjectCollection::sequence = 0;
+  DataObjectCollection::database = nullptr;
+  DataObjectCollection::snapshot = nullptr;
+  DataObjectCollection::saveDeferred = false;
+  DataObjectCollection::schemaInference = false;
 }
 
-void DataObjectCollection::load() {
-  struct stat stats;
-
-  // Get the file path stats
-  if (stat(path.c_str(), &stats) != 0) {
-    // File doesn't exist, no loading to be done
-    return;
+DataObjectCollection::~DataObjectCollection() {
+  // A snapshot outliving the collection can't be finished
+  if (snapshot != nullptr) {
+    snapshot->abandon();
+    snapshot->collection = nullptr;
   }
+}
 
-  // Open binary stream to the file
-  ifstream stream(path, ios::binary);
-
-  if (!stream.is_open()) {
-    throw std::exception(
-        "Failed to open stream to data object collection file");
+void DataObjectCollection::load() {
+  // Storage doesn't exist yet, no loading to be done
+  if (storage->size() == 0) {
+    return;
   }
 
-  // Read the nextId from the stream
-  stream.read(reinterpret_cast<char*>(&nextId), sizeof(nextId));
-
-  // Handle initial read error
-  if (stream.fail()) {
-    throw std::exception("Error while reading data object collection nextId");
-  }
+  // Open a stream reading the storage, the file is read once so its
+  // pages are dropped from the cache as they are parsed
+  StorageReadBuffer buffer(*storage, true);
+  istream stream(&buffer);
 
-  // Read the length of the object entries map
+  // Read the header containing the nextId and the number of objects
   uint32_t size;
-  stream.read(reinterpret_cast<char*>(&size), sizeof(size));
+  uint32_t formatVersion = deserializeCollectionHeader(stream, nextId, size);
 
   // Reserve the space for the new objects
   objects.reserve(size);
@@ -59,10 +107,10 @@ void DataObjectCollection::load() {
   for (uint32_t i = 0; i < size; i++) {
     // Deserialize a data object from the stream
     DataObject object;
-    object.deserialize(stream);
+    object.deserialize(stream, formatVersion);
 
     if (stream.fail()) {
-      throw std::exception(
+      throw std::runtime_error(
           "Error while reading data object collection objects");
     }
 
@@ -70,72 +118,246 @@ void DataObjectCollection::load() {
     objects.push_back(object);
   }
 
-  // Close the finished stream
-  stream.close();
+  // Lookups rely on the objects being ordered by ID
+  if (!std::is_sorted(objects.begin(), objects.end(), compareObjectIds)) {
+    std::sort(objects.begin(), objects.end(), compareObjectIds);
+  }
+
+  if (schemaInference) {
+    schemaReport.reset(new DataSchemaReport(DataSchema::infer(objects)));
+  }
 }
 
 void DataObjectCollection::save() const {
-  ofstream stream(DataObjectCollection::path.c_str(), ios::binary | ios::trunc);
-
-  if (!stream.is_open()) {
-    throw std::exception(
-        "Failed to open stream to data object collection file");
+  // Hosted collections are written as part of the database file
+  if (database != nullptr) {
+    database->checkpoint();
+    return;
   }
 
-  // Write the next ID
-  stream.write(reinterpret_cast<const char*>(&nextId), sizeof(nextId));
-
-  // Handle initial write error
-  if (stream.fail()) {
-    throw std::exception("Error while writing data object collection nextId");
+  // A snapshot in progress to the same storage would publish older
+  // contents than these
+  if (snapshot != nullptr && snapshot->storage == storage.get()) {
+    snapshot->abandon();
   }
+  saveDeferred = false;
 
-  // Write the size of the object list
-  uint32_t size = static_cast<uint32_t>(objects.size());
-  stream.write(reinterpret_cast<const char*>(&size), sizeof(size));
+  // Write a snapshot replacing the stored contents once complete, so a
+  // crash or a concurrent reader never sees a partially written file
+  storage->beginSnapshot();
+  StorageWriteBuffer buffer(*storage);
+  ostream stream(&buffer);
 
-  if (stream.fail()) {
-    throw std::exception("Failed to write objects size");
-  }
+  // Write the header containing the nextId and the number of objects
+  serializeCollectionHeader(stream, nextId,
+                            static_cast<uint32_t>(objects.size()));
 
+  // One encoding buffer is reused for every object
+  vector<uint8_t> encoded;
   for (DataObject const& object : objects) {
-    object.serialize(stream);
+    object.serialize(stream, encoded);
 
     if (stream.fail()) {
-      throw std::exception(
+      throw std::runtime_error(
           "Error while writing data object collection objects");
     }
   }
 
-  // Close the finished stream
-  stream.close();
+  // Append the remaining buffered bytes and publish the snapshot
+  buffer.pubsync();
+  storage->publishSnapshot();
 }
 
-DataObject* DataObjectCollection::getObject(uint32_t id) {
-  // Search the objects for a matching ID
-  for (size_t i = 0; i < objects.size(); i++) {
-    DataObject* object = &objects[i];
-    if (object->id == id) {
-      return object;
-    }
+void DataObjectCollection::persist(
+    const std::function<void(DatabaseBatch&)>& changes) {
+  // Hosted collections log the changes instead of rewriting a file
+  if (database != nullptr) {
+    DatabaseBatch batch;
+    changes(batch);
+    database->writeLog(batch);
+    return;
+  }
+
+  // Saving would abandon a snapshot being written to the storage, the
+  // snapshot stays consistent as changed objects are preserved for it
+  if (snapshot != nullptr && snapshot->storage == storage.get()) {
+    saveDeferred = true;
+    return;
   }
 
+  save();
+}
+
+bool DataObjectCollection::isSaveDeferred() const {
+  return saveDeferred;
+}
+
+void DataObjectCollection::admit() {
+  if (database != nullptr) {
+    database->admit();
+  }
+}
+
+DataObject* DataObjectCollection::findObject(uint32_t id) {
+  // Binary search the ID ordered objects for a matching ID
+  vector<DataObject>::iterator object =
+      std::lower_bound(objects.begin(), objects.end(), id, compareObjectId);
+
   // No matching object found
-  return nullptr;
+  if (object == objects.end() || object->id != id) {
+    return nullptr;
+  }
+
+  return &*object;
+}
+
+DataObject* DataObjectCollection::getObjectLocked(uint32_t id) {
+  DataObject* object = findObject(id);
+
+  if (object != nullptr && !migrations.empty()) {
+    migrate(*object);
+  }
+
+  return object;
+}
+
+DataObject* DataObjectCollection::getObject(uint32_t id) {
+  // Migrating may log the object, wait for room in the log first
+  if (!migrations.empty()) {
+    admit();
+  }
+  std::lock_guard<std::mutex> guard(structLock);
+
+  return getObjectLocked(id);
+}
+
+DataObject* DataObjectCollection::getObjectForUpdate(uint32_t id) {
+  if (!migrations.empty()) {
+    admit();
+  }
+  std::lock_guard<std::mutex> guard(structLock);
+
+  DataObject* object = getObjectLocked(id);
+
+  if (object != nullptr && snapshot != nullptr) {
+    snapshot->preserve(*object);
+  }
+
+  return object;
 }
 
 void DataObjectCollection::deleteObject(uint32_t id) {
-  // Search the objects for a matching ID
-  for (size_t i = 0; i < objects.size(); i++) {
-    DataObject* object = &objects[i];
-    if (object->id == id) {
-      // Remove the object
-      objects.erase(objects.begin() + i);
-      return;
+  // Binary search the ID ordered objects for a matching ID
+  vector<DataObject>::iterator object =
+      std::lower_bound(objects.begin(), objects.end(), id, compareObjectId);
+
+  if (object != objects.end() && object->id == id) {
+    if (snapshot != nullptr) {
+      snapshot->preserve(*object);
+    }
+
+    sequence++;
+    if (history) {
+      history->recordDeleted(sequence, *object);
+      history->flush();
     }
+
+    // Remove the object
+    objects.erase(object);
   }
 }
 
+bool DataObjectCollection::removeObject(uint32_t id) {
+  admit();
+  std::lock_guard<std::mutex> guard(structLock);
+
+  // Binary search the ID ordered objects for a matching ID
+  vector<DataObject>::iterator object =
+      std::lower_bound(objects.begin(), objects.end(), id, compareObjectId);
+
+  if (object == objects.end() || object->id != id) {
+    return false;
+  }
+
+  if (snapshot != nullptr) {
+    snapshot->preserve(*object);
+  }
+
+  sequence++;
+  if (history) {
+    history->recordDeleted(sequence, *object);
+    history->flush();
+  }
+
+  // Remove the object
+  objects.erase(object);
+
+  // Save the database
+  persist([this, id](DatabaseBatch& batch) { batch.remove(name, id); });
+
+  return true;
+}
+
+size_t DataObjectCollection::deleteWhere(
+    const std::function<bool(const DataObject&)>& predicate) {
+  admit();
+  std::lock_guard<std::mutex> guard(structLock);
+
+  uint64_t commit = sequence + 1;
+  DataObjectHistory* changes = history.get();
+  IncrementalSnapshot* active = snapshot;
+  vector<uint32_t> removed;
+
+  // Compact the remaining objects to the front in one pass
+  vector<DataObject>::iterator end = std::remove_if(
+      objects.begin(), objects.end(),
+      [&predicate, &removed, changes, active,
+       commit](const DataObject& object) {
+        if (!predicate(object)) {
+          return false;
+        }
+        if (changes != nullptr) {
+          changes->recordDeleted(commit, object);
+        }
+        if (active != nullptr) {
+          active->preserve(object);
+        }
+        removed.push_back(object.getId());
+        return true;
+      });
+  size_t deleted = static_cast<size_t>(objects.end() - end);
+
+  if (deleted == 0) {
+    return 0;
+  }
+
+  objects.erase(end, objects.end());
+
+  sequence = commit;
+  if (history) {
+    history->flush();
+  }
+
+  // Save the database
+  persist([this, &removed](DatabaseBatch& batch) {
+    for (uint32_t id : removed) {
+      batch.remove(name, id);
+    }
+  });
+
+  return deleted;
+}
+
+size_t DataObjectCollection::deleteObjects(const vector<uint32_t>& ids) {
+  // Sort the IDs so membership can be binary searched
+  vector<uint32_t> sorted(ids);
+  std::sort(sorted.begin(), sorted.end());
+
+  return deleteWhere([&sorted](const DataObject& object) {
+    return std::binary_search(sorted.begin(), sorted.end(), object.getId());
+  });
+}
+
 DataObject* DataObjectCollection::createObject() {
   // Get and increment the next ID
   uint32_t id = nextId;
@@ -144,10 +366,18 @@ DataObject* DataObjectCollection::createObject() {
   // Create the new object
   DataObject object = DataObject();
   object.id = id;
+  object.version = 1;
+  stampSchema(object);
 
   // Insert the object into the collection
   objects.push_back(object);
 
+  sequence++;
+  if (history) {
+    history->recordCreated(sequence, object);
+    history->flush();
+  }
+
   // Get a reference to the inserted object
   DataObject* insertedObject = &objects.back();
 
@@ -158,7 +388,25 @@ size_t DataObjectCollection::getObjectCount() {
   return objects.size();
 }
 
+const vector<DataObject>& DataObjectCollection::getObjects() const {
+  return objects;
+}
+
+void DataObjectCollection::visitObjects(
+    const std::function<bool(const DataObject&)>& visitor) {
+  std::lock_guard<std::mutex> guard(structLock);
+
+  for (const DataObject& object : objects) {
+    if (!visitor(object)) {
+      return;
+    }
+  }
+}
+
 DataObject* DataObjectCollection::storeStruct(DataObjectStructure* structure) {
+  admit();
+  std::lock_guard<std::mutex> guard(structLock);
+
   // Create the object
   DataObject* object = createObject();
 
@@ -166,35 +414,88 @@ DataObject* DataObjectCollection::storeStruct(DataObjectStructure* structure) {
   structure->populateObject(object);
 
   // Save the database
-  save();
+  persist([this, object](DatabaseBatch& batch) { batch.put(name, *object); });
 
   return object;
 }
 
 DataObject* DataObjectCollection::saveStruct(DataObjectStructure* structure) {
+  admit();
+  std::lock_guard<std::mutex> guard(structLock);
+
+  return saveStructLocked(structure, nullptr);
+}
+
+DataObject* DataObjectCollection::saveStructIfVersion(
+    DataObjectStructure* structure, uint32_t expectedVersion) {
+  admit();
+  std::lock_guard<std::mutex> guard(structLock);
+
+  return saveStructLocked(structure, &expectedVersion);
+}
+
+DataObject* DataObjectCollection::saveStructLocked(
+    DataObjectStructure* structure, const uint32_t* expectedVersion) {
   // Find the object containing the structure
-  DataObject* object = getObject(structure->getObjectId());
+  DataObject* object = getObjectLocked(structure->getObjectId());
 
-  // Object doesn't exist
-  if (object == nullptr) {
+  // Object doesn't exist or was modified by another writer
+  if (object == nullptr ||
+      (expectedVersion != nullptr && object->version != *expectedVersion)) {
     return nullptr;
   }
 
-  // Clear the existing object data
-  object->clear();
+  // Populate a copy of the object with the structure data
+  DataObject updated;
+  updated.id = object->id;
+  updated.version = object->version;
+  structure->populateObject(&updated);
+  stampSchema(updated);
+
+  // Skip persisting unchanged contents, equal hashes are confirmed by
+  // comparing the entries so a collision can't drop a write
+  if (updated.getContentHash() == object->getContentHash() &&
+      updated.entries == object->entries) {
+    return object;
+  }
 
-  // Populate the object with the structure data
-  structure->populateObject(object);
+  // Keep the current state for a snapshot in progress
+  if (snapshot != nullptr) {
+    snapshot->preserve(*object);
+  }
+
+  // Swap in the new entries, keeping the previous state for the history
+  uint32_t previousVersion = object->version;
+  EntryMap previous;
+  object->entries.swap(updated.entries);
+  object->contentHash = updated.contentHash;
+  object->contentHashValid = true;
+  if (history) {
+    previous.swap(updated.entries);
+  }
+  object->version++;
+
+  sequence++;
+  if (history) {
+    history->recordUpdated(sequence, *object, previousVersion, previous);
+    history->flush();
+  }
 
   // Save the database
-  save();
+  persist([this, object](DatabaseBatch& batch) { batch.put(name, *object); });
 
   return object;
 }
 
 DataObject* DataObjectCollection::loadStruct(DataObjectStructure* structure) {
+  // Migrating may log the object, wait for room in the log first
+  if (!migrations.empty()) {
+    admit();
+  }
+  std::lock_guard<std::mutex> guard(structLock);
+
   // Find the object containing the structure
-  DataObject* object = getObject(structure->getObjectId());
+  DataObject* object = getObjectLocked(structure->getObjectId());
 
   // Object doesn't exist
   if (object == nullptr) {
@@ -207,27 +508,295 @@ DataObject* DataObjectCollection::loadStruct(DataObjectStructure* structure) {
   return object;
 }
 
-DataObject::DataObject() : id(0), entries{} {}
+void DataObjectCollection::enableHistory(uint64_t retention) {
+  std::lock_guard<std::mutex> guard(structLock);
+
+  history.reset(new DataObjectHistory(path + ".history", retention));
+  history->load();
+
+  // Continue numbering from the last recorded commit
+  if (history->getLastSequence() > sequence) {
+    sequence = history->getLastSequence();
+  }
+
+  history->collect(sequence);
+}
+
+void DataObjectCollection::enableSchemaInference() {
+  std::lock_guard<std::mutex> guard(structLock);
+
+  schemaInference = true;
+  schemaReport.reset(new DataSchemaReport(DataSchema::infer(objects)));
+}
+
+const DataSchemaReport* DataObjectCollection::getSchemaReport() const {
+  return schemaReport.get();
+}
+
+void DataObjectCollection::stampSchema(DataObject& object) const {
+  if (!migrations.empty()) {
+    object.set(SCHEMA_VERSION_KEY.getView(),
+               static_cast<int32_t>(migrations.size()));
+  }
+}
+
+void DataObjectCollection::migrate(DataObject& object) {
+  size_t version = 0;
+  EntryMap::const_iterator marker =
+      object.entries.find(SCHEMA_VERSION_KEY.getView());
+  if (marker != object.entries.end()) {
+    const int32_t* stored = marker->second.asInt();
+    if (stored != nullptr && *stored > 0) {
+      version = static_cast<size_t>(*stored);
+    }
+  }
+
+  if (version >= migrations.size()) {
+    return;
+  }
+
+  // A snapshot in progress keeps the object as it is stored
+  if (snapshot != nullptr) {
+    snapshot->preserve(object);
+  }
+
+  // Keep the previous state for the history
+  uint32_t previousVersion = object.version;
+  EntryMap previous;
+  if (history) {
+    previous = object.entries;
+  }
+
+  for (; version < migrations.size(); version++) {
+    migrations[version](object);
+  }
+  stampSchema(object);
+  object.version++;
+
+  sequence++;
+  if (history) {
+    history->recordUpdated(sequence, object, previousVersion, previous);
+    history->flush();
+  }
+
+  // Hosted collections log the migrated object, standalone collections
+  // save it with the next save instead of rewriting the file on a read
+  if (database != nullptr) {
+    persist([this, &object](DatabaseBatch& batch) {
+      batch.put(name, object);
+    });
+  } else {
+    saveDeferred = true;
+  }
+}
+
+uint32_t DataObjectCollection::addMigration(
+    std::function<void(DataObject&)> migration) {
+  std::lock_guard<std::mutex> guard(structLock);
+
+  migrations.push_back(std::move(migration));
+  return static_cast<uint32_t>(migrations.size());
+}
+
+uint32_t DataObjectCollection::getSchemaVersion() const {
+  return static_cast<uint32_t>(migrations.size());
+}
+
+uint64_t DataObjectCollection::getSequence() const {
+  return sequence;
+}
+
+bool DataObjectCollection::getObjectAt(uint32_t id, uint64_t sequence,
+                                       DataObject* out) {
+  std::lock_guard<std::mutex> guard(structLock);
+
+  if (!history) {
+    throw std::runtime_error("History is not enabled for this collection");
+  }
+
+  return history->reconstruct(id, sequence, findObject(id), *out);
+}
+
+size_t DataObjectCollection::collectHistory() {
+  std::lock_guard<std::mutex> guard(structLock);
+
+  if (!history) {
+    return 0;
+  }
+
+  return history->collect(sequence);
+}
+
+BulkLoader::BulkLoader(DataObjectCollection* collection, size_t countHint)
+    : collection(collection), pending{} {
+  // Pre-size the storage so adding objects never reallocates
+  pending.reserve(countHint);
+}
+
+DataObject* BulkLoader::add() {
+  // Get and increment the next ID
+  uint32_t id;
+  {
+    std::lock_guard<std::mutex> guard(collection->structLock);
+    id = collection->nextId;
+    collection->nextId++;
+  }
+
+  // Create the new object in place
+  pending.emplace_back();
+  DataObject* object = &pending.back();
+  object->id = id;
+  object->version = 1;
+  collection->stampSchema(*object);
+
+  return object;
+}
+
+size_t BulkLoader::getPendingCount() const {
+  return pending.size();
+}
+
+size_t BulkLoader::commit() {
+  collection->admit();
+  std::lock_guard<std::mutex> guard(collection->structLock);
+
+  size_t count = pending.size();
+  vector<DataObject>& objects = collection->objects;
+
+  // Record the creation of every loaded object as one commit
+  if (count > 0) {
+    collection->sequence++;
+    if (collection->history) {
+      for (const DataObject& object : pending) {
+        collection->history->recordCreated(collection->sequence, object);
+      }
+      collection->history->flush();
+    }
+  }
+
+  // Keep the loaded IDs for persisting once the objects are moved
+  vector<uint32_t> loaded;
+  loaded.reserve(count);
+  for (const DataObject& object : pending) {
+    loaded.push_back(object.id);
+  }
+
+  // The IDs were given out before any snapshot in progress started,
+  // keep the loaded objects out of it
+  if (collection->snapshot != nullptr) {
+    for (uint32_t id : loaded) {
+      collection->snapshot->exclude(id);
+    }
+  }
+
+  // Pending objects form a single run sorted by ID
+  size_t existing = objects.size();
+  objects.reserve(existing + count);
+  std::move(pending.begin(), pending.end(), std::back_inserter(objects));
+  pending.clear();
+
+  // Objects created on the collection while loading may have been given
+  // higher IDs than the loaded run, merge the two runs back into order
+  if (existing > 0 && count > 0 &&
+      compareObjectIds(objects[existing], objects[existing - 1])) {
+    std::inplace_merge(objects.begin(), objects.begin() + existing,
+                       objects.end(), compareObjectIds);
+  }
+
+  // Save the database
+  collection->persist([this, &loaded](DatabaseBatch& batch) {
+    for (uint32_t id : loaded) {
+      batch.put(collection->name, *collection->findObject(id));
+    }
+  });
+
+  return count;
+}
+
+DataObject::DataObject()
+    : id(0), version(0), entries{}, contentHash(0), contentHashValid(false) {}
 
 uint32_t DataObject::getId() const {
   return id;
 }
 
+uint32_t DataObject::getVersion() const {
+  return version;
+}
+
 void DataObject::clear() {
   entries.clear();
+  contentHashValid = false;
 }
 
 void DataObject::setEntry(string key, DataValue value) {
+  contentHashValid = false;
   entries[key] = value;
 
   DataObject::entries.insert(std::make_pair(key, value));
 }
 
 DataValue* DataObject::getEntry(string key) {
+  // The entry can be modified through the returned pointer
+  contentHashValid = false;
   return &DataObject::entries[key];
 }
 
-void serializeString(ofstream& stream, const string& value) {
+DataValue& DataObject::findOrCreate(std::string_view key) {
+  EntryMap::iterator entry = entries.lower_bound(key);
+  if (entry == entries.end() || entry->first != key) {
+    entry = entries.emplace_hint(entry, string(key), DataValue());
+  }
+  return entry->second;
+}
+
+void DataObject::setEntry(DataKey key, DataValue value) {
+  contentHashValid = false;
+  findOrCreate(key.getView()) = value;
+}
+
+DataValue* DataObject::getEntry(DataKey key) {
+  // The entry can be modified through the returned pointer
+  contentHashValid = false;
+  return &findOrCreate(key.getView());
+}
+
+const EntryMap& DataObject::getEntries() const {
+  return entries;
+}
+
+uint64_t DataObject::getContentHash() const {
+  if (contentHashValid) {
+    return contentHash;
+  }
+
+  uint64_t hash = 0;
+  for (const std::pair<const string, DataValue>& entry : entries) {
+    const DataValue& value = entry.second;
+    hash = hashBytes(entry.first.data(), entry.first.size(), hash);
+
+    // Mixing in the type keeps equal bytes of different types distinct
+    hash ^= value.type;
+    switch (value.type) {
+      case DataValue::STRING:
+        hash = hashBytes(value.stringValue.data(), value.stringValue.size(),
+                         hash);
+        break;
+      case DataValue::INTEGER:
+        hash = hashBytes(&value.intValue, sizeof(value.intValue), hash);
+        break;
+      case DataValue::FLOAT:
+        hash = hashBytes(&value.floatValue, sizeof(value.floatValue), hash);
+        break;
+    }
+  }
+
+  contentHash = hash;
+  contentHashValid = true;
+  return hash;
+}
+
+void serializeString(ostream& stream, const string& value) {
   // Get the length of the string
   uint32_t length = static_cast<uint32_t>(value.size());
   // Write the length of the string
@@ -236,9 +805,9 @@ void serializeString(ofstream& stream, const string& value) {
   stream.write(value.c_str(), length);
 }
 
-void deserializeString(ifstream& stream, string& out) {
+void deserializeString(istream& stream, string& out) {
   // Read the length of the string
-  uint32_t length;
+  uint32_t length = 0;
   stream.read(reinterpret_cast<char*>(&length), sizeof(length));
 
   // Resize the output string
@@ -248,10 +817,92 @@ void deserializeString(ifstream& stream, string& out) {
   stream.read(&out[0], length);
 }
 
-void DataObject::deserialize(ifstream& stream) {
+void serializeCollectionHeader(ostream& stream, uint32_t nextId,
+                               uint32_t size) {
+  // Write the file magic and format version
+  stream.write(reinterpret_cast<const char*>(&FILE_MAGIC), sizeof(FILE_MAGIC));
+  stream.write(reinterpret_cast<const char*>(&FORMAT_VERSION),
+               sizeof(FORMAT_VERSION));
+
+  // Write the next ID
+  stream.write(reinterpret_cast<const char*>(&nextId), sizeof(nextId));
+
+  // Handle initial write error
+  if (stream.fail()) {
+    throw std::runtime_error("Error while writing data object collection nextId");
+  }
+
+  // Write the size of the object list
+  stream.write(reinterpret_cast<const char*>(&size), sizeof(size));
+
+  if (stream.fail()) {
+    throw std::runtime_error("Failed to write objects size");
+  }
+}
+
+uint32_t deserializeCollectionHeader(istream& stream, uint32_t& nextId,
+                                     uint32_t& size) {
+  // Read the file magic, legacy files start with the nextId instead
+  uint32_t magic;
+  stream.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+
+  uint32_t formatVersion = LEGACY_FORMAT_VERSION;
+  if (magic == FILE_MAGIC) {
+    stream.read(reinterpret_cast<char*>(&formatVersion),
+                sizeof(formatVersion));
+
+    if (formatVersion > FORMAT_VERSION) {
+      throw std::runtime_error("Unsupported data object collection format");
+    }
+
+    // Read the nextId from the stream
+    stream.read(reinterpret_cast<char*>(&nextId), sizeof(nextId));
+  } else {
+    nextId = magic;
+  }
+
+  // Handle initial read error
+  if (stream.fail()) {
+    throw std::runtime_error("Error while reading data object collection nextId");
+  }
+
+  // Read the length of the object entries map
+  stream.read(reinterpret_cast<char*>(&size), sizeof(size));
+
+  if (stream.fail()) {
+    throw std::runtime_error("Error while reading data object collection size");
+  }
+
+  return formatVersion;
+}
+
+void DataObject::deserialize(istream& stream, uint32_t formatVersion) {
   // Read the object ID
   stream.read(reinterpret_cast<char*>(&id), sizeof(id));
 
+  // Read the object version, legacy objects start at the first version
+  if (formatVersion >= 2) {
+    stream.read(reinterpret_cast<char*>(&version), sizeof(version));
+  } else {
+    version = 1;
+  }
+
+  // Entries are stored as a front coded block
+  if (formatVersion >= 3) {
+    uint32_t blockSize = 0;
+    stream.read(reinterpret_cast<char*>(&blockSize), sizeof(blockSize));
+
+    vector<uint8_t> block(blockSize);
+    stream.read(reinterpret_cast<char*>(block.data()), blockSize);
+
+    if (stream.fail()) {
+      throw std::runtime_error("Error while reading data object collection object");
+    }
+
+    FrontCodedBlockReader(block.data(), block.size()).decodeAll(entries);
+    return;
+  }
+
   // Read the length of the object entries map
   uint32_t size;
   stream.read(reinterpret_cast<char*>(&size), sizeof(size));
@@ -266,33 +917,101 @@ void DataObject::deserialize(ifstream& stream) {
     entry.deserialize(stream);
 
     if (stream.fail()) {
-      throw std::exception("Error while reading data object collection object");
+      throw std::runtime_error("Error while reading data object collection object");
     }
 
     DataObject::entries[key] = entry;
   }
 }
 
-void DataObject::serialize(ofstream& stream) const {
-  // Write the object ID
-  stream.write(reinterpret_cast<const char*>(&id), sizeof(id));
+void DataObject::serialize(ostream& stream) const {
+  vector<uint8_t> buffer;
+  serialize(stream, buffer);
+}
+
+void DataObject::serialize(ostream& stream, vector<uint8_t>& buffer) const {
+  // Collection files store the in memory encoding
+  buffer.clear();
+  encodeTo(buffer);
+  stream.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+}
 
-  // Get the length of the entries map
-  uint32_t size = static_cast<uint32_t>(entries.size());
+/// <summary>
+/// Size of the fixed fields before the entry block of an encoded object,
+/// the ID, the version and the block size
+/// </summary>
+static const size_t ENCODED_OBJECT_HEADER = 3 * sizeof(uint32_t);
 
-  // Write the entries length
-  stream.write(reinterpret_cast<const char*>(&size), sizeof(size));
+size_t DataObject::getEncodedSize() const {
+  return ENCODED_OBJECT_HEADER + FrontCodedBlockBuilder::measure(entries);
+}
+
+size_t DataObject::encodeTo(uint8_t* buffer, size_t capacity) const {
+  size_t blockSize = FrontCodedBlockBuilder::measure(entries);
+  size_t size = ENCODED_OBJECT_HEADER + blockSize;
+  if (capacity < size) {
+    throw std::length_error("Buffer is too small for the encoded object");
+  }
 
-  for (std::pair<const string&, const DataValue&> entry : DataObject::entries) {
-    const string& key = entry.first;
-    const DataValue value = entry.second;
+  encodeWithBlockSize(buffer, blockSize);
+  return size;
+}
+
+void DataObject::encodeTo(vector<uint8_t>& buffer) const {
+  // Measuring walks every key, so it is only done once per encode
+  size_t blockSize = FrontCodedBlockBuilder::measure(entries);
+  size_t offset = buffer.size();
+  buffer.resize(offset + ENCODED_OBJECT_HEADER + blockSize);
+  encodeWithBlockSize(buffer.data() + offset, blockSize);
+}
 
-    // Serialize the key
-    serializeString(stream, key);
+void DataObject::encodeWithBlockSize(uint8_t* buffer, size_t blockSize) const {
+  uint32_t blockLength = static_cast<uint32_t>(blockSize);
+  memcpy(buffer, &id, sizeof(id));
+  memcpy(buffer + sizeof(id), &version, sizeof(version));
+  memcpy(buffer + sizeof(id) + sizeof(version), &blockLength,
+         sizeof(blockLength));
+
+  // Map iteration is in key order so neighbouring keys share prefixes
+  FrontCodedBlockBuilder::encode(entries, buffer + ENCODED_OBJECT_HEADER,
+                                 blockSize);
+}
 
-    // Serialize the value
-    value.serialize(stream);
+size_t DataObject::decodeFrom(const uint8_t* data, size_t size) {
+  size_t blockSize;
+  const uint8_t* block = getEncodedBlock(data, size, blockSize);
+  memcpy(&id, data, sizeof(id));
+  memcpy(&version, data + sizeof(id), sizeof(version));
+
+  clear();
+  FrontCodedBlockReader(block, blockSize).decodeAll(entries);
+  return ENCODED_OBJECT_HEADER + blockSize;
+}
+
+const uint8_t* DataObject::getEncodedBlock(const uint8_t* data, size_t size,
+                                           size_t& blockSize) {
+  if (size < ENCODED_OBJECT_HEADER) {
+    throw std::runtime_error("Encoded object is truncated");
+  }
+
+  uint32_t blockLength;
+  memcpy(&blockLength, data + 2 * sizeof(uint32_t), sizeof(blockLength));
+  if (size - ENCODED_OBJECT_HEADER < blockLength) {
+    throw std::runtime_error("Encoded object is truncated");
   }
+
+  blockSize = blockLength;
+  return data + ENCODED_OBJECT_HEADER;
+}
+
+EntryAccessError::EntryAccessError(EntryError error, const string& key)
+    : std::runtime_error(error == EntryError::MISSING
+                             ? "Entry does not exist: " + key
+                             : "Entry has a different type: " + key),
+      error(error) {}
+
+EntryError EntryAccessError::getError() const {
+  return error;
 }
 
 DataValue::DataValue() : type(DataValue::INTEGER), intValue(0) {}
@@ -363,7 +1082,32 @@ float* DataValue::asFloat() {
   return &this->floatValue;
 }
 
-void DataValue::serialize(ofstream& stream) const {
+const string* DataValue::asString() const {
+  if (DataValue::type != DataValue::STRING) {
+    return nullptr;
+  }
+  return &this->stringValue;
+}
+
+const int32_t* DataValue::asInt() const {
+  if (DataValue::type != DataValue::INTEGER) {
+    return nullptr;
+  }
+  return &this->intValue;
+}
+
+const float* DataValue::asFloat() const {
+  if (DataValue::type != DataValue::FLOAT) {
+    return nullptr;
+  }
+  return &this->floatValue;
+}
+
+DataValue::Type DataValue::getType() const {
+  return type;
+}
+
+void DataValue::serialize(ostream& stream) const {
   // Write the type
   stream.write(reinterpret_cast<const char*>(&type), sizeof(type));
 
@@ -386,7 +1130,7 @@ void DataValue::serialize(ofstream& stream) const {
   }
 }
 
-void DataValue::deserialize(std::ifstream& stream) {
+void DataValue::deserialize(std::istream& stream) {
   // Read the type byte from the stream
   stream.read(reinterpret_cast<char*>(&type), sizeof(type));
 
@@ -413,6 +1157,23 @@ void DataValue::deserialize(std::ifstream& stream) {
   }
 }
 
+bool DataValue::operator==(const DataValue& other) const {
+  if (type != other.type) {
+    return false;
+  }
+
+  switch (type) {
+    case DataValue::STRING:
+      return stringValue == other.stringValue;
+    case DataValue::INTEGER:
+      return intValue == other.intValue;
+    case DataValue::FLOAT:
+      return floatValue == other.floatValue;
+  }
+
+  return false;
+}
+
 DataValue& DataValue::operator=(const DataValue& other) {
   if (this == &other)
     return *this;
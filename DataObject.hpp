@@ -1,32 +1,78 @@
-
 #ifndef DATA_OBJECT
 #define DATA_OBJECT 1
 
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <stdint.h>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "DataKey.hpp"
+#include "Expected.hpp"
+
 using std::ifstream;
 using std::int32_t;
+using std::istream;
 using std::map;
 using std::ofstream;
+using std::ostream;
 using std::string;
 using std::uint32_t;
 using std::uint8_t;
 using std::vector;
 
+/// <summary>
+/// Reasons a typed entry access can fail
+/// </summary>
+enum class EntryError : uint8_t { MISSING, TYPE_MISMATCH };
+
+/// <summary>
+/// Thrown by DataObject::get when the entry doesn't exist or holds a
+/// value of a different type
+/// </summary>
+class EntryAccessError : public std::runtime_error {
+ private:
+  EntryError error;
+
+ public:
+  EntryAccessError(EntryError error, const string& key);
+
+  /// <summary>
+  /// Provides the reason the access failed
+  /// </summary>
+  EntryError getError() const;
+};
+
+/// <summary>
+/// Always false, used to reject unsupported value types only when a
+/// template is instantiated with them
+/// </summary>
+template <typename T>
+struct UnsupportedValueType : std::false_type {};
+
 /// <summary>
 /// Value stored within a DataObject, can be a String, Integer, or Float
 /// </summary>
 class DataValue {
+ public:
+  /// <summary>
+  /// The types of data that can be stored within a data value
+  /// </summary>
+  enum Type : uint8_t { STRING, INTEGER, FLOAT };
+
  private:
   /// <summary>
   /// The type of data stored
   /// </summary>
-  enum : uint8_t { STRING, INTEGER, FLOAT } type;
+  Type type;
   union {
     /// <summary>
     /// String value
@@ -46,13 +92,13 @@ class DataValue {
   /// Serializes this data value to the provided stream
   /// </summary>
   /// <param name="stream">The stream to write to</param>
-  void serialize(std::ofstream& stream) const;
+  void serialize(std::ostream& stream) const;
 
   /// <summary>
   /// Deserializes this data value from the provided stream
   /// </summary>
   /// <param name="stream">The stream to read from</param>
-  void deserialize(std::ifstream& stream);
+  void deserialize(std::istream& stream);
 
  public:
   /// <summary>
@@ -109,14 +155,76 @@ class DataValue {
   /// <returns>Pointer to the float value or a nullptr</returns>
   float* asFloat();
 
+  /// <summary>
+  /// Const variant of asString for read only access
+  /// </summary>
+  /// <returns>Pointer to the string value or a nullptr</returns>
+  const string* asString() const;
+
+  /// <summary>
+  /// Const variant of asInt for read only access
+  /// </summary>
+  /// <returns>Pointer to the int value or a nullptr</returns>
+  const int32_t* asInt() const;
+
+  /// <summary>
+  /// Const variant of asFloat for read only access
+  /// </summary>
+  /// <returns>Pointer to the float value or a nullptr</returns>
+  const float* asFloat() const;
+
+  /// <summary>
+  /// Provides the type of the underlying value
+  /// </summary>
+  /// <returns>The value type</returns>
+  Type getType() const;
+
+  /// <summary>
+  /// Typed variant of asString, asInt and asFloat, the accessor is
+  /// chosen at compile time so only the type test remains at runtime.
+  /// T must be string, int32_t or float
+  /// </summary>
+  /// <returns>Pointer to the value or a nullptr if the value has a
+  /// different type</returns>
+  template <typename T>
+  const T* as() const;
+
+  template <typename T>
+  T* as();
+
+  /// <summary>
+  /// Calls the visitor with the underlying string, int32_t or float
+  /// value. The visitor must return the same type for every value type
+  /// </summary>
+  /// <param name="visitor">The function to call</param>
+  /// <returns>The result of the visitor</returns>
+  template <typename F>
+  decltype(auto) visit(F&& visitor) const;
+
+  template <typename F>
+  decltype(auto) visit(F&& visitor);
+
   /// <summary>
   /// Assings self from the provided other data value
   /// </summary>
   DataValue& operator=(const DataValue& other);
 
+  /// <summary>
+  /// Compares the type and value of this data value to another
+  /// </summary>
+  bool operator==(const DataValue& other) const;
+
   friend class DataObject;
+  friend class DataObjectHistory;
 };
 
+/// <summary>
+/// Entries of a DataObject ordered by key. The comparator is
+/// transparent so entries can be found by a DataKey or string_view
+/// without constructing a string
+/// </summary>
+typedef map<string, DataValue, std::less<>> EntryMap;
+
 /// <summary>
 /// Object of data stored within a data object collection. Objects
 /// contain a collection of key value entries.
@@ -130,22 +238,57 @@ class DataObject {
   /// </summary>
   uint32_t id;
 
+  /// <summary>
+  /// Version of this object, starts at one when the object is created
+  /// and is increased each time a structure is saved to the object
+  /// </summary>
+  uint32_t version;
+
   /// <summary>
   /// Collection of key value entries present in this object
   /// </summary>
-  map<string, DataValue> entries;
+  EntryMap entries;
+
+  /// <summary>
+  /// Cached hash of the entries, cleared whenever the entries may be
+  /// modified
+  /// </summary>
+  mutable uint64_t contentHash;
+  mutable bool contentHashValid;
 
   /// <summary>
   /// Deserializes the object from the provided stream
   /// </summary>
   /// <param name="stream">The stream to read from</param>
-  void deserialize(std::ifstream& stream);
+  /// <param name="formatVersion">The file format version being read</param>
+  void deserialize(std::istream& stream, uint32_t formatVersion);
 
   /// <summary>
   /// Serializes the object writing it to the provided stream
   /// </summary>
   /// <param name="stream">The stream to write to</param>
-  void serialize(std::ofstream& stream) const;
+  void serialize(std::ostream& stream) const;
+
+  /// <summary>
+  /// Serializes the object encoding it in the provided scratch buffer,
+  /// so writing many objects reuses a single allocation
+  /// </summary>
+  /// <param name="stream">The stream to write to</param>
+  /// <param name="buffer">The scratch buffer, its contents are
+  /// replaced</param>
+  void serialize(std::ostream& stream, vector<uint8_t>& buffer) const;
+
+  /// <summary>
+  /// Writes the encoded object to the buffer, which must hold the header
+  /// and the entry block of the measured size
+  /// </summary>
+  void encodeWithBlockSize(uint8_t* buffer, size_t blockSize) const;
+
+  /// <summary>
+  /// Provides the value for the key, creating an empty entry if it
+  /// doesn't exist. The key is only copied when the entry is created
+  /// </summary>
+  DataValue& findOrCreate(std::string_view key);
 
  public:
   /// <summary>
@@ -159,6 +302,13 @@ class DataObject {
   /// <returns>The object ID</returns>
   uint32_t getId() const;
 
+  /// <summary>
+  /// Provides the version of this object, used by structures to detect
+  /// concurrent modification when saving with saveStructIfVersion
+  /// </summary>
+  /// <returns>The object version</returns>
+  uint32_t getVersion() const;
+
   /// <summary>
   /// Sets the entry at the provided key to the provided
   /// value
@@ -174,14 +324,210 @@ class DataObject {
   /// <param name="key">The entry key</param>
   DataValue* getEntry(string key);
 
+  /// <summary>
+  /// Variants of setEntry and getEntry for compile time keys
+  /// ("username"_key), which are found without constructing a string
+  /// </summary>
+  void setEntry(DataKey key, DataValue value);
+  DataValue* getEntry(DataKey key);
+
+  /// <summary>
+  /// Provides the value of the entry as the provided type, without
+  /// creating the entry when it doesn't exist. T must be string,
+  /// int32_t or float
+  /// </summary>
+  /// <param name="key">The entry key</param>
+  /// <returns>The entry value</returns>
+  /// <exception cref="EntryAccessError">The entry doesn't exist or has
+  /// a different type</exception>
+  template <typename T>
+  const T& get(std::string_view key) const;
+
+  /// <summary>
+  /// Variant of get that reports failure through the result rather
+  /// than throwing
+  /// </summary>
+  /// <param name="key">The entry key</param>
+  /// <returns>The entry value or the reason it couldn't be read</returns>
+  template <typename T>
+  Expected<T, EntryError> tryGet(std::string_view key) const;
+
+  /// <summary>
+  /// Sets the entry at the provided key, the stored type is chosen at
+  /// compile time from the value. Values must be a string (or string
+  /// literal), int32_t or float
+  /// </summary>
+  /// <param name="key">The entry key</param>
+  /// <param name="value">The entry value</param>
+  template <typename T>
+  void set(std::string_view key, T&& value);
+
+  /// <summary>
+  /// Provides read only access to all the entries within this
+  /// object, ordered by key
+  /// </summary>
+  /// <returns>The object entries</returns>
+  const EntryMap& getEntries() const;
+
+  /// <summary>
+  /// Provides a 64 bit hash of the object entries (XXH64 over each key
+  /// and value). Objects with equal entries have equal hashes, so the
+  /// hash can be stored to cheaply detect later changes.
+  ///
+  /// The hash is cached until the entries are modified
+  /// </summary>
+  /// <returns>The content hash</returns>
+  uint64_t getContentHash() const;
+
+  /// <summary>
+  /// Provides the exact number of bytes encodeTo writes for this object
+  /// </summary>
+  /// <returns>The encoded size</returns>
+  size_t getEncodedSize() const;
+
+  /// <summary>
+  /// Encodes the object into the provided buffer using the same binary
+  /// encoding as collection files: the ID, the version, the entry block
+  /// size and the front coded entry block
+  /// </summary>
+  /// <param name="buffer">The buffer to write to</param>
+  /// <param name="capacity">The size of the buffer, must be at least
+  /// getEncodedSize bytes</param>
+  /// <returns>The number of bytes written</returns>
+  size_t encodeTo(uint8_t* buffer, size_t capacity) const;
+
+  /// <summary>
+  /// Appends the encoded object to the provided buffer, growing it with
+  /// a single allocation
+  /// </summary>
+  /// <param name="buffer">The buffer to append to</param>
+  void encodeTo(vector<uint8_t>& buffer) const;
+
+  /// <summary>
+  /// Replaces the ID, version and entries of this object with an object
+  /// decoded from the provided buffer
+  /// </summary>
+  /// <param name="data">The encoded object</param>
+  /// <param name="size">The number of bytes available</param>
+  /// <returns>The number of bytes the object used</returns>
+  size_t decodeFrom(const uint8_t* data, size_t size);
+
+  /// <summary>
+  /// Locates the front coded entry block of an object encoded with
+  /// encodeTo, so single entries can be found without decoding the
+  /// whole object
+  /// </summary>
+  /// <param name="data">The encoded object</param>
+  /// <param name="size">The number of bytes available</param>
+  /// <param name="blockSize">The size of the entry block</param>
+  /// <returns>The start of the entry block</returns>
+  static const uint8_t* getEncodedBlock(const uint8_t* data, size_t size,
+                                        size_t& blockSize);
+
   /// <summary>
   /// Clears the contents of the object
   /// </summary>
   void clear();
 
   friend class DataObjectCollection;
+  friend class DataObjectHistory;
+  friend class BulkLoader;
+  friend class Database;
+  friend class DatabaseBatch;
+  friend class IncrementalSnapshot;
+  friend class PersistentCollection;
+  friend class PersistentSnapshot;
 };
 
+template <typename T>
+const T* DataValue::as() const {
+  if constexpr (std::is_same<T, string>::value) {
+    return type == DataValue::STRING ? &stringValue : nullptr;
+  } else if constexpr (std::is_same<T, int32_t>::value) {
+    return type == DataValue::INTEGER ? &intValue : nullptr;
+  } else if constexpr (std::is_same<T, float>::value) {
+    return type == DataValue::FLOAT ? &floatValue : nullptr;
+  } else {
+    static_assert(UnsupportedValueType<T>::value,
+                  "Data values are string, int32_t or float");
+  }
+}
+
+template <typename T>
+T* DataValue::as() {
+  return const_cast<T*>(static_cast<const DataValue*>(this)->as<T>());
+}
+
+template <typename F>
+decltype(auto) DataValue::visit(F&& visitor) const {
+  switch (type) {
+    case DataValue::STRING:
+      return std::forward<F>(visitor)(stringValue);
+    case DataValue::INTEGER:
+      return std::forward<F>(visitor)(intValue);
+    default:
+      return std::forward<F>(visitor)(floatValue);
+  }
+}
+
+template <typename F>
+decltype(auto) DataValue::visit(F&& visitor) {
+  switch (type) {
+    case DataValue::STRING:
+      return std::forward<F>(visitor)(stringValue);
+    case DataValue::INTEGER:
+      return std::forward<F>(visitor)(intValue);
+    default:
+      return std::forward<F>(visitor)(floatValue);
+  }
+}
+
+template <typename T>
+const T& DataObject::get(std::string_view key) const {
+  EntryMap::const_iterator entry = entries.find(key);
+  if (entry == entries.end()) {
+    throw EntryAccessError(EntryError::MISSING, string(key));
+  }
+
+  const T* value = entry->second.as<T>();
+  if (value == nullptr) {
+    throw EntryAccessError(EntryError::TYPE_MISMATCH, string(key));
+  }
+  return *value;
+}
+
+template <typename T>
+Expected<T, EntryError> DataObject::tryGet(std::string_view key) const {
+  EntryMap::const_iterator entry = entries.find(key);
+  if (entry == entries.end()) {
+    return Expected<T, EntryError>::failure(EntryError::MISSING);
+  }
+
+  const T* value = entry->second.as<T>();
+  if (value == nullptr) {
+    return Expected<T, EntryError>::failure(EntryError::TYPE_MISMATCH);
+  }
+  return Expected<T, EntryError>(*value);
+}
+
+template <typename T>
+void DataObject::set(std::string_view key, T&& value) {
+  typedef typename std::decay<T>::type Value;
+
+  if constexpr (std::is_same<Value, string>::value ||
+                std::is_same<Value, const char*>::value ||
+                std::is_same<Value, char*>::value) {
+    findOrCreate(key) = DataValue(string(std::forward<T>(value)));
+  } else if constexpr (std::is_same<Value, int32_t>::value ||
+                       std::is_same<Value, float>::value) {
+    findOrCreate(key) = DataValue(static_cast<Value>(value));
+  } else {
+    static_assert(UnsupportedValueType<Value>::value,
+                  "Data values are string, int32_t or float");
+  }
+  contentHashValid = false;
+}
+
 /// <summary>
 /// Abstract class implemented by structures that can be
 /// serialized and deserialized as DataObjects
@@ -206,7 +552,8 @@ class DataObjectStructure {
   virtual void populateObject(DataObject* object) = 0;
 
   /// <summary>
-  /// Creates this structure from the provided obejct
+  /// Creates this structure from the provided obejct. Structures that
+  /// save optimistically should also keep object->getVersion()
   /// </summary>
   /// <param name="object">The object to create from</param>
   virtual void fromObject(DataObject* object) = 0;
@@ -219,14 +566,42 @@ class DataObjectStructure {
 /// </summary>
 /// <param name="stream">The stream to write to</param>
 /// <param name="value">The string value to write</param>
-void serializeString(ofstream& stream, const string& value);
+void serializeString(ostream& stream, const string& value);
 
 /// <summary>
 /// Deserializes a string from the provided stream, storing the
 /// deserialized string in the provided out variable
 /// </summary>
 /// <param name="out">The string to store the value in</param>
-void deserializeString(ifstream& stream, string& out);
+void deserializeString(istream& stream, string& out);
+
+/// <summary>
+/// Serializes the header of a collection file, the file magic and format
+/// version followed by the next ID and the number of objects
+/// </summary>
+/// <param name="stream">The stream to write to</param>
+/// <param name="nextId">The next ID of the collection</param>
+/// <param name="size">The number of objects that follow</param>
+void serializeCollectionHeader(ostream& stream, uint32_t nextId,
+                               uint32_t size);
+
+/// <summary>
+/// Deserializes the header of a collection file, legacy files without
+/// the file magic are also accepted
+/// </summary>
+/// <param name="stream">The stream to read from</param>
+/// <param name="nextId">Stores the next ID of the collection</param>
+/// <param name="size">Stores the number of objects that follow</param>
+/// <returns>The format version of the file</returns>
+uint32_t deserializeCollectionHeader(istream& stream, uint32_t& nextId,
+                                     uint32_t& size);
+
+class DataObjectHistory;
+class Database;
+class DatabaseBatch;
+class IncrementalSnapshot;
+class StorageBackend;
+struct DataSchemaReport;
 
 /// <summary>
 /// Collection of DataObjects creating a data store, this store can
@@ -241,14 +616,117 @@ class DataObjectCollection {
   /// </summary>
   string path;
   /// <summary>
+  /// Storage the collection is loaded from and saved to
+  /// </summary>
+  std::unique_ptr<StorageBackend> storage;
+  /// <summary>
   /// Unique ID counter for the ID that should be given
   /// to the next object created
   /// </summary>
   uint32_t nextId;
   /// <summary>
-  /// The underlying collection of objects
+  /// The underlying collection of objects, kept sorted by ID so
+  /// that the vector itself acts as the ID index
   /// </summary>
   vector<DataObject> objects;
+  /// <summary>
+  /// Lock held while structures are stored, saved and loaded so that
+  /// version checks and updates happen atomically
+  /// </summary>
+  std::mutex structLock;
+  /// <summary>
+  /// Sequence number of the last commit made to the collection
+  /// </summary>
+  uint64_t sequence;
+  /// <summary>
+  /// Retained history of object changes, nullptr unless history has
+  /// been enabled
+  /// </summary>
+  std::unique_ptr<DataObjectHistory> history;
+  /// <summary>
+  /// Database hosting this collection, nullptr for collections stored
+  /// in their own file
+  /// </summary>
+  Database* database;
+  /// <summary>
+  /// Name of this collection within its database
+  /// </summary>
+  string name;
+  /// <summary>
+  /// Incremental snapshot in progress, nullptr when there is none
+  /// </summary>
+  IncrementalSnapshot* snapshot;
+  /// <summary>
+  /// Whether changes were left unsaved because an incremental snapshot
+  /// was being written to the storage of the collection
+  /// </summary>
+  mutable bool saveDeferred;
+  /// <summary>
+  /// Whether load infers the schema of the collection
+  /// </summary>
+  bool schemaInference;
+  /// <summary>
+  /// Schema inferred by the last load, nullptr unless schema inference
+  /// has been enabled
+  /// </summary>
+  std::unique_ptr<DataSchemaReport> schemaReport;
+  /// <summary>
+  /// Migrations between schema versions, the migration at index i
+  /// upgrades objects from version i to version i + 1
+  /// </summary>
+  vector<std::function<void(DataObject&)>> migrations;
+
+  /// <summary>
+  /// Marks the object as being in the current schema version, objects
+  /// are only marked once a migration has been added
+  /// </summary>
+  void stampSchema(DataObject& object) const;
+
+  /// <summary>
+  /// Applies the migrations the object hasn't had yet. A migrated object
+  /// is a new version, recorded in the history and logged by hosted
+  /// collections. Called with structLock held
+  /// </summary>
+  void migrate(DataObject& object);
+
+  /// <summary>
+  /// Finds the object with the provided ID without migrating it
+  /// </summary>
+  /// <returns>The object with the provided ID or null</returns>
+  DataObject* findObject(uint32_t id);
+
+  /// <summary>
+  /// Provides the object with the provided ID, migrating it if needed.
+  /// Called with structLock held
+  /// </summary>
+  /// <returns>The object with the provided ID or null</returns>
+  DataObject* getObjectLocked(uint32_t id);
+
+  /// <summary>
+  /// Saves the structure to its object, shared by saveStruct and
+  /// saveStructIfVersion. Called with structLock held
+  /// </summary>
+  /// <param name="expectedVersion">The version the object must have, or
+  /// nullptr to save over any version</param>
+  /// <returns>The saved object or null</returns>
+  DataObject* saveStructLocked(DataObjectStructure* structure,
+                               const uint32_t* expectedVersion);
+
+  /// <summary>
+  /// Persists the changes made by an operation. Hosted collections add
+  /// the changes to a batch that is written to the database log, other
+  /// collections save their whole file, unless an incremental snapshot
+  /// is being written to it in which case the save is deferred
+  /// </summary>
+  /// <param name="changes">Function adding the changes to a batch</param>
+  void persist(const std::function<void(DatabaseBatch&)>& changes);
+
+  /// <summary>
+  /// Waits until the hosting database accepts more changes, see
+  /// Database::setBackpressure. Must be called before taking the struct
+  /// lock
+  /// </summary>
+  void admit();
 
  public:
   /// <summary>
@@ -257,6 +735,16 @@ class DataObjectCollection {
   /// <param name="path">The path to the data object file</param>
   DataObjectCollection(string path);
 
+  /// <summary>
+  /// Creates a new data object collection stored in the provided
+  /// storage backend, the path is only used for the history log
+  /// </summary>
+  /// <param name="path">The path of the collection</param>
+  /// <param name="storage">The storage to load from and save to</param>
+  DataObjectCollection(string path, std::unique_ptr<StorageBackend> storage);
+
+  ~DataObjectCollection();
+
   /// <summary>
   /// Deserializes this object collection from a file at the specific
   /// path for this colleciton.
@@ -277,20 +765,58 @@ class DataObjectCollection {
   /// </summary>
   void save() const;
 
+  /// <summary>
+  /// Provides whether changes made while an incremental snapshot was
+  /// being written to the collection storage, or objects migrated since
+  /// the last save, are still unsaved. They are saved by the next save
+  /// or incremental snapshot
+  /// </summary>
+  bool isSaveDeferred() const;
+
   /// <summary>
   /// Provides a pointer to the object with the provided ID. If the
-  /// obejct does not exist a nullptr is returned instead
+  /// obejct does not exist a nullptr is returned instead.
+  ///
+  /// Objects from an older schema version are migrated when they are
+  /// first provided, see addMigration. The lookup and migration hold
+  /// the struct lock, but the object itself can be changed by other
+  /// threads once it has been provided
   /// </summary>
   /// <param name="id">The ID of the object to return</param>
   /// <returns>The object with the provided ID or null</returns>
   DataObject* getObject(uint32_t id);
 
+  /// <summary>
+  /// Provides the object with the provided ID for modification through
+  /// the returned pointer. The object is first preserved for any
+  /// incremental snapshot in progress so the changes don't leak into it
+  /// </summary>
+  /// <param name="id">The ID of the object to return</param>
+  /// <returns>The object with the provided ID or null</returns>
+  DataObject* getObjectForUpdate(uint32_t id);
+
   /// <summary>
   /// Provides the total number of objects stored in this collection
   /// </summary>
   /// <returns>The number of objects</returns>
   size_t getObjectCount();
 
+  /// <summary>
+  /// Provides read only access to all the objects stored in this
+  /// collection, ordered by ID
+  /// </summary>
+  /// <returns>The objects in the collection</returns>
+  const vector<DataObject>& getObjects() const;
+
+  /// <summary>
+  /// Calls the visitor with each object in ID order while holding the
+  /// struct lock, so writers on other threads can't change the objects
+  /// during the scan. The visitor must not call back into the collection
+  /// </summary>
+  /// <param name="visitor">Function returning false to stop the scan
+  /// </param>
+  void visitObjects(const std::function<bool(const DataObject&)>& visitor);
+
   /// <summary>
   /// Deletes an object with the provided ID if one is present
   ///
@@ -299,6 +825,37 @@ class DataObjectCollection {
   /// <param name="id">The ID of the object to delete</param>
   void deleteObject(uint32_t id);
 
+  /// <summary>
+  /// Deletes the object with the provided ID if one is present, and
+  /// persists the deletion like the struct functions: hosted
+  /// collections log it, other collections are saved
+  /// </summary>
+  /// <param name="id">The ID of the object to delete</param>
+  /// <returns>Whether an object was deleted</returns>
+  bool removeObject(uint32_t id);
+
+  /// <summary>
+  /// Deletes every object matching the provided predicate. Matching
+  /// objects are removed in a single compaction pass.
+  ///
+  /// Saves the object collection once if any objects were deleted. The
+  /// predicate is called with the struct lock held, so it must not call
+  /// back into the collection
+  /// </summary>
+  /// <param name="predicate">Predicate selecting objects to delete</param>
+  /// <returns>The number of objects deleted</returns>
+  size_t deleteWhere(const std::function<bool(const DataObject&)>& predicate);
+
+  /// <summary>
+  /// Deletes every object with an ID in the provided list. Matching
+  /// objects are removed in a single compaction pass.
+  ///
+  /// Saves the object collection once if any objects were deleted
+  /// </summary>
+  /// <param name="ids">The IDs of the objects to delete</param>
+  /// <returns>The number of objects deleted</returns>
+  size_t deleteObjects(const vector<uint32_t>& ids);
+
   /// <summary>
   /// Creates a new object, allocates the next ID
   /// to the object and increases the ID counter
@@ -318,18 +875,172 @@ class DataObjectCollection {
   /// Saves an existing data object structure back to the database with
   /// its new changes
   ///
-  /// Saves the object collection automatically
+  /// Saves the object collection automatically, unless the structure
+  /// produced the same entries as the object already has in which case
+  /// the object, its version and the collection are left untouched
   /// </summary>
   /// <returns>The underlying data object loaded from or nullptr if
   /// none</returns>
   DataObject* saveStruct(DataObjectStructure* structure);
 
+  /// <summary>
+  /// Saves an existing data object structure back to the database only
+  /// if the object is still at the expected version, allowing writers to
+  /// prepare changes without holding a lock (compare-and-set)
+  ///
+  /// Saves the object collection automatically when the object's
+  /// entries are changed
+  /// </summary>
+  /// <param name="structure">The structure to save</param>
+  /// <param name="expectedVersion">The version the structure was loaded
+  /// from</param>
+  /// <returns>The updated data object or nullptr if the object doesn't
+  /// exist or has been modified since the expected version</returns>
+  DataObject* saveStructIfVersion(DataObjectStructure* structure,
+                                  uint32_t expectedVersion);
+
   /// <summary>
   /// Loads an existing structure from the databse
   /// </summary>
   /// <returns>The underlying data object loaded from or nullptr if
   /// none</returns>
   DataObject* loadStruct(DataObjectStructure* structure);
+
+  /// <summary>
+  /// Enables retention of object history, changes made through the
+  /// collection are stored as deltas in a history log next to the
+  /// collection file (path + ".history") which is loaded if it exists.
+  ///
+  /// Changes made directly to objects returned by the collection are
+  /// not tracked until they are saved through saveStruct
+  /// </summary>
+  /// <param name="retention">The number of commits to retain history
+  /// for, zero retains all history</param>
+  void enableHistory(uint64_t retention);
+
+  /// <summary>
+  /// Provides the sequence number of the last commit made to the
+  /// collection
+  /// </summary>
+  /// <returns>The commit sequence number</returns>
+  uint64_t getSequence() const;
+
+  /// <summary>
+  /// Reconstructs the state of an object as it was after the commit
+  /// with the provided sequence number. History must be enabled
+  /// </summary>
+  /// <param name="id">The ID of the object</param>
+  /// <param name="sequence">The commit sequence number</param>
+  /// <param name="out">The object to store the state in</param>
+  /// <returns>Whether the object existed at that sequence</returns>
+  bool getObjectAt(uint32_t id, uint64_t sequence, DataObject* out);
+
+  /// <summary>
+  /// Removes history that is older than the retention window and
+  /// compacts the history log
+  /// </summary>
+  /// <returns>The number of changes removed</returns>
+  size_t collectHistory();
+
+  /// <summary>
+  /// Enables schema inference, the schema of the objects is inferred
+  /// from the frequencies of their shapes each time the collection is
+  /// loaded, or immediately if objects are already loaded. The report
+  /// holds the layout that would use the least memory for the objects
+  /// and its estimated savings
+  /// </summary>
+  void enableSchemaInference();
+
+  /// <summary>
+  /// Provides the schema inferred when the collection was last loaded
+  /// </summary>
+  /// <returns>The report or nullptr if schema inference isn't enabled
+  /// </returns>
+  const DataSchemaReport* getSchemaReport() const;
+
+  /// <summary>
+  /// Entry holding the schema version of an object, objects without it
+  /// are version zero
+  /// </summary>
+  static constexpr DataKey SCHEMA_VERSION_KEY = "$schema"_key;
+
+  /// <summary>
+  /// Adds a migration upgrading objects to the next schema version, such
+  /// as adding or renaming entries. Objects aren't rewritten up front,
+  /// each object is migrated the first time getObject (or a struct
+  /// function) provides it. The migrated object gets a new version,
+  /// recorded in the history like any update. Hosted collections log
+  /// it, standalone collections save it with the next save rather than
+  /// rewriting the file on a read, see isSaveDeferred. getObjects
+  /// provides objects as they are stored.
+  ///
+  /// Objects created or saved through the collection or its database
+  /// are marked with the current version. Migrations should be added in
+  /// order before the collection is used
+  /// </summary>
+  /// <param name="migration">Function upgrading an object in place
+  /// </param>
+  /// <returns>The schema version the migration upgrades to</returns>
+  uint32_t addMigration(std::function<void(DataObject&)> migration);
+
+  /// <summary>
+  /// Provides the current schema version, the number of migrations
+  /// </summary>
+  uint32_t getSchemaVersion() const;
+
+  friend class BulkLoader;
+  friend class Database;
+  friend class IncrementalSnapshot;
+  friend class WarmImage;
+};
+
+/// <summary>
+/// Fast path for creating large numbers of objects within a collection.
+///
+/// Objects are created in storage that is pre-sized from the count hint
+/// and are only merged into the collection when the loader is committed,
+/// as a single sorted run, before the collection is saved once.
+///
+/// Pointers returned by add remain valid until the count hint is
+/// exceeded or the loader is committed.
+/// </summary>
+class BulkLoader {
+ private:
+  /// <summary>
+  /// The collection the objects are loaded into
+  /// </summary>
+  DataObjectCollection* collection;
+  /// <summary>
+  /// Objects created by this loader that have not been committed
+  /// </summary>
+  vector<DataObject> pending;
+
+ public:
+  /// <summary>
+  /// Creates a new bulk loader for the provided collection
+  /// </summary>
+  /// <param name="collection">The collection to load into</param>
+  /// <param name="countHint">The expected number of objects</param>
+  BulkLoader(DataObjectCollection* collection, size_t countHint);
+
+  /// <summary>
+  /// Creates a new object, allocating the next ID from the collection
+  /// </summary>
+  /// <returns>The newly allocated object</returns>
+  DataObject* add();
+
+  /// <summary>
+  /// Provides the number of objects waiting to be committed
+  /// </summary>
+  /// <returns>The number of pending objects</returns>
+  size_t getPendingCount() const;
+
+  /// <summary>
+  /// Moves the pending objects into the collection and saves the
+  /// collection once
+  /// </summary>
+  /// <returns>The number of objects committed</returns>
+  size_t commit();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,388 @@
+#include "DataObjectHistory.hpp"
+
+#include <fstream>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "StorageBackend.hpp"
+
+using std::ifstream;
+using std::ios;
+using std::map;
+using std::ofstream;
+using std::ostream;
+using std::string;
+using std::uint32_t;
+using std::uint64_t;
+using std::vector;
+
+/// <summary>
+/// Magic value written at the start of history log files ("DOBH")
+/// </summary>
+static const uint32_t HISTORY_MAGIC = 0x48424F44;
+
+/// <summary>
+/// History log format version
+/// </summary>
+static const uint32_t HISTORY_FORMAT_VERSION = 1;
+
+DataObjectHistory::DataObjectHistory(string path, uint64_t retention)
+    : path(path),
+      retention(retention),
+      lastSequence(0),
+      horizon(0),
+      changes{},
+      firstChange(0),
+      objectChanges{},
+      unflushed(0) {}
+
+void DataObjectHistory::load() {
+  struct stat stats;
+
+  // Get the file path stats
+  if (stat(path.c_str(), &stats) != 0) {
+    // File doesn't exist, no loading to be done
+    return;
+  }
+
+  // Open binary stream to the file
+  ifstream stream(path, ios::binary);
+
+  if (!stream.is_open()) {
+    throw std::runtime_error("Failed to open stream to history log file");
+  }
+
+  uint32_t magic;
+  uint32_t formatVersion;
+  stream.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+  stream.read(reinterpret_cast<char*>(&formatVersion), sizeof(formatVersion));
+  stream.read(reinterpret_cast<char*>(&horizon), sizeof(horizon));
+
+  if (stream.fail() || magic != HISTORY_MAGIC ||
+      formatVersion > HISTORY_FORMAT_VERSION) {
+    throw std::runtime_error("Unsupported history log file");
+  }
+
+  if (horizon > lastSequence) {
+    lastSequence = horizon;
+  }
+
+  // The end of the last complete change
+  std::streamoff complete = stream.tellg();
+  bool torn = false;
+  while (stream.peek() != ifstream::traits_type::eof()) {
+    DataObjectChange change;
+    deserializeChange(stream, change);
+
+    // A partially written change at the end of the log is discarded
+    if (stream.fail()) {
+      torn = true;
+      break;
+    }
+
+    append(change);
+    complete = stream.tellg();
+  }
+
+  // Close the finished stream
+  stream.close();
+
+  // Cut the partial change off so later changes aren't appended after it
+  if (torn) {
+    FileStorageBackend storage(path);
+    storage.truncate(static_cast<uint64_t>(complete));
+    storage.sync();
+  }
+
+  // Everything loaded is already present in the log
+  unflushed = 0;
+}
+
+void DataObjectHistory::flush() {
+  if (unflushed == 0) {
+    return;
+  }
+
+  struct stat stats;
+  bool exists = stat(path.c_str(), &stats) == 0;
+
+  ofstream stream(path.c_str(), ios::binary | ios::app);
+
+  if (!stream.is_open()) {
+    throw std::runtime_error("Failed to open stream to history log file");
+  }
+
+  // New logs start with the header
+  if (!exists) {
+    stream.write(reinterpret_cast<const char*>(&HISTORY_MAGIC),
+                 sizeof(HISTORY_MAGIC));
+    stream.write(reinterpret_cast<const char*>(&HISTORY_FORMAT_VERSION),
+                 sizeof(HISTORY_FORMAT_VERSION));
+    stream.write(reinterpret_cast<const char*>(&horizon), sizeof(horizon));
+  }
+
+  for (size_t i = changes.size() - unflushed; i < changes.size(); i++) {
+    serializeChange(stream, changes[i]);
+  }
+
+  if (stream.fail()) {
+    throw std::runtime_error("Error while writing history log");
+  }
+
+  // Close the finished stream
+  stream.close();
+
+  unflushed = 0;
+}
+
+size_t DataObjectHistory::collect(uint64_t sequence) {
+  if (retention == 0 || sequence <= retention) {
+    return 0;
+  }
+
+  // Changes made at or before the horizon are only needed to
+  // reconstruct states from before the horizon
+  uint64_t newHorizon = sequence - retention;
+  if (newHorizon <= horizon) {
+    return 0;
+  }
+  horizon = newHorizon;
+
+  size_t removed = 0;
+  while (!changes.empty() && changes.front().sequence <= horizon) {
+    // Changes are indexed in sequence order so this change is the
+    // oldest for its object
+    map<uint32_t, deque<uint64_t>>::iterator indexed =
+        objectChanges.find(changes.front().id);
+    indexed->second.pop_front();
+    if (indexed->second.empty()) {
+      objectChanges.erase(indexed);
+    }
+
+    changes.pop_front();
+    firstChange++;
+    removed++;
+  }
+
+  // Rewrite the log with only the retained changes, published
+  // atomically so a crash never leaves a partial log
+  FileStorageBackend storage(path);
+  storage.beginSnapshot();
+  StorageWriteBuffer buffer(storage);
+  ostream stream(&buffer);
+
+  stream.write(reinterpret_cast<const char*>(&HISTORY_MAGIC),
+               sizeof(HISTORY_MAGIC));
+  stream.write(reinterpret_cast<const char*>(&HISTORY_FORMAT_VERSION),
+               sizeof(HISTORY_FORMAT_VERSION));
+  stream.write(reinterpret_cast<const char*>(&horizon), sizeof(horizon));
+
+  for (const DataObjectChange& change : changes) {
+    serializeChange(stream, change);
+  }
+
+  if (stream.fail()) {
+    throw std::runtime_error("Error while writing history log");
+  }
+
+  buffer.pubsync();
+  storage.publishSnapshot();
+
+  unflushed = 0;
+  return removed;
+}
+
+uint64_t DataObjectHistory::getLastSequence() const {
+  return lastSequence;
+}
+
+size_t DataObjectHistory::getChangeCount() const {
+  return changes.size();
+}
+
+void DataObjectHistory::append(const DataObjectChange& change) {
+  objectChanges[change.id].push_back(firstChange + changes.size());
+  changes.push_back(change);
+  unflushed++;
+
+  if (change.sequence > lastSequence) {
+    lastSequence = change.sequence;
+  }
+}
+
+void DataObjectHistory::recordCreated(uint64_t sequence,
+                                      const DataObject& object) {
+  DataObjectChange change;
+  change.sequence = sequence;
+  change.id = object.id;
+  change.kind = DataObjectChange::CREATED;
+  change.previousVersion = 0;
+  append(change);
+}
+
+void DataObjectHistory::recordUpdated(uint64_t sequence,
+                                      const DataObject& object,
+                                      uint32_t previousVersion,
+                                      const EntryMap& previous) {
+  DataObjectChange change;
+  change.sequence = sequence;
+  change.id = object.id;
+  change.kind = DataObjectChange::UPDATED;
+  change.previousVersion = previousVersion;
+
+  // Both maps are ordered by key so the delta is found in one merge pass
+  EntryMap::const_iterator before = previous.begin();
+  EntryMap::const_iterator after = object.entries.begin();
+  while (before != previous.end() || after != object.entries.end()) {
+    if (after == object.entries.end() ||
+        (before != previous.end() && before->first < after->first)) {
+      // Entry was removed
+      change.previous.insert(*before);
+      ++before;
+    } else if (before == previous.end() || after->first < before->first) {
+      // Entry was added
+      change.added.push_back(after->first);
+      ++after;
+    } else {
+      // Entry exists in both, only store it if it was changed
+      if (!(before->second == after->second)) {
+        change.previous.insert(*before);
+      }
+      ++before;
+      ++after;
+    }
+  }
+
+  append(change);
+}
+
+void DataObjectHistory::recordDeleted(uint64_t sequence,
+                                      const DataObject& object) {
+  DataObjectChange change;
+  change.sequence = sequence;
+  change.id = object.id;
+  change.kind = DataObjectChange::DELETED;
+  change.previousVersion = object.version;
+  change.previous = object.entries;
+  append(change);
+}
+
+bool DataObjectHistory::reconstruct(uint32_t id, uint64_t sequence,
+                                    const DataObject* current,
+                                    DataObject& out) const {
+  if (sequence < horizon) {
+    throw std::out_of_range("Sequence is outside of the retained history");
+  }
+
+  bool exists = current != nullptr;
+  out.clear();
+  out.id = id;
+  out.version = 0;
+  if (current != nullptr) {
+    out.version = current->version;
+    out.entries = current->entries;
+  }
+
+  map<uint32_t, deque<uint64_t>>::const_iterator indexed =
+      objectChanges.find(id);
+  if (indexed == objectChanges.end()) {
+    return exists;
+  }
+
+  // Undo the changes made after the sequence, newest first
+  const deque<uint64_t>& positions = indexed->second;
+  for (deque<uint64_t>::const_reverse_iterator position = positions.rbegin();
+       position != positions.rend(); ++position) {
+    const DataObjectChange& change = changes[*position - firstChange];
+    if (change.sequence <= sequence) {
+      break;
+    }
+
+    switch (change.kind) {
+      case DataObjectChange::CREATED:
+        exists = false;
+        out.entries.clear();
+        break;
+      case DataObjectChange::UPDATED:
+        for (const string& key : change.added) {
+          out.entries.erase(key);
+        }
+        for (const std::pair<const string, DataValue>& entry :
+             change.previous) {
+          out.entries[entry.first] = entry.second;
+        }
+        break;
+      case DataObjectChange::DELETED:
+        exists = true;
+        out.entries = change.previous;
+        break;
+    }
+
+    out.version = change.previousVersion;
+  }
+
+  if (!exists) {
+    out.clear();
+  }
+  return exists;
+}
+
+void DataObjectHistory::serializeChange(ostream& stream,
+                                        const DataObjectChange& change) {
+  stream.write(reinterpret_cast<const char*>(&change.sequence),
+               sizeof(change.sequence));
+  stream.write(reinterpret_cast<const char*>(&change.id), sizeof(change.id));
+  stream.write(reinterpret_cast<const char*>(&change.kind),
+               sizeof(change.kind));
+  stream.write(reinterpret_cast<const char*>(&change.previousVersion),
+               sizeof(change.previousVersion));
+
+  // Write the previous entry values
+  uint32_t size = static_cast<uint32_t>(change.previous.size());
+  stream.write(reinterpret_cast<const char*>(&size), sizeof(size));
+  for (const std::pair<const string, DataValue>& entry : change.previous) {
+    serializeString(stream, entry.first);
+    entry.second.serialize(stream);
+  }
+
+  // Write the added entry keys
+  size = static_cast<uint32_t>(change.added.size());
+  stream.write(reinterpret_cast<const char*>(&size), sizeof(size));
+  for (const string& key : change.added) {
+    serializeString(stream, key);
+  }
+}
+
+void DataObjectHistory::deserializeChange(istream& stream,
+                                          DataObjectChange& change) {
+  stream.read(reinterpret_cast<char*>(&change.sequence),
+              sizeof(change.sequence));
+  stream.read(reinterpret_cast<char*>(&change.id), sizeof(change.id));
+  stream.read(reinterpret_cast<char*>(&change.kind), sizeof(change.kind));
+  stream.read(reinterpret_cast<char*>(&change.previousVersion),
+              sizeof(change.previousVersion));
+
+  uint32_t size = 0;
+  stream.read(reinterpret_cast<char*>(&size), sizeof(size));
+  for (uint32_t i = 0; i < size && !stream.fail(); i++) {
+    string key;
+    deserializeString(stream, key);
+
+    DataValue value;
+    value.deserialize(stream);
+    change.previous[key] = value;
+  }
+
+  size = 0;
+  stream.read(reinterpret_cast<char*>(&size), sizeof(size));
+  for (uint32_t i = 0; i < size && !stream.fail(); i++) {
+    string key;
+    deserializeString(stream, key);
+    change.added.push_back(key);
+  }
+}
@@ -0,0 +1,204 @@
+#ifndef DATA_OBJECT_HISTORY
+#define DATA_OBJECT_HISTORY 1
+
+#include <deque>
+#include <fstream>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "DataObject.hpp"
+
+using std::deque;
+using std::ifstream;
+using std::istream;
+using std::map;
+using std::ofstream;
+using std::ostream;
+using std::string;
+using std::uint32_t;
+using std::uint64_t;
+using std::uint8_t;
+using std::vector;
+
+/// <summary>
+/// Change made to a single object by a commit. Records are stored as
+/// reverse deltas, they contain what is needed to undo the change:
+/// the previous values of the entries that were changed or removed and
+/// the keys of the entries that were added
+/// </summary>
+struct DataObjectChange {
+  /// <summary>
+  /// The kind of change that was made to the object
+  /// </summary>
+  enum Kind : uint8_t { CREATED, UPDATED, DELETED };
+
+  /// <summary>
+  /// The sequence number of the commit that made the change
+  /// </summary>
+  uint64_t sequence;
+  /// <summary>
+  /// The ID of the changed object
+  /// </summary>
+  uint32_t id;
+  /// <summary>
+  /// The kind of change
+  /// </summary>
+  Kind kind;
+  /// <summary>
+  /// The object version before the change
+  /// </summary>
+  uint32_t previousVersion;
+  /// <summary>
+  /// Previous values of the entries that were changed or removed. For
+  /// deletions this is every entry the object had
+  /// </summary>
+  EntryMap previous;
+  /// <summary>
+  /// Keys of the entries that did not exist before the change
+  /// </summary>
+  vector<string> added;
+};
+
+/// <summary>
+/// Retained history of the changes made to the objects within a
+/// collection, allowing the state of an object to be reconstructed as
+/// it was after any retained commit.
+///
+/// Changes are appended to a history log file stored alongside the
+/// collection file. Changes older than the retention window are
+/// removed by collect, which also compacts the log
+/// </summary>
+class DataObjectHistory {
+ private:
+  /// <summary>
+  /// File path to the history log
+  /// </summary>
+  string path;
+  /// <summary>
+  /// Number of commits worth of changes that are retained
+  /// </summary>
+  uint64_t retention;
+  /// <summary>
+  /// The highest sequence number recorded
+  /// </summary>
+  uint64_t lastSequence;
+  /// <summary>
+  /// Changes made at or before this sequence number have been removed,
+  /// states from before it can no longer be reconstructed
+  /// </summary>
+  uint64_t horizon;
+  /// <summary>
+  /// Retained changes in sequence order
+  /// </summary>
+  deque<DataObjectChange> changes;
+  /// <summary>
+  /// The absolute position of the first retained change, changes are
+  /// referenced by absolute position so that collection does not
+  /// invalidate the per object index
+  /// </summary>
+  uint64_t firstChange;
+  /// <summary>
+  /// Absolute positions of the changes for each object in sequence
+  /// order
+  /// </summary>
+  map<uint32_t, deque<uint64_t>> objectChanges;
+  /// <summary>
+  /// Number of changes at the end of the changes list that have not
+  /// been appended to the log
+  /// </summary>
+  size_t unflushed;
+
+  /// <summary>
+  /// Adds a change to the retained history
+  /// </summary>
+  void append(const DataObjectChange& change);
+
+  /// <summary>
+  /// Serializes a change writing it to the provided stream
+  /// </summary>
+  static void serializeChange(ostream& stream, const DataObjectChange& change);
+
+  /// <summary>
+  /// Deserializes a change from the provided stream
+  /// </summary>
+  static void deserializeChange(istream& stream, DataObjectChange& change);
+
+ public:
+  /// <summary>
+  /// Creates a new history for the provided log path
+  /// </summary>
+  /// <param name="path">The path to the history log file</param>
+  /// <param name="retention">The number of commits to retain changes
+  /// for, zero retains every change</param>
+  DataObjectHistory(string path, uint64_t retention);
+
+  /// <summary>
+  /// Loads the changes stored in the history log file if it exists
+  /// </summary>
+  void load();
+
+  /// <summary>
+  /// Writes any changes that have been recorded since the last flush
+  /// to the end of the history log
+  /// </summary>
+  void flush();
+
+  /// <summary>
+  /// Removes the changes that are outside the retention window and
+  /// rewrites the history log with the remaining changes
+  /// </summary>
+  /// <param name="sequence">The current commit sequence number</param>
+  /// <returns>The number of changes removed</returns>
+  size_t collect(uint64_t sequence);
+
+  /// <summary>
+  /// Provides the highest sequence number that has been recorded
+  /// </summary>
+  uint64_t getLastSequence() const;
+
+  /// <summary>
+  /// Provides the number of retained changes
+  /// </summary>
+  size_t getChangeCount() const;
+
+  /// <summary>
+  /// Records the creation of the provided object
+  /// </summary>
+  void recordCreated(uint64_t sequence, const DataObject& object);
+
+  /// <summary>
+  /// Records an update to the provided object, storing only the entries
+  /// that differ from the previous entries
+  /// </summary>
+  /// <param name="sequence">The commit sequence number</param>
+  /// <param name="object">The object after the update</param>
+  /// <param name="previousVersion">The object version before the update</param>
+  /// <param name="previous">The object entries before the update</param>
+  void recordUpdated(uint64_t sequence, const DataObject& object,
+                     uint32_t previousVersion,
+                     const EntryMap& previous);
+
+  /// <summary>
+  /// Records the deletion of the provided object
+  /// </summary>
+  void recordDeleted(uint64_t sequence, const DataObject& object);
+
+  /// <summary>
+  /// Reconstructs the state of an object as it was after the commit with
+  /// the provided sequence number, by undoing the newer changes
+  /// </summary>
+  /// <param name="id">The ID of the object</param>
+  /// <param name="sequence">The sequence number to reconstruct at</param>
+  /// <param name="current">The current object or nullptr if the object
+  /// no longer exists</param>
+  /// <param name="out">The object to store the reconstructed state in</param>
+  /// <returns>Whether the object existed at the sequence number</returns>
+  bool reconstruct(uint32_t id, uint64_t sequence, const DataObject* current,
+                   DataObject& out) const;
+};
+
+#endif
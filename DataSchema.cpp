@@ -0,0 +1,298 @@
+#include "DataSchema.hpp"
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ContentHash.hpp"
+
+using std::string;
+using std::uint64_t;
+using std::unordered_map;
+using std::vector;
+
+/// <summary>
+/// Longest string held inline by std::string without a heap allocation
+/// </summary>
+static const size_t INLINE_STRING_CAPACITY = 15;
+
+/// <summary>
+/// Bytes of a std::map node in addition to its value, the red black
+/// tree links and color
+/// </summary>
+static const uint64_t MAP_NODE_OVERHEAD = 4 * sizeof(void*);
+
+/// <summary>
+/// Number of objects with a shape and the first object that had it
+/// </summary>
+struct InferredShape {
+  size_t objects;
+  size_t exemplar;
+};
+
+/// <summary>
+/// Orders schema fields by their key
+/// </summary>
+static bool compareFieldKey(const DataSchemaField& field,
+                            std::string_view key) {
+  return field.key < key;
+}
+
+DataSchema::DataSchema() : fields() {}
+
+void DataSchema::addField(string key, DataValue::Type type) {
+  vector<DataSchemaField>::iterator field =
+      std::lower_bound(fields.begin(), fields.end(), key, compareFieldKey);
+
+  if (field != fields.end() && field->key == key) {
+    field->type = type;
+    return;
+  }
+
+  fields.insert(field, DataSchemaField{std::move(key), type});
+}
+
+const vector<DataSchemaField>& DataSchema::getFields() const {
+  return fields;
+}
+
+const DataSchemaField* DataSchema::getField(std::string_view key) const {
+  vector<DataSchemaField>::const_iterator field =
+      std::lower_bound(fields.begin(), fields.end(), key, compareFieldKey);
+
+  if (field == fields.end() || field->key != key) {
+    return nullptr;
+  }
+  return &*field;
+}
+
+bool DataSchema::matches(const DataObject& object) const {
+  const EntryMap& entries = object.getEntries();
+  if (entries.size() != fields.size()) {
+    return false;
+  }
+
+  // Both are ordered by key so they are compared in a single pass
+  vector<DataSchemaField>::const_iterator field = fields.begin();
+  for (const std::pair<const string, DataValue>& entry : entries) {
+    if (entry.first != field->key || entry.second.getType() != field->type) {
+      return false;
+    }
+    field++;
+  }
+  return true;
+}
+
+/// <summary>
+/// Provides the heap bytes used by the string beyond the string itself
+/// </summary>
+static uint64_t measureHeap(const string& value) {
+  return value.size() > INLINE_STRING_CAPACITY ? value.size() + 1 : 0;
+}
+
+/// <summary>
+/// Provides the heap bytes used by the value beyond the value itself
+/// </summary>
+static uint64_t measureHeap(const DataValue& value) {
+  const string* text = value.asString();
+  return text != nullptr ? measureHeap(*text) : 0;
+}
+
+/// <summary>
+/// Provides the bytes used by the object holding its entries as a map
+/// </summary>
+static uint64_t measureMapObject(const DataObject& object) {
+  uint64_t bytes = sizeof(DataObject);
+  for (const std::pair<const string, DataValue>& entry :
+       object.getEntries()) {
+    bytes += MAP_NODE_OVERHEAD + sizeof(EntryMap::value_type) +
+             measureHeap(entry.first) + measureHeap(entry.second);
+  }
+  return bytes;
+}
+
+/// <summary>
+/// Provides the schema with the keys and value types of the object
+/// </summary>
+static DataSchema schemaOf(const DataObject& object) {
+  DataSchema schema;
+  for (const std::pair<const string, DataValue>& entry :
+       object.getEntries()) {
+    schema.addField(entry.first, entry.second.getType());
+  }
+  return schema;
+}
+
+/// <summary>
+/// Checks whether the objects have the same keys with the same value
+/// types, confirming objects whose shape hashes are equal
+/// </summary>
+static bool sameShape(const DataObject& first, const DataObject& second) {
+  const EntryMap& firstEntries = first.getEntries();
+  const EntryMap& secondEntries = second.getEntries();
+  if (firstEntries.size() != secondEntries.size()) {
+    return false;
+  }
+
+  // Both are ordered by key so they are compared in a single pass
+  EntryMap::const_iterator other = secondEntries.begin();
+  for (const std::pair<const string, DataValue>& entry : firstEntries) {
+    if (entry.first != other->first ||
+        entry.second.getType() != other->second.getType()) {
+      return false;
+    }
+    other++;
+  }
+  return true;
+}
+
+DataSchemaReport DataSchema::infer(const vector<DataObject>& objects) {
+  DataSchemaReport report;
+  report.objectCount = objects.size();
+  report.shapeCount = 0;
+  report.matchingObjects = 0;
+  report.mapBytes = 0;
+  report.shapeBytes = 0;
+  report.columnarBytes = 0;
+  report.layout = DataLayout::MAP;
+
+  // Objects are grouped by a hash of their keys and value types, the
+  // length of each key is included so keys can't run into each other.
+  // Shapes sharing a hash are kept apart by comparing each object with
+  // the exemplar of every shape in the bucket
+  unordered_map<uint64_t, vector<InferredShape>> shapes;
+  for (size_t i = 0; i < objects.size(); i++) {
+    const DataObject& object = objects[i];
+    uint64_t hash = 0;
+
+    // Shapes hold the ID, version, shape and the values of the object
+    report.shapeBytes += 3 * sizeof(uint32_t) + sizeof(vector<DataValue>);
+    for (const std::pair<const string, DataValue>& entry :
+         object.getEntries()) {
+      uint64_t length = entry.first.size();
+      DataValue::Type type = entry.second.getType();
+      hash = hashBytes(&length, sizeof(length), hash);
+      hash = hashBytes(entry.first.data(), entry.first.size(), hash);
+      hash = hashBytes(&type, sizeof(type), hash);
+
+      report.shapeBytes += sizeof(DataValue) + measureHeap(entry.second);
+    }
+    report.mapBytes += measureMapObject(object);
+
+    vector<InferredShape>& bucket = shapes[hash];
+    vector<InferredShape>::iterator shape = bucket.begin();
+    while (shape != bucket.end() &&
+           !sameShape(objects[shape->exemplar], object)) {
+      shape++;
+    }
+    if (shape == bucket.end()) {
+      bucket.push_back(InferredShape{0, i});
+      shape = bucket.end() - 1;
+      report.shapeCount++;
+    }
+    shape->objects++;
+  }
+
+  if (report.shapeCount == 0) {
+    return report;
+  }
+
+  // The keys of each shape are held once
+  vector<InferredShape> ordered;
+  ordered.reserve(report.shapeCount);
+  for (const std::pair<const uint64_t, vector<InferredShape>>& bucket :
+       shapes) {
+    for (const InferredShape& shape : bucket.second) {
+      ordered.push_back(shape);
+      report.shapeBytes += sizeof(vector<string>);
+      for (const std::pair<const string, DataValue>& entry :
+           objects[shape.exemplar].getEntries()) {
+        report.shapeBytes += sizeof(string) + measureHeap(entry.first);
+      }
+    }
+  }
+
+  std::sort(ordered.begin(), ordered.end(),
+            [](const InferredShape& a, const InferredShape& b) {
+              return a.objects != b.objects ? a.objects > b.objects
+                                            : a.exemplar < b.exemplar;
+            });
+  for (size_t i = 0;
+       i < ordered.size() && i < DataSchemaReport::MAX_REPORTED_SHAPES; i++) {
+    report.shapes.push_back(DataSchemaShape{
+        schemaOf(objects[ordered[i].exemplar]), ordered[i].objects});
+  }
+  report.schema = report.shapes.front().schema;
+
+  // Columns hold the ID, version and one value per field for objects
+  // matching the schema, the remaining objects stay maps
+  const vector<DataSchemaField>& fields = report.schema.getFields();
+  for (const DataObject& object : objects) {
+    if (!report.schema.matches(object)) {
+      report.columnarBytes += measureMapObject(object);
+      continue;
+    }
+
+    report.matchingObjects++;
+    report.columnarBytes += 2 * sizeof(uint32_t);
+    vector<DataSchemaField>::const_iterator field = fields.begin();
+    for (const std::pair<const string, DataValue>& entry :
+         object.getEntries()) {
+      report.columnarBytes += field->type == DataValue::STRING
+                                  ? sizeof(string) + measureHeap(entry.second)
+                                  : sizeof(int32_t);
+      field++;
+    }
+  }
+
+  // Ties keep the simpler layout
+  if (report.shapeBytes < report.mapBytes) {
+    report.layout = DataLayout::SHAPES;
+  }
+  if (report.columnarBytes < report.getLayoutBytes()) {
+    report.layout = DataLayout::COLUMNAR;
+  }
+
+  return report;
+}
+
+uint64_t DataSchemaReport::getLayoutBytes() const {
+  switch (layout) {
+    case DataLayout::SHAPES:
+      return shapeBytes;
+    case DataLayout::COLUMNAR:
+      return columnarBytes;
+    default:
+      return mapBytes;
+  }
+}
+
+uint64_t DataSchemaReport::getSavedBytes() const {
+  return mapBytes - getLayoutBytes();
+}
+
+string DataSchemaReport::describe() const {
+  static const char* const LAYOUT_NAMES[] = {"map", "shapes", "columnar"};
+  static const char* const TYPE_NAMES[] = {"string", "integer", "float"};
+
+  string text = std::to_string(objectCount) + " objects in " +
+                std::to_string(shapeCount) + " shapes, " +
+                std::to_string(matchingObjects) + " match {";
+  for (size_t i = 0; i < schema.getFields().size(); i++) {
+    const DataSchemaField& field = schema.getFields()[i];
+    text += (i == 0 ? "" : ", ") + field.key + ": " + TYPE_NAMES[field.type];
+  }
+
+  text += "}; map " + std::to_string(mapBytes) + " bytes, shapes " +
+          std::to_string(shapeBytes) + " bytes, columnar " +
+          std::to_string(columnarBytes) + " bytes; best layout would be " +
+          LAYOUT_NAMES[static_cast<size_t>(layout)] + ", saving " +
+          std::to_string(getSavedBytes()) + " bytes";
+  if (mapBytes != 0) {
+    text += " (" + std::to_string(getSavedBytes() * 100 / mapBytes) + "%)";
+  }
+  return text;
+}
@@ -0,0 +1,171 @@
+#ifndef DATA_SCHEMA
+#define DATA_SCHEMA 1
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "DataObject.hpp"
+
+using std::string;
+using std::uint64_t;
+using std::vector;
+
+struct DataSchemaReport;
+
+/// <summary>
+/// Field of a DataSchema
+/// </summary>
+struct DataSchemaField {
+  /// <summary>
+  /// The entry key
+  /// </summary>
+  string key;
+  /// <summary>
+  /// The type of the entry value
+  /// </summary>
+  DataValue::Type type;
+};
+
+/// <summary>
+/// Describes the entries objects are expected to have, a key and value
+/// type per field. Fields are ordered by key like the entries of an
+/// object, so objects matching a schema all share one shape and can be
+/// stored in a columnar layout
+/// </summary>
+class DataSchema {
+ private:
+  /// <summary>
+  /// The fields ordered by key
+  /// </summary>
+  vector<DataSchemaField> fields;
+
+ public:
+  /// <summary>
+  /// Creates a schema without fields
+  /// </summary>
+  DataSchema();
+
+  /// <summary>
+  /// Adds a field to the schema, replacing the type of an existing
+  /// field with the same key
+  /// </summary>
+  /// <param name="key">The entry key</param>
+  /// <param name="type">The type of the entry value</param>
+  void addField(string key, DataValue::Type type);
+
+  /// <summary>
+  /// Provides the fields ordered by key
+  /// </summary>
+  const vector<DataSchemaField>& getFields() const;
+
+  /// <summary>
+  /// Provides the field with the provided key or a nullptr if the
+  /// schema doesn't have the field
+  /// </summary>
+  /// <param name="key">The entry key</param>
+  const DataSchemaField* getField(std::string_view key) const;
+
+  /// <summary>
+  /// Provides whether the object has exactly the fields of the schema,
+  /// each with the value type of the field
+  /// </summary>
+  /// <param name="object">The object to check</param>
+  bool matches(const DataObject& object) const;
+
+  /// <summary>
+  /// Infers the schema of the provided objects from the frequencies of
+  /// their shapes (sets of keys and value types) and estimates the
+  /// memory each layout would use for them
+  /// </summary>
+  /// <param name="objects">The objects to analyze</param>
+  /// <returns>The inferred schema and layout decision</returns>
+  static DataSchemaReport infer(const vector<DataObject>& objects);
+};
+
+/// <summary>
+/// Representations objects can be held in
+/// </summary>
+enum class DataLayout : uint8_t {
+  /// <summary>
+  /// Each object holds a map of its entries
+  /// </summary>
+  MAP,
+  /// <summary>
+  /// Objects with the same keys share one copy of the keys and only
+  /// hold their values
+  /// </summary>
+  SHAPES,
+  /// <summary>
+  /// Objects matching the schema are held as one typed column per
+  /// field, other objects as maps
+  /// </summary>
+  COLUMNAR
+};
+
+/// <summary>
+/// Shape found while inferring a schema with the number of objects
+/// that have it
+/// </summary>
+struct DataSchemaShape {
+  DataSchema schema;
+  size_t objects;
+};
+
+/// <summary>
+/// Result of DataSchema::infer
+/// </summary>
+struct DataSchemaReport {
+  /// <summary>
+  /// The schema of the most common shape
+  /// </summary>
+  DataSchema schema;
+  /// <summary>
+  /// The most common shapes, most frequent first, up to
+  /// MAX_REPORTED_SHAPES
+  /// </summary>
+  vector<DataSchemaShape> shapes;
+  static const size_t MAX_REPORTED_SHAPES = 8;
+  /// <summary>
+  /// The number of objects analyzed
+  /// </summary>
+  size_t objectCount;
+  /// <summary>
+  /// The number of distinct shapes
+  /// </summary>
+  size_t shapeCount;
+  /// <summary>
+  /// The number of objects matching the schema
+  /// </summary>
+  size_t matchingObjects;
+  /// <summary>
+  /// Estimated bytes used by the objects in each layout
+  /// </summary>
+  uint64_t mapBytes;
+  uint64_t shapeBytes;
+  uint64_t columnarBytes;
+  /// <summary>
+  /// The layout using the least memory
+  /// </summary>
+  DataLayout layout;
+
+  /// <summary>
+  /// Provides the estimated bytes used in the chosen layout
+  /// </summary>
+  uint64_t getLayoutBytes() const;
+
+  /// <summary>
+  /// Provides the estimated bytes saved by the chosen layout compared
+  /// to holding every object as a map
+  /// </summary>
+  uint64_t getSavedBytes() const;
+
+  /// <summary>
+  /// Describes the estimate and the best layout in a single line for
+  /// logging
+  /// </summary>
+  string describe() const;
+};
+
+#endif
@@ -0,0 +1,703 @@
+#include "Database.hpp"
+
+#include "ContentHash.hpp"
+#include "DataObjectHistory.hpp"
+#include "StorageBackend.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#define openDescriptor _open
+#define closeDescriptor _close
+#define writeDescriptor _write
+#define syncDescriptor _commit
+#define truncateDescriptor _chsize
+#define seekDescriptor _lseek
+#define LOG_OPEN_FLAGS (_O_RDWR | _O_APPEND | _O_CREAT | _O_BINARY)
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#define openDescriptor ::open
+#define closeDescriptor ::close
+#define writeDescriptor ::write
+#define syncDescriptor ::fsync
+#define truncateDescriptor ::ftruncate
+#define seekDescriptor ::lseek
+#define LOG_OPEN_FLAGS (O_RDWR | O_APPEND | O_CREAT)
+#endif
+
+using std::ifstream;
+using std::ios;
+using std::map;
+using std::ofstream;
+using std::string;
+using std::uint32_t;
+using std::uint64_t;
+using std::uint8_t;
+using std::vector;
+
+/// <summary>
+/// Magic value written at the start of database files ("DODB")
+/// </summary>
+static const uint32_t DATABASE_MAGIC = 0x42444F44;
+
+/// <summary>
+/// Database file format versions
+///   1: Initial format
+/// </summary>
+static const uint32_t DATABASE_FORMAT_VERSION = 1;
+
+/// <summary>
+/// Size of the header before each batch in the write-ahead log, the
+/// payload length followed by the payload hash
+/// </summary>
+static const size_t LOG_RECORD_HEADER = sizeof(uint32_t) + sizeof(uint64_t);
+
+/// <summary>
+/// Appends the raw bytes of a value to the buffer
+/// </summary>
+static void putBytes(vector<uint8_t>& buffer, const void* data, size_t size) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+  buffer.insert(buffer.end(), bytes, bytes + size);
+}
+
+/// <summary>
+/// Reads raw bytes from the data
+/// </summary>
+static void getBytes(const uint8_t* data, size_t length, size_t& offset,
+                     void* out, size_t size) {
+  if (offset > length || length - offset < size) {
+    throw std::runtime_error("Database log record is truncated");
+  }
+  memcpy(out, data + offset, size);
+  offset += size;
+}
+
+/// <summary>
+/// Orders objects by their ID against a searched for ID
+/// </summary>
+static bool compareObjectId(const DataObject& object, uint32_t id) {
+  return object.getId() < id;
+}
+
+/// <summary>
+/// Writes the whole buffer to the file descriptor
+/// </summary>
+static bool writeAll(int descriptor, const vector<uint8_t>& buffer) {
+  size_t written = 0;
+  while (written < buffer.size()) {
+    size_t remaining = buffer.size() - written;
+    int count = static_cast<int>(
+        writeDescriptor(descriptor, buffer.data() + written,
+                        static_cast<unsigned int>(std::min<size_t>(
+                            remaining, 1u << 30))));
+    if (count <= 0) {
+      return false;
+    }
+    written += static_cast<size_t>(count);
+  }
+  return true;
+}
+
+/// <summary>
+/// Flushes the contents of the file at the provided path to disk
+/// </summary>
+static void syncPath(const string& path) {
+  int descriptor = openDescriptor(path.c_str(), LOG_OPEN_FLAGS, 0644);
+  if (descriptor < 0) {
+    throw std::runtime_error("Failed to open database file for syncing");
+  }
+  int result = syncDescriptor(descriptor);
+  closeDescriptor(descriptor);
+  if (result != 0) {
+    throw std::runtime_error("Failed to sync database file");
+  }
+}
+
+/// <summary>
+/// Encodes a batch as a single log record
+/// </summary>
+static void encodeBatch(vector<uint8_t>& buffer,
+                        const vector<DatabaseOperation>& operations) {
+  size_t start = buffer.size();
+  buffer.resize(start + LOG_RECORD_HEADER);
+
+  uint32_t count = static_cast<uint32_t>(operations.size());
+  putBytes(buffer, &count, sizeof(count));
+
+  for (const DatabaseOperation& operation : operations) {
+    uint32_t nameLength = static_cast<uint32_t>(operation.collection.size());
+    putBytes(buffer, &operation.kind, sizeof(operation.kind));
+    putBytes(buffer, &nameLength, sizeof(nameLength));
+    putBytes(buffer, operation.collection.data(), nameLength);
+
+    // Puts carry the encoded object, which starts with the ID
+    if (operation.kind == DatabaseOperation::PUT) {
+      operation.object.encodeTo(buffer);
+    } else {
+      uint32_t id = operation.object.getId();
+      putBytes(buffer, &id, sizeof(id));
+    }
+  }
+
+  // Fill in the header now the payload is known
+  uint32_t payloadLength =
+      static_cast<uint32_t>(buffer.size() - start - LOG_RECORD_HEADER);
+  uint64_t hash =
+      hashBytes(buffer.data() + start + LOG_RECORD_HEADER, payloadLength);
+  memcpy(buffer.data() + start, &payloadLength, sizeof(payloadLength));
+  memcpy(buffer.data() + start + sizeof(payloadLength), &hash, sizeof(hash));
+}
+
+DatabaseBatch::DatabaseBatch() : operations{} {}
+
+size_t DatabaseBatch::put(const string& collection, const DataObject& object) {
+  DatabaseOperation operation;
+  operation.kind = DatabaseOperation::PUT;
+  operation.collection = collection;
+  operation.object = object;
+  operations.push_back(std::move(operation));
+  return operations.size() - 1;
+}
+
+size_t DatabaseBatch::remove(const string& collection, uint32_t id) {
+  DatabaseOperation operation;
+  operation.kind = DatabaseOperation::REMOVE;
+  operation.collection = collection;
+  operation.object.id = id;
+  operations.push_back(std::move(operation));
+  return operations.size() - 1;
+}
+
+const DataObject& DatabaseBatch::getObject(size_t index) const {
+  return operations.at(index).object;
+}
+
+size_t DatabaseBatch::size() const {
+  return operations.size();
+}
+
+void DatabaseBatch::clear() {
+  operations.clear();
+}
+
+DatabaseBusyError::DatabaseBusyError(const string& message)
+    : std::runtime_error(message) {}
+
+Database::Database(string path)
+    : path(path),
+      collections{},
+      logDescriptor(-1),
+      logQueue{},
+      logWriting(false),
+      checkpointing(false),
+      logBuffer{},
+      dirtyBytes(0),
+      queuedBytes(0),
+      maxDirtyBytes(0),
+      maxQueuedBytes(0),
+      blockWhenFull(true),
+      checkpointLimiter(nullptr) {}
+
+Database::~Database() {
+  if (logDescriptor >= 0) {
+    closeDescriptor(logDescriptor);
+  }
+}
+
+DataObjectCollection* Database::getOrCreate(const string& name) {
+  map<string, std::unique_ptr<DataObjectCollection>>::iterator existing =
+      collections.find(name);
+  if (existing != collections.end()) {
+    return existing->second.get();
+  }
+
+  // Hosted collections use their path only for the history log
+  std::unique_ptr<DataObjectCollection> collection(
+      new DataObjectCollection(path + "." + name));
+  collection->database = this;
+  collection->name = name;
+
+  DataObjectCollection* created = collection.get();
+  collections.emplace(name, std::move(collection));
+  return created;
+}
+
+void Database::open() {
+  std::lock_guard<std::mutex> guard(collectionsLock);
+  struct stat stats;
+
+  if (stat(path.c_str(), &stats) == 0) {
+    ifstream stream(path, ios::binary);
+
+    if (!stream.is_open()) {
+      throw std::runtime_error("Failed to open stream to database file");
+    }
+
+    uint32_t magic = 0;
+    uint32_t formatVersion = 0;
+    uint32_t count = 0;
+    stream.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    stream.read(reinterpret_cast<char*>(&formatVersion),
+                sizeof(formatVersion));
+    stream.read(reinterpret_cast<char*>(&count), sizeof(count));
+
+    if (stream.fail() || magic != DATABASE_MAGIC ||
+        formatVersion > DATABASE_FORMAT_VERSION) {
+      throw std::runtime_error("Unsupported database file");
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+      string name;
+      deserializeString(stream, name);
+      DataObjectCollection* collection = getOrCreate(name);
+
+      // Each collection is stored in the collection file format
+      uint32_t size = 0;
+      uint32_t objectFormat =
+          deserializeCollectionHeader(stream, collection->nextId, size);
+
+      collection->objects.clear();
+      collection->objects.reserve(size);
+      for (uint32_t j = 0; j < size; j++) {
+        DataObject object;
+        object.deserialize(stream, objectFormat);
+
+        if (stream.fail()) {
+          throw std::runtime_error("Error while reading database collection");
+        }
+
+        collection->objects.push_back(std::move(object));
+      }
+    }
+
+    stream.close();
+  }
+
+  replayLog();
+}
+
+void Database::replayLog() {
+  string logPath = path + ".wal";
+  vector<uint8_t> data;
+
+  {
+    ifstream stream(logPath, ios::binary);
+    if (stream.is_open()) {
+      data.assign(std::istreambuf_iterator<char>(stream),
+                  std::istreambuf_iterator<char>());
+    }
+  }
+
+  size_t offset = 0;
+  while (data.size() - offset >= LOG_RECORD_HEADER) {
+    uint32_t payloadLength;
+    uint64_t hash;
+    memcpy(&payloadLength, data.data() + offset, sizeof(payloadLength));
+    memcpy(&hash, data.data() + offset + sizeof(payloadLength), sizeof(hash));
+
+    // Batches that were not completely written are discarded
+    const uint8_t* payload = data.data() + offset + LOG_RECORD_HEADER;
+    if (data.size() - offset - LOG_RECORD_HEADER < payloadLength ||
+        hashBytes(payload, payloadLength) != hash) {
+      break;
+    }
+
+    DatabaseBatch batch;
+    size_t position = 0;
+    uint32_t count = 0;
+    getBytes(payload, payloadLength, position, &count, sizeof(count));
+
+    for (uint32_t i = 0; i < count; i++) {
+      DatabaseOperation operation;
+      uint32_t nameLength = 0;
+      getBytes(payload, payloadLength, position, &operation.kind,
+               sizeof(operation.kind));
+      getBytes(payload, payloadLength, position, &nameLength,
+               sizeof(nameLength));
+      operation.collection.resize(nameLength);
+      getBytes(payload, payloadLength, position, &operation.collection[0],
+               nameLength);
+
+      if (operation.kind == DatabaseOperation::PUT) {
+        position += operation.object.decodeFrom(payload + position,
+                                                payloadLength - position);
+      } else if (operation.kind == DatabaseOperation::REMOVE) {
+        getBytes(payload, payloadLength, position, &operation.object.id,
+                 sizeof(operation.object.id));
+      } else {
+        throw std::runtime_error("Unexpected database log operation");
+      }
+
+      batch.operations.push_back(std::move(operation));
+    }
+
+    vector<DataObjectCollection*> targets;
+    for (const DatabaseOperation& operation : batch.operations) {
+      targets.push_back(getOrCreate(operation.collection));
+    }
+
+    apply(batch, targets, false);
+    offset += LOG_RECORD_HEADER + payloadLength;
+  }
+
+  logDescriptor = openDescriptor(logPath.c_str(), LOG_OPEN_FLAGS, 0644);
+  if (logDescriptor < 0) {
+    throw std::runtime_error("Failed to open database log file");
+  }
+
+  // Drop the partially written tail so new batches follow the last
+  // complete one
+  if (offset < data.size()) {
+    if (truncateDescriptor(logDescriptor, static_cast<long>(offset)) != 0) {
+      throw std::runtime_error("Failed to truncate database log file");
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(logLock);
+  dirtyBytes = offset;
+}
+
+DataObjectCollection* Database::getCollection(const string& name) {
+  std::lock_guard<std::mutex> guard(collectionsLock);
+  return getOrCreate(name);
+}
+
+vector<string> Database::getCollectionNames() {
+  std::lock_guard<std::mutex> guard(collectionsLock);
+
+  vector<string> names;
+  names.reserve(collections.size());
+  for (const std::pair<const string, std::unique_ptr<DataObjectCollection>>&
+           collection : collections) {
+    names.push_back(collection.first);
+  }
+  return names;
+}
+
+void Database::writeLog(const DatabaseBatch& batch) {
+  if (batch.operations.empty()) {
+    return;
+  }
+
+  // Encode before queuing so the leader only has to copy the record
+  PendingCommit commit = {{}, false, false};
+  encodeBatch(commit.record, batch.operations);
+
+  std::unique_lock<std::mutex> lock(logLock);
+  logCondition.wait(lock, [this] { return !checkpointing; });
+  logQueue.push_back(&commit);
+  queuedBytes += commit.record.size();
+
+  // Wait until a leader has written the batch or this commit is at the
+  // front of the queue and can lead the next group
+  logCondition.wait(lock, [this, &commit] {
+    return commit.done || (!logWriting && logQueue.front() == &commit);
+  });
+
+  if (!commit.done) {
+    vector<PendingCommit*> group(logQueue.begin(), logQueue.end());
+    logWriting = true;
+    lock.unlock();
+
+    // Every batch in the group is written with one write and one sync
+    long logSize =
+        static_cast<long>(seekDescriptor(logDescriptor, 0, SEEK_END));
+    bool failed = logSize < 0;
+    try {
+      logBuffer.clear();
+      for (PendingCommit* pending : group) {
+        logBuffer.insert(logBuffer.end(), pending->record.begin(),
+                         pending->record.end());
+      }
+      failed = failed || !writeAll(logDescriptor, logBuffer) ||
+               syncDescriptor(logDescriptor) != 0;
+    } catch (...) {
+      failed = true;
+    }
+
+    // Remove any part of the failed group that was written, so later
+    // groups don't follow a torn record and the failed batches can't
+    // be replayed after a restart
+    if (failed && logSize >= 0) {
+      if (truncateDescriptor(logDescriptor, logSize) == 0) {
+        syncDescriptor(logDescriptor);
+      }
+    }
+
+    lock.lock();
+    for (PendingCommit* pending : group) {
+      pending->done = true;
+      pending->failed = failed;
+      queuedBytes -= pending->record.size();
+      logQueue.pop_front();
+    }
+    if (!failed) {
+      dirtyBytes += logBuffer.size();
+    }
+    logWriting = false;
+    logCondition.notify_all();
+  }
+
+  if (commit.failed) {
+    throw std::runtime_error("Failed to write to the database log");
+  }
+}
+
+void Database::apply(const DatabaseBatch& batch,
+                     const vector<DataObjectCollection*>& targets,
+                     bool record) {
+  // Every affected collection advances by a single commit
+  vector<DataObjectCollection*> affected(targets);
+  std::sort(affected.begin(), affected.end());
+  affected.erase(std::unique(affected.begin(), affected.end()),
+                 affected.end());
+  for (DataObjectCollection* collection : affected) {
+    collection->sequence++;
+  }
+
+  for (size_t i = 0; i < batch.operations.size(); i++) {
+    const DatabaseOperation& operation = batch.operations[i];
+    DataObjectCollection* collection = targets[i];
+    DataObjectHistory* history = record ? collection->history.get() : nullptr;
+    vector<DataObject>& objects = collection->objects;
+    uint32_t id = operation.object.id;
+
+    vector<DataObject>::iterator existing =
+        std::lower_bound(objects.begin(), objects.end(), id, compareObjectId);
+    bool exists = existing != objects.end() && existing->id == id;
+
+    if (operation.kind == DatabaseOperation::REMOVE) {
+      if (exists) {
+        if (history != nullptr) {
+          history->recordDeleted(collection->sequence, *existing);
+        }
+        objects.erase(existing);
+      }
+      continue;
+    }
+
+    if (exists) {
+      uint32_t previousVersion = existing->version;
+      EntryMap previous;
+      previous.swap(existing->entries);
+      existing->entries = operation.object.entries;
+      existing->version = operation.object.version;
+      existing->contentHashValid = false;
+      if (history != nullptr) {
+        history->recordUpdated(collection->sequence, *existing,
+                               previousVersion, previous);
+      }
+    } else {
+      existing = objects.insert(existing, operation.object);
+      if (history != nullptr) {
+        history->recordCreated(collection->sequence, *existing);
+      }
+    }
+
+    if (id >= collection->nextId) {
+      collection->nextId = id + 1;
+    }
+  }
+
+  if (record) {
+    for (DataObjectCollection* collection : affected) {
+      if (collection->history) {
+        collection->history->flush();
+      }
+    }
+  }
+}
+
+void Database::commit(DatabaseBatch& batch) {
+  admit();
+
+  vector<DataObjectCollection*> targets;
+  {
+    std::lock_guard<std::mutex> guard(collectionsLock);
+    for (const DatabaseOperation& operation : batch.operations) {
+      targets.push_back(getOrCreate(operation.collection));
+    }
+  }
+
+  // Lock the affected collections in name order
+  map<string, DataObjectCollection*> affected;
+  for (size_t i = 0; i < targets.size(); i++) {
+    affected[batch.operations[i].collection] = targets[i];
+  }
+  vector<std::unique_lock<std::mutex>> guards;
+  guards.reserve(affected.size());
+  for (const std::pair<const string, DataObjectCollection*>& collection :
+       affected) {
+    guards.emplace_back(collection.second->structLock);
+  }
+
+  // Allocate IDs and versions before the batch is logged so replaying
+  // the log produces the same objects
+  for (size_t i = 0; i < targets.size(); i++) {
+    DatabaseOperation& operation = batch.operations[i];
+    if (operation.kind != DatabaseOperation::PUT) {
+      continue;
+    }
+
+    DataObjectCollection* collection = targets[i];
+    if (operation.object.id == 0) {
+      operation.object.id = collection->nextId++;
+    }
+
+    const DataObject* existing =
+        collection->findObject(operation.object.id);
+    operation.object.version = existing != nullptr ? existing->version + 1 : 1;
+    collection->stampSchema(operation.object);
+  }
+
+  writeLog(batch);
+  apply(batch, targets, true);
+}
+
+void Database::checkpoint() {
+  std::lock_guard<std::mutex> collectionsGuard(collectionsLock);
+
+  // Hold every collection lock so no changes are made while writing
+  vector<std::unique_lock<std::mutex>> guards;
+  guards.reserve(collections.size());
+  for (const std::pair<const string, std::unique_ptr<DataObjectCollection>>&
+           collection : collections) {
+    guards.emplace_back(collection.second->structLock);
+  }
+
+  // Wait for batches already in the log queue
+  std::unique_lock<std::mutex> lock(logLock);
+  checkpointing = true;
+  logCondition.wait(lock, [this] { return logQueue.empty() && !logWriting; });
+  lock.unlock();
+
+  try {
+    string temporaryPath = path + ".tmp";
+    ofstream stream(temporaryPath.c_str(), ios::binary | ios::trunc);
+
+    if (!stream.is_open()) {
+      throw std::runtime_error("Failed to open stream to database file");
+    }
+
+    uint32_t count = static_cast<uint32_t>(collections.size());
+    stream.write(reinterpret_cast<const char*>(&DATABASE_MAGIC),
+                 sizeof(DATABASE_MAGIC));
+    stream.write(reinterpret_cast<const char*>(&DATABASE_FORMAT_VERSION),
+                 sizeof(DATABASE_FORMAT_VERSION));
+    stream.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    std::streamoff paced = 0;
+
+    // One encoding buffer is reused for every object
+    vector<uint8_t> encoded;
+    for (const std::pair<const string, std::unique_ptr<DataObjectCollection>>&
+             entry : collections) {
+      const DataObjectCollection& collection = *entry.second;
+      serializeString(stream, entry.first);
+      serializeCollectionHeader(
+          stream, collection.nextId,
+          static_cast<uint32_t>(collection.objects.size()));
+      for (const DataObject& object : collection.objects) {
+        object.serialize(stream, encoded);
+
+        // Pace the writes by the bytes each object added
+        if (checkpointLimiter) {
+          std::streamoff position = stream.tellp();
+          checkpointLimiter->acquire(static_cast<uint64_t>(position - paced));
+          paced = position;
+        }
+      }
+    }
+
+    stream.close();
+    if (stream.fail()) {
+      throw std::runtime_error("Error while writing database file");
+    }
+
+    // Durably replace the database file before the log is emptied, a
+    // crash in between replays the log onto the new file which is
+    // harmless
+    syncPath(temporaryPath);
+    if (!replaceFile(temporaryPath, path)) {
+      throw std::runtime_error("Failed to replace database file");
+    }
+
+    if (truncateDescriptor(logDescriptor, 0) != 0 ||
+        syncDescriptor(logDescriptor) != 0) {
+      throw std::runtime_error("Failed to truncate database log file");
+    }
+  } catch (...) {
+    lock.lock();
+    checkpointing = false;
+    logCondition.notify_all();
+    throw;
+  }
+
+  lock.lock();
+  checkpointing = false;
+  dirtyBytes = 0;
+  logCondition.notify_all();
+}
+
+void Database::admit() {
+  std::unique_lock<std::mutex> lock(logLock);
+
+  while (true) {
+    if (maxQueuedBytes != 0 && queuedBytes >= maxQueuedBytes) {
+      if (!blockWhenFull) {
+        throw DatabaseBusyError("Database log queue is full");
+      }
+      logCondition.wait(lock);
+      continue;
+    }
+
+    if (maxDirtyBytes != 0 && dirtyBytes >= maxDirtyBytes) {
+      if (!blockWhenFull) {
+        throw DatabaseBusyError("Database log is waiting for a checkpoint");
+      }
+
+      // Wait for a running checkpoint, otherwise this change runs one
+      if (checkpointing) {
+        logCondition.wait(lock);
+      } else {
+        lock.unlock();
+        checkpoint();
+        lock.lock();
+      }
+      continue;
+    }
+
+    return;
+  }
+}
+
+void Database::setBackpressure(uint64_t maxDirtyBytes,
+                               uint64_t maxQueuedBytes, bool block) {
+  std::lock_guard<std::mutex> guard(logLock);
+  Database::maxDirtyBytes = maxDirtyBytes;
+  Database::maxQueuedBytes = maxQueuedBytes;
+  blockWhenFull = block;
+
+  // Waiting changes may fit within the new limits
+  logCondition.notify_all();
+}
+
+uint64_t Database::getDirtyBytes() {
+  std::lock_guard<std::mutex> guard(logLock);
+  return dirtyBytes;
+}
+
+void Database::setCheckpointRateLimiter(std::shared_ptr<RateLimiter> limiter) {
+  std::lock_guard<std::mutex> guard(collectionsLock);
+  checkpointLimiter = limiter;
+}
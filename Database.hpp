@@ -0,0 +1,319 @@
+#ifndef DATABASE
+#define DATABASE 1
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "DataObject.hpp"
+#include "RateLimiter.hpp"
+
+using std::deque;
+using std::map;
+using std::string;
+using std::uint32_t;
+using std::uint64_t;
+using std::uint8_t;
+using std::vector;
+
+/// <summary>
+/// Thrown instead of blocking when a Database set to reject changes
+/// over its backpressure limits is full
+/// </summary>
+class DatabaseBusyError : public std::runtime_error {
+ public:
+  DatabaseBusyError(const string& message);
+};
+
+/// <summary>
+/// Single change within a DatabaseBatch
+/// </summary>
+struct DatabaseOperation {
+  /// <summary>
+  /// The kind of change
+  /// </summary>
+  enum Kind : uint8_t { PUT, REMOVE };
+
+  Kind kind;
+  /// <summary>
+  /// The name of the collection being changed
+  /// </summary>
+  string collection;
+  /// <summary>
+  /// The object being stored, only the ID is used for removals
+  /// </summary>
+  DataObject object;
+};
+
+/// <summary>
+/// Group of changes across any of the collections of a Database that
+/// are committed atomically, either every change is recovered after a
+/// crash or none of them are
+/// </summary>
+class DatabaseBatch {
+ private:
+  vector<DatabaseOperation> operations;
+
+ public:
+  DatabaseBatch();
+
+  /// <summary>
+  /// Stores a copy of the object in the collection, replacing the
+  /// entries of any existing object with the same ID. Objects with an ID
+  /// of 0 are given the next ID of the collection when committed
+  /// </summary>
+  /// <param name="collection">The collection name</param>
+  /// <param name="object">The object to store</param>
+  /// <returns>The index of the operation within the batch</returns>
+  size_t put(const string& collection, const DataObject& object);
+
+  /// <summary>
+  /// Removes the object with the provided ID from the collection
+  /// </summary>
+  /// <param name="collection">The collection name</param>
+  /// <param name="id">The ID of the object to remove</param>
+  /// <returns>The index of the operation within the batch</returns>
+  size_t remove(const string& collection, uint32_t id);
+
+  /// <summary>
+  /// Provides the object of the operation at the provided index. After
+  /// a commit this contains the ID and version the object was given
+  /// </summary>
+  /// <param name="index">The index of the operation</param>
+  const DataObject& getObject(size_t index) const;
+
+  /// <summary>
+  /// Provides the number of operations in the batch
+  /// </summary>
+  size_t size() const;
+
+  /// <summary>
+  /// Removes every operation from the batch
+  /// </summary>
+  void clear();
+
+  friend class Database;
+};
+
+/// <summary>
+/// Storage engine hosting many named DataObjectCollections in a single
+/// database file.
+///
+/// Instead of every collection rewriting its own file on each change,
+/// changes from all of the collections are appended to one shared
+/// write-ahead log (path + ".wal"). Concurrent commits are grouped: the
+/// first waiting committer writes every queued batch with a single
+/// write and a single fsync on behalf of the others.
+///
+/// checkpoint writes every collection into the database file and
+/// truncates the log, open replays the log on top of the database file
+/// discarding any partially written batch.
+/// </summary>
+class Database {
+ private:
+  /// <summary>
+  /// Batch waiting in the group commit queue
+  /// </summary>
+  struct PendingCommit {
+    /// <summary>
+    /// The batch encoded as a log record by the committing thread, its
+    /// size is counted against the queue limit
+    /// </summary>
+    vector<uint8_t> record;
+    bool done;
+    bool failed;
+  };
+
+  /// <summary>
+  /// File path to the database file
+  /// </summary>
+  string path;
+  /// <summary>
+  /// The hosted collections ordered by name, which is also the order
+  /// their locks are taken in
+  /// </summary>
+  map<string, std::unique_ptr<DataObjectCollection>> collections;
+  /// <summary>
+  /// Lock guarding the collections map
+  /// </summary>
+  std::mutex collectionsLock;
+  /// <summary>
+  /// File descriptor of the write-ahead log, -1 until opened
+  /// </summary>
+  int logDescriptor;
+  /// <summary>
+  /// Lock guarding the group commit queue and state
+  /// </summary>
+  std::mutex logLock;
+  std::condition_variable logCondition;
+  /// <summary>
+  /// Commits waiting to be written, the front commit leads the group
+  /// </summary>
+  deque<PendingCommit*> logQueue;
+  /// <summary>
+  /// Whether a group is being written
+  /// </summary>
+  bool logWriting;
+  /// <summary>
+  /// Whether a checkpoint is in progress, new commits wait until it
+  /// has finished
+  /// </summary>
+  bool checkpointing;
+  /// <summary>
+  /// Buffer the records of a group are gathered into by its leader
+  /// </summary>
+  vector<uint8_t> logBuffer;
+  /// <summary>
+  /// Bytes in the log that have not been checkpointed
+  /// </summary>
+  uint64_t dirtyBytes;
+  /// <summary>
+  /// Bytes of the batches waiting in the log queue
+  /// </summary>
+  uint64_t queuedBytes;
+  /// <summary>
+  /// Limit on dirty bytes before changes wait for a checkpoint, 0 for
+  /// no limit
+  /// </summary>
+  uint64_t maxDirtyBytes;
+  /// <summary>
+  /// Limit on queued bytes before changes wait for the log, 0 for no
+  /// limit
+  /// </summary>
+  uint64_t maxQueuedBytes;
+  /// <summary>
+  /// Whether changes over a limit wait rather than throw
+  /// </summary>
+  bool blockWhenFull;
+  /// <summary>
+  /// Limiter for checkpoint writes, nullptr for no limit
+  /// </summary>
+  std::shared_ptr<RateLimiter> checkpointLimiter;
+
+  /// <summary>
+  /// Waits until the database is within its backpressure limits before
+  /// a change is made, or throws DatabaseBusyError when set not to
+  /// block. A change waiting on the dirty limit runs the checkpoint
+  /// itself. No collection locks may be held
+  /// </summary>
+  void admit();
+
+  /// <summary>
+  /// Provides the collection with the provided name, creating it if it
+  /// doesn't exist. The collections lock must be held
+  /// </summary>
+  DataObjectCollection* getOrCreate(const string& name);
+
+  /// <summary>
+  /// Appends the batch to the write-ahead log through the group commit
+  /// queue, returning once the batch is durable
+  /// </summary>
+  void writeLog(const DatabaseBatch& batch);
+
+  /// <summary>
+  /// Applies the batch to the in-memory collections
+  /// </summary>
+  /// <param name="batch">The batch to apply</param>
+  /// <param name="targets">The collection of each operation</param>
+  /// <param name="record">Whether to record the changes in the
+  /// collection histories</param>
+  void apply(const DatabaseBatch& batch,
+             const vector<DataObjectCollection*>& targets, bool record);
+
+  /// <summary>
+  /// Replays the batches in the write-ahead log
+  /// </summary>
+  void replayLog();
+
+ public:
+  /// <summary>
+  /// Creates a database for the provided path, open must be called
+  /// before the database is used
+  /// </summary>
+  /// <param name="path">The path to the database file</param>
+  Database(string path);
+
+  ~Database();
+
+  /// <summary>
+  /// Loads the database file and replays the write-ahead log. If the
+  /// files do not exist the database starts empty
+  /// </summary>
+  void open();
+
+  /// <summary>
+  /// Provides the collection with the provided name, creating an empty
+  /// collection if it doesn't exist. The pointer remains valid for the
+  /// lifetime of the database.
+  ///
+  /// Changes made through the struct functions, deleteWhere and bulk
+  /// loaders are written to the shared write-ahead log instead of a
+  /// collection file.
+  /// </summary>
+  /// <param name="name">The collection name</param>
+  /// <returns>The collection</returns>
+  DataObjectCollection* getCollection(const string& name);
+
+  /// <summary>
+  /// Provides the names of the hosted collections in order
+  /// </summary>
+  vector<string> getCollectionNames();
+
+  /// <summary>
+  /// Commits the batch atomically with a single fsync, then applies it
+  /// to the collections. The locks of the affected collections are held
+  /// for the duration of the commit
+  /// </summary>
+  /// <param name="batch">The batch to commit</param>
+  void commit(DatabaseBatch& batch);
+
+  /// <summary>
+  /// Writes every collection to the database file and truncates the
+  /// write-ahead log. The file is written to a temporary file and
+  /// renamed into place so a crash never leaves a partial database file
+  /// </summary>
+  void checkpoint();
+
+  /// <summary>
+  /// Limits the memory and log held by changes, applied to commits and
+  /// to the changing functions of the hosted collections.
+  ///
+  /// Dirty bytes are log bytes written since the last checkpoint, all
+  /// of which are replayed on open. Queued bytes are batches waiting to
+  /// be written by the group commit. When a limit is reached changes
+  /// either wait, the change reaching the dirty limit running the
+  /// checkpoint, or throw DatabaseBusyError
+  /// </summary>
+  /// <param name="maxDirtyBytes">The dirty byte limit, 0 for no
+  /// limit</param>
+  /// <param name="maxQueuedBytes">The queued byte limit, 0 for no
+  /// limit</param>
+  /// <param name="block">Whether changes over a limit wait rather than
+  /// throw</param>
+  void setBackpressure(uint64_t maxDirtyBytes, uint64_t maxQueuedBytes,
+                       bool block);
+
+  /// <summary>
+  /// Provides the number of log bytes written since the last checkpoint
+  /// </summary>
+  uint64_t getDirtyBytes();
+
+  /// <summary>
+  /// Limits the rate checkpoints are written at. Checkpoints hold the
+  /// collection locks while writing, so limiting them trades a longer
+  /// pause of this database for less disk contention with others
+  /// </summary>
+  /// <param name="limiter">The limiter, which can be shared with other
+  /// writers, or nullptr for no limit</param>
+  void setCheckpointRateLimiter(std::shared_ptr<RateLimiter> limiter);
+
+  friend class DataObjectCollection;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef EXPECTED
+#define EXPECTED 1
+
+#include <stdexcept>
+#include <utility>
+
+/// <summary>
+/// Result of an operation that either provides a value or the error it
+/// failed with, for callers that would rather test for failure than
+/// catch an exception. The value type must be default constructible
+/// </summary>
+template <typename T, typename E>
+class Expected {
+ private:
+  /// <summary>
+  /// Whether the result holds a value rather than an error
+  /// </summary>
+  bool valid;
+  T value;
+  E error;
+
+ public:
+  /// <summary>
+  /// Creates a successful result holding the provided value
+  /// </summary>
+  Expected(T value) : valid(true), value(std::move(value)), error() {}
+
+  /// <summary>
+  /// Creates a failed result holding the provided error
+  /// </summary>
+  static Expected failure(E error) {
+    Expected result{T()};
+    result.valid = false;
+    result.error = error;
+    return result;
+  }
+
+  /// <summary>
+  /// Provides whether the result holds a value
+  /// </summary>
+  bool hasValue() const { return valid; }
+
+  explicit operator bool() const { return valid; }
+
+  /// <summary>
+  /// Provides the value, throws std::logic_error if the result holds an
+  /// error
+  /// </summary>
+  const T& getValue() const {
+    if (!valid) {
+      throw std::logic_error("Expected result holds an error");
+    }
+    return value;
+  }
+
+  /// <summary>
+  /// Provides the value, or the fallback if the result holds an error
+  /// </summary>
+  T getValueOr(T fallback) const { return valid ? value : fallback; }
+
+  /// <summary>
+  /// Provides the error, only meaningful when hasValue is false
+  /// </summary>
+  E getError() const { return error; }
+
+  /// <summary>
+  /// Unchecked access to the value, hasValue must be true
+  /// </summary>
+  const T& operator*() const { return value; }
+  const T* operator->() const { return &value; }
+};
+
+#endif
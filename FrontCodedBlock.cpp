@@ -0,0 +1,316 @@
+#include "FrontCodedBlock.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using std::int32_t;
+using std::map;
+using std::string;
+using std::uint32_t;
+using std::uint8_t;
+using std::vector;
+
+/// <summary>
+/// Provides the number of bytes used by the varint encoding of a value
+/// </summary>
+static size_t varintSize(uint32_t value) {
+  size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
+  }
+  return size;
+}
+
+/// <summary>
+/// Writes an unsigned LEB128 varint, advancing the output
+/// </summary>
+static void writeVarint(uint8_t*& out, uint32_t value) {
+  while (value >= 0x80) {
+    *out++ = static_cast<uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = static_cast<uint8_t>(value);
+}
+
+/// <summary>
+/// Writes raw bytes, advancing the output
+/// </summary>
+static void writeBytes(uint8_t*& out, const void* data, size_t size) {
+  if (size > 0) {
+    memcpy(out, data, size);
+    out += size;
+  }
+}
+
+/// <summary>
+/// Provides the length of the prefix shared by two keys
+/// </summary>
+static size_t sharedPrefix(const string& a, const string& b) {
+  size_t limit = std::min(a.size(), b.size());
+  size_t shared = 0;
+  while (shared < limit && a[shared] == b[shared]) {
+    shared++;
+  }
+  return shared;
+}
+
+/// <summary>
+/// Provides the encoded size of an entry sharing a prefix of the
+/// provided length with the previous key
+/// </summary>
+static size_t entrySize(size_t shared, const string& key,
+                        const DataValue& value) {
+  size_t unshared = key.size() - shared;
+  size_t size = varintSize(static_cast<uint32_t>(shared)) +
+                varintSize(static_cast<uint32_t>(unshared)) + unshared +
+                sizeof(DataValue::Type);
+  switch (value.getType()) {
+    case DataValue::STRING:
+      size += sizeof(uint32_t) + value.asString()->size();
+      break;
+    case DataValue::INTEGER:
+      size += sizeof(int32_t);
+      break;
+    case DataValue::FLOAT:
+      size += sizeof(float);
+      break;
+  }
+  return size;
+}
+
+/// <summary>
+/// Writes an entry sharing a prefix of the provided length with the
+/// previous key, advancing the output
+/// </summary>
+static void writeEntry(uint8_t*& out, size_t shared, const string& key,
+                       const DataValue& value) {
+  writeVarint(out, static_cast<uint32_t>(shared));
+  writeVarint(out, static_cast<uint32_t>(key.size() - shared));
+  writeBytes(out, key.data() + shared, key.size() - shared);
+
+  // Values use the same encoding as DataValue serialization
+  DataValue::Type type = value.getType();
+  writeBytes(out, &type, sizeof(type));
+  switch (type) {
+    case DataValue::STRING: {
+      const string& text = *value.asString();
+      uint32_t length = static_cast<uint32_t>(text.size());
+      writeBytes(out, &length, sizeof(length));
+      writeBytes(out, text.data(), text.size());
+      break;
+    }
+    case DataValue::INTEGER:
+      writeBytes(out, value.asInt(), sizeof(int32_t));
+      break;
+    case DataValue::FLOAT:
+      writeBytes(out, value.asFloat(), sizeof(float));
+      break;
+  }
+}
+
+/// <summary>
+/// Reads an unsigned LEB128 varint from the data
+/// </summary>
+static uint32_t getVarint(const uint8_t* data, size_t length, size_t& offset) {
+  uint32_t value = 0;
+  for (uint32_t shift = 0; shift < 35; shift += 7) {
+    if (offset >= length) {
+      break;
+    }
+    uint8_t byte = data[offset++];
+    value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+  throw std::runtime_error("Front coded block varint is malformed");
+}
+
+/// <summary>
+/// Reads raw bytes from the data
+/// </summary>
+static void getBytes(const uint8_t* data, size_t length, size_t& offset,
+                     void* out, size_t size) {
+  if (length - offset < size || offset > length) {
+    throw std::runtime_error("Front coded block is truncated");
+  }
+  memcpy(out, data + offset, size);
+  offset += size;
+}
+
+size_t FrontCodedBlockBuilder::measure(const EntryMap& entries) {
+  size_t size = 0;
+  size_t index = 0;
+  const string* previous = nullptr;
+
+  for (const std::pair<const string, DataValue>& entry : entries) {
+    size_t shared = index % RESTART_INTERVAL == 0
+                        ? 0
+                        : sharedPrefix(*previous, entry.first);
+    size += entrySize(shared, entry.first, entry.second);
+    previous = &entry.first;
+    index++;
+  }
+
+  // Restart offsets and the restart count
+  size_t restartCount = (index + RESTART_INTERVAL - 1) / RESTART_INTERVAL;
+  return size + (restartCount + 1) * sizeof(uint32_t);
+}
+
+void FrontCodedBlockBuilder::encode(const EntryMap& entries,
+                                    uint8_t* out, size_t size) {
+  uint32_t restartCount = static_cast<uint32_t>(
+      (entries.size() + RESTART_INTERVAL - 1) / RESTART_INTERVAL);
+
+  // Restart offsets are written to the end of the block as entries are
+  // written, the size is known up front
+  uint8_t* restartsOut = out + size - (restartCount + 1) * sizeof(uint32_t);
+  uint8_t* cursor = out;
+  size_t index = 0;
+  const string* previous = nullptr;
+
+  for (const std::pair<const string, DataValue>& entry : entries) {
+    size_t shared = 0;
+    if (index % RESTART_INTERVAL == 0) {
+      uint32_t restart = static_cast<uint32_t>(cursor - out);
+      writeBytes(restartsOut, &restart, sizeof(restart));
+    } else {
+      shared = sharedPrefix(*previous, entry.first);
+    }
+
+    writeEntry(cursor, shared, entry.first, entry.second);
+    previous = &entry.first;
+    index++;
+  }
+
+  writeBytes(restartsOut, &restartCount, sizeof(restartCount));
+}
+
+FrontCodedBlockReader::FrontCodedBlockReader(const uint8_t* data, size_t size)
+    : data(data), length(0), restarts(nullptr), restartCount(0) {
+  if (size < sizeof(uint32_t)) {
+    throw std::runtime_error("Front coded block is truncated");
+  }
+
+  memcpy(&restartCount, data + size - sizeof(uint32_t), sizeof(uint32_t));
+  size_t trailer = (static_cast<size_t>(restartCount) + 1) * sizeof(uint32_t);
+  if (trailer > size) {
+    throw std::runtime_error("Front coded block is truncated");
+  }
+
+  length = size - trailer;
+  restarts = data + length;
+}
+
+uint32_t FrontCodedBlockReader::getRestart(uint32_t index) const {
+  uint32_t offset;
+  memcpy(&offset, restarts + index * sizeof(uint32_t), sizeof(offset));
+  return offset;
+}
+
+size_t FrontCodedBlockReader::decodeEntry(size_t offset, string& key,
+                                          DataValue* value) const {
+  uint32_t shared = getVarint(data, length, offset);
+  uint32_t unshared = getVarint(data, length, offset);
+  if (shared > key.size() || length - offset < unshared) {
+    throw std::runtime_error("Front coded block entry is malformed");
+  }
+
+  key.resize(shared);
+  key.append(reinterpret_cast<const char*>(data + offset), unshared);
+  offset += unshared;
+
+  DataValue::Type type;
+  getBytes(data, length, offset, &type, sizeof(type));
+  switch (type) {
+    case DataValue::STRING: {
+      uint32_t size;
+      getBytes(data, length, offset, &size, sizeof(size));
+      if (length - offset < size) {
+        throw std::runtime_error("Front coded block is truncated");
+      }
+      if (value != nullptr) {
+        *value = DataValue(
+            string(reinterpret_cast<const char*>(data + offset), size));
+      }
+      offset += size;
+      break;
+    }
+    case DataValue::INTEGER: {
+      int32_t number;
+      getBytes(data, length, offset, &number, sizeof(number));
+      if (value != nullptr) {
+        *value = DataValue(number);
+      }
+      break;
+    }
+    case DataValue::FLOAT: {
+      float number;
+      getBytes(data, length, offset, &number, sizeof(number));
+      if (value != nullptr) {
+        *value = DataValue(number);
+      }
+      break;
+    }
+    default:
+      throw std::runtime_error("Unexpected data entry type");
+  }
+
+  return offset;
+}
+
+void FrontCodedBlockReader::decodeAll(EntryMap& out) const {
+  string key;
+  DataValue value;
+  size_t offset = 0;
+
+  // Entries are in key order so each one can be hinted at the end
+  while (offset < length) {
+    offset = decodeEntry(offset, key, &value);
+    out.emplace_hint(out.end(), key, value);
+  }
+}
+
+bool FrontCodedBlockReader::find(const string& key, DataValue& out) const {
+  if (restartCount == 0) {
+    return false;
+  }
+
+  // Find the last restart point with a key not greater than the key
+  uint32_t low = 0;
+  uint32_t high = restartCount - 1;
+  string candidate;
+  while (low < high) {
+    uint32_t middle = (low + high + 1) / 2;
+    candidate.clear();
+    decodeEntry(getRestart(middle), candidate, nullptr);
+    if (candidate <= key) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+
+  // Scan forward from the restart point
+  size_t offset = getRestart(low);
+  size_t end = low + 1 < restartCount ? getRestart(low + 1) : length;
+  candidate.clear();
+  while (offset < end) {
+    DataValue value;
+    offset = decodeEntry(offset, candidate, &value);
+    if (candidate == key) {
+      out = value;
+      return true;
+    }
+    if (candidate > key) {
+      break;
+    }
+  }
+
+  return false;
+}
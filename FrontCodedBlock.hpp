@@ -0,0 +1,109 @@
+#ifndef FRONT_CODED_BLOCK
+#define FRONT_CODED_BLOCK 1
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "DataObject.hpp"
+
+using std::map;
+using std::string;
+using std::uint32_t;
+using std::uint8_t;
+using std::vector;
+
+/// <summary>
+/// Encodes a block of key value entries where each key is stored as the
+/// length of the prefix it shares with the previous key followed by the
+/// rest of the key (front coding).
+///
+/// Every RESTART_INTERVAL entries a restart point stores the full key,
+/// the offsets of the restart points are written at the end of the block
+/// so a reader can start decoding at any of them.
+///
+/// Block layout:
+///   entry*: varint shared, varint unshared, unshared key bytes, value
+///   uint32 restart offset * restart count
+///   uint32 restart count
+/// </summary>
+class FrontCodedBlockBuilder {
+ public:
+  /// <summary>
+  /// Number of entries between restart points
+  /// </summary>
+  static const uint32_t RESTART_INTERVAL = 16;
+
+  /// <summary>
+  /// Provides the exact size of the block encoding the provided entries
+  /// </summary>
+  /// <param name="entries">The entries in key order</param>
+  /// <returns>The size of the block in bytes</returns>
+  static size_t measure(const EntryMap& entries);
+
+  /// <summary>
+  /// Encodes the entries as a block directly into the output without
+  /// any intermediate buffer
+  /// </summary>
+  /// <param name="entries">The entries in key order</param>
+  /// <param name="out">The output, with room for the block</param>
+  /// <param name="size">The size of the block provided by measure</param>
+  static void encode(const EntryMap& entries, uint8_t* out,
+                     size_t size);
+};
+
+/// <summary>
+/// Reads entries from a block written by FrontCodedBlockBuilder
+/// </summary>
+class FrontCodedBlockReader {
+ private:
+  const uint8_t* data;
+  /// <summary>
+  /// The length of the entry data, excluding the restart points
+  /// </summary>
+  size_t length;
+  /// <summary>
+  /// Position of the restart offsets within the block
+  /// </summary>
+  const uint8_t* restarts;
+  uint32_t restartCount;
+
+  /// <summary>
+  /// Provides the offset of the restart point at the provided index
+  /// </summary>
+  uint32_t getRestart(uint32_t index) const;
+
+  /// <summary>
+  /// Decodes the entry at the provided offset. The key is updated in
+  /// place using the shared prefix of the previous key
+  /// </summary>
+  /// <returns>The offset of the next entry</returns>
+  size_t decodeEntry(size_t offset, string& key, DataValue* value) const;
+
+ public:
+  /// <summary>
+  /// Creates a reader for the provided block
+  /// </summary>
+  /// <param name="data">The block data</param>
+  /// <param name="size">The size of the block</param>
+  FrontCodedBlockReader(const uint8_t* data, size_t size);
+
+  /// <summary>
+  /// Decodes every entry in the block into the provided map
+  /// </summary>
+  /// <param name="out">The map to store the entries in</param>
+  void decodeAll(EntryMap& out) const;
+
+  /// <summary>
+  /// Finds a single entry without decoding the whole block, restart
+  /// points are binary searched and only the entries following the
+  /// closest restart point are decoded
+  /// </summary>
+  /// <param name="key">The key to find</param>
+  /// <param name="out">Stores the value when found</param>
+  /// <returns>Whether the key was found</returns>
+  bool find(const string& key, DataValue& out) const;
+};
+
+#endif
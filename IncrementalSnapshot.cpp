@@ -0,0 +1,164 @@
+#include "IncrementalSnapshot.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <stdint.h>
+#include <vector>
+
+using std::uint32_t;
+using std::vector;
+
+IncrementalSnapshot::IncrementalSnapshot(DataObjectCollection* collection)
+    : IncrementalSnapshot(collection, nullptr) {}
+
+IncrementalSnapshot::IncrementalSnapshot(
+    DataObjectCollection* collection, std::unique_ptr<StorageBackend> storage)
+    : collection(collection),
+      ownedStorage(std::move(storage)),
+      storage(ownedStorage ? ownedStorage.get() : collection->storage.get()),
+      buffer(*this->storage),
+      stream(&buffer),
+      nextId(0),
+      cursor(0),
+      preserved{},
+      excluded{},
+      published(false),
+      abandoned(false) {
+  std::lock_guard<std::mutex> guard(collection->structLock);
+
+  if (collection->database != nullptr) {
+    throw std::invalid_argument(
+        "Hosted collections are snapshotted by their database");
+  }
+  if (collection->snapshot != nullptr) {
+    throw std::runtime_error("A snapshot of the collection is in progress");
+  }
+
+  // Every object that exists now is written exactly once, either as it
+  // is when reached or as it was preserved before changing
+  nextId = collection->nextId;
+  this->storage->beginSnapshot();
+  if (this->storage == collection->storage.get()) {
+    collection->saveDeferred = false;
+  }
+  serializeCollectionHeader(stream, nextId,
+                            static_cast<uint32_t>(collection->objects.size()));
+  collection->snapshot = this;
+}
+
+IncrementalSnapshot::~IncrementalSnapshot() {
+  if (collection != nullptr) {
+    std::lock_guard<std::mutex> guard(collection->structLock);
+    detach();
+  }
+}
+
+void IncrementalSnapshot::preserve(const DataObject& object) {
+  if (abandoned || object.id < cursor || object.id >= nextId ||
+      excluded.count(object.id) != 0) {
+    return;
+  }
+
+  // Only the state when the snapshot was created is kept
+  preserved.emplace(object.id, object);
+}
+
+void IncrementalSnapshot::exclude(uint32_t id) {
+  if (id >= cursor && id < nextId) {
+    excluded.insert(id);
+  }
+}
+
+void IncrementalSnapshot::abandon() {
+  abandoned = true;
+  preserved.clear();
+  excluded.clear();
+}
+
+void IncrementalSnapshot::detach() {
+  if (collection != nullptr && collection->snapshot == this) {
+    collection->snapshot = nullptr;
+  }
+  collection = nullptr;
+}
+
+bool IncrementalSnapshot::step(std::chrono::microseconds budget) {
+  if (published || collection == nullptr) {
+    return true;
+  }
+
+  std::lock_guard<std::mutex> guard(collection->structLock);
+  if (abandoned) {
+    detach();
+    return true;
+  }
+
+  std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() + budget;
+
+  // Continue from the cursor, objects may have been added or removed
+  // since the last step
+  vector<DataObject>& objects = collection->objects;
+  vector<DataObject>::const_iterator live = std::lower_bound(
+      objects.begin(), objects.end(), cursor,
+      [](const DataObject& object, uint32_t id) { return object.id < id; });
+
+  // One encoding buffer is reused for every object of the step
+  vector<uint8_t> encoded;
+  while (true) {
+    // Objects added with older IDs after the snapshot are skipped
+    while (live != objects.end() && live->id < nextId &&
+           excluded.count(live->id) != 0) {
+      ++live;
+    }
+
+    bool hasLive = live != objects.end() && live->id < nextId;
+    map<uint32_t, DataObject>::iterator kept = preserved.begin();
+
+    if (!hasLive && kept == preserved.end()) {
+      break;
+    }
+
+    // Preserved copies take the place of the changed or deleted object
+    if (kept != preserved.end() && (!hasLive || kept->first <= live->id)) {
+      kept->second.serialize(stream, encoded);
+      cursor = kept->first + 1;
+      if (hasLive && live->id == kept->first) {
+        ++live;
+      }
+      preserved.erase(kept);
+    } else {
+      live->serialize(stream, encoded);
+      cursor = live->id + 1;
+      ++live;
+    }
+
+    if (stream.fail()) {
+      throw std::runtime_error("Error while writing snapshot objects");
+    }
+
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return false;
+    }
+  }
+
+  buffer.pubsync();
+  storage->publishSnapshot();
+  published = true;
+  detach();
+  return true;
+}
+
+bool IncrementalSnapshot::isPublished() const {
+  return published;
+}
+
+bool IncrementalSnapshot::isAbandoned() const {
+  return abandoned;
+}
+
+size_t IncrementalSnapshot::getPreservedCount() const {
+  return preserved.size();
+}
@@ -0,0 +1,156 @@
+#ifndef INCREMENTAL_SNAPSHOT
+#define INCREMENTAL_SNAPSHOT 1
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <stdint.h>
+
+#include "DataObject.hpp"
+#include "StorageBackend.hpp"
+
+using std::map;
+using std::ostream;
+using std::set;
+using std::uint32_t;
+
+/// <summary>
+/// Snapshot of a DataObjectCollection written in small time slices, so
+/// an event loop can interleave saving a large collection with handling
+/// requests instead of stalling for a full save.
+///
+/// The snapshot holds the collection as it was when the snapshot was
+/// created. Objects are written in ID order, and an object that is
+/// about to change or be deleted before it is written is first copied
+/// into the snapshot, so later changes never leak into it. Objects are
+/// tracked when they change through the struct functions, deleteObject,
+/// deleteWhere and getObjectForUpdate. Objects created after the
+/// snapshot are not part of it, including objects committed by a
+/// BulkLoader whose IDs were given out before the snapshot.
+///
+/// While a snapshot is written to the storage of the collection, changes
+/// don't save the whole collection, see DataObjectCollection::
+/// isSaveDeferred. An explicit save writes newer contents, the snapshot
+/// is then abandoned rather than publishing older contents over it.
+/// </summary>
+class IncrementalSnapshot {
+ private:
+  /// <summary>
+  /// The collection being written, nullptr once the collection has
+  /// been destroyed
+  /// </summary>
+  DataObjectCollection* collection;
+  /// <summary>
+  /// Storage provided for the snapshot, nullptr when it is published to
+  /// the storage of the collection
+  /// </summary>
+  std::unique_ptr<StorageBackend> ownedStorage;
+  /// <summary>
+  /// The storage the snapshot is published to
+  /// </summary>
+  StorageBackend* storage;
+  StorageWriteBuffer buffer;
+  ostream stream;
+  /// <summary>
+  /// The next ID of the collection when the snapshot was created,
+  /// objects with greater IDs are not part of the snapshot
+  /// </summary>
+  uint32_t nextId;
+  /// <summary>
+  /// Objects with IDs below the cursor have been written
+  /// </summary>
+  uint32_t cursor;
+  /// <summary>
+  /// Copies of objects that changed before they were written
+  /// </summary>
+  map<uint32_t, DataObject> preserved;
+  /// <summary>
+  /// Objects committed by a BulkLoader after the snapshot was created
+  /// with IDs below nextId, which are not part of the snapshot
+  /// </summary>
+  set<uint32_t> excluded;
+  /// <summary>
+  /// Whether the snapshot has been published
+  /// </summary>
+  bool published;
+  /// <summary>
+  /// Whether the snapshot was superseded by a full save
+  /// </summary>
+  bool abandoned;
+
+  /// <summary>
+  /// Copies the object into the snapshot if it is part of the snapshot
+  /// and hasn't been written yet. Called before the object changes
+  /// </summary>
+  void preserve(const DataObject& object);
+
+  /// <summary>
+  /// Leaves the object with the provided ID out of the snapshot. Called
+  /// when an object is added with an ID given out before the snapshot
+  /// </summary>
+  void exclude(uint32_t id);
+
+  /// <summary>
+  /// Stops the snapshot without publishing it
+  /// </summary>
+  void abandon();
+
+  /// <summary>
+  /// Removes the snapshot from its collection
+  /// </summary>
+  void detach();
+
+ public:
+  /// <summary>
+  /// Starts a snapshot of the collection published to the storage of
+  /// the collection
+  /// </summary>
+  /// <param name="collection">The collection to snapshot</param>
+  IncrementalSnapshot(DataObjectCollection* collection);
+
+  /// <summary>
+  /// Starts a snapshot of the collection published to the provided
+  /// storage, which changes to the collection keep saving alongside.
+  /// Only one snapshot of a collection can be in progress, and
+  /// collections hosted by a Database are snapshotted by its checkpoint
+  /// </summary>
+  /// <param name="collection">The collection to snapshot</param>
+  /// <param name="storage">The storage to publish to</param>
+  IncrementalSnapshot(DataObjectCollection* collection,
+                      std::unique_ptr<StorageBackend> storage);
+
+  ~IncrementalSnapshot();
+
+  /// <summary>
+  /// Writes objects until the budget has elapsed, always writing at
+  /// least one. The snapshot is published by the step that writes the
+  /// last object
+  /// </summary>
+  /// <param name="budget">The time to spend writing</param>
+  /// <returns>Whether the snapshot has finished, either published or
+  /// abandoned</returns>
+  bool step(std::chrono::microseconds budget);
+
+  /// <summary>
+  /// Provides whether the snapshot has been published
+  /// </summary>
+  bool isPublished() const;
+
+  /// <summary>
+  /// Provides whether the snapshot was abandoned for a full save
+  /// </summary>
+  bool isAbandoned() const;
+
+  /// <summary>
+  /// Provides the number of objects copied because they changed before
+  /// being written and are still waiting to be written
+  /// </summary>
+  size_t getPreservedCount() const;
+
+  friend class BulkLoader;
+  friend class DataObjectCollection;
+};
+
+#endif
@@ -0,0 +1,512 @@
+#include "PersistentCollection.hpp"
+
+#include "StorageBackend.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+using std::ifstream;
+using std::ios;
+using std::make_shared;
+using std::ostream;
+using std::shared_ptr;
+using std::string;
+using std::uint32_t;
+using std::vector;
+
+typedef shared_ptr<const DataObject> ObjectPtr;
+
+struct HamtNode;
+typedef shared_ptr<const HamtNode> NodePtr;
+
+/// <summary>
+/// Number of hash bits consumed by each level of the trie
+/// </summary>
+static const uint32_t BITS_PER_LEVEL = 5;
+
+/// <summary>
+/// Node within the hash array mapped trie. Each node has 32 slots which
+/// hold either an object or a child node, only the occupied slots are
+/// stored, in slot order, and the bitmaps record which slots they are
+/// </summary>
+struct HamtNode {
+  /// <summary>
+  /// Slots holding objects
+  /// </summary>
+  uint32_t dataMap;
+  /// <summary>
+  /// Slots holding child nodes
+  /// </summary>
+  uint32_t nodeMap;
+  vector<ObjectPtr> values;
+  vector<NodePtr> children;
+
+  HamtNode() : dataMap(0), nodeMap(0), values{}, children{} {}
+};
+
+/// <summary>
+/// Immutable state of a persistent collection
+/// </summary>
+struct PersistentState {
+  NodePtr root;
+  size_t size;
+  uint32_t nextId;
+};
+
+/// <summary>
+/// Hashes an object ID. The mixing function is a bijection so distinct
+/// IDs never collide and always separate within the depth of the trie
+/// </summary>
+static uint32_t hashId(uint32_t id) {
+  id ^= id >> 16;
+  id *= 0x85EBCA6B;
+  id ^= id >> 13;
+  id *= 0xC2B2AE35;
+  id ^= id >> 16;
+  return id;
+}
+
+/// <summary>
+/// Provides the bit for the slot the hash occupies at the provided shift
+/// </summary>
+static uint32_t slotBit(uint32_t hash, uint32_t shift) {
+  return 1u << ((hash >> shift) & 31);
+}
+
+/// <summary>
+/// Provides the position of a slot within the compact storage for the
+/// provided bitmap
+/// </summary>
+static size_t slotIndex(uint32_t bitmap, uint32_t bit) {
+  return std::bitset<32>(bitmap & (bit - 1)).count();
+}
+
+/// <summary>
+/// Creates a node containing two objects whose hashes are equal up to
+/// the provided shift
+/// </summary>
+static NodePtr mergeObjects(const ObjectPtr& a, uint32_t hashA,
+                            const ObjectPtr& b, uint32_t hashB,
+                            uint32_t shift) {
+  shared_ptr<HamtNode> node = make_shared<HamtNode>();
+  uint32_t bitA = slotBit(hashA, shift);
+  uint32_t bitB = slotBit(hashB, shift);
+
+  if (bitA == bitB) {
+    // Still sharing a slot, push both down another level
+    node->nodeMap = bitA;
+    node->children.push_back(
+        mergeObjects(a, hashA, b, hashB, shift + BITS_PER_LEVEL));
+  } else {
+    node->dataMap = bitA | bitB;
+    if (bitA < bitB) {
+      node->values.push_back(a);
+      node->values.push_back(b);
+    } else {
+      node->values.push_back(b);
+      node->values.push_back(a);
+    }
+  }
+
+  return node;
+}
+
+/// <summary>
+/// Provides a copy of the node with the object inserted or replaced,
+/// only the path to the object is copied
+/// </summary>
+static NodePtr putObject(const NodePtr& node, const ObjectPtr& object,
+                         uint32_t hash, uint32_t shift, bool& added) {
+  uint32_t bit = slotBit(hash, shift);
+  shared_ptr<HamtNode> copy = make_shared<HamtNode>(*node);
+
+  if (node->dataMap & bit) {
+    size_t index = slotIndex(node->dataMap, bit);
+    const ObjectPtr& existing = node->values[index];
+
+    if (existing->getId() == object->getId()) {
+      // Replace the existing object
+      copy->values[index] = object;
+      added = false;
+      return copy;
+    }
+
+    // Slot is taken by another object, move both into a child node
+    NodePtr child = mergeObjects(existing, hashId(existing->getId()), object,
+                                 hash, shift + BITS_PER_LEVEL);
+    copy->values.erase(copy->values.begin() + index);
+    copy->dataMap &= ~bit;
+    copy->nodeMap |= bit;
+    copy->children.insert(
+        copy->children.begin() + slotIndex(copy->nodeMap, bit), child);
+    added = true;
+  } else if (node->nodeMap & bit) {
+    size_t index = slotIndex(node->nodeMap, bit);
+    copy->children[index] = putObject(node->children[index], object, hash,
+                                      shift + BITS_PER_LEVEL, added);
+  } else {
+    // Empty slot
+    copy->values.insert(
+        copy->values.begin() + slotIndex(node->dataMap, bit), object);
+    copy->dataMap |= bit;
+    added = true;
+  }
+
+  return copy;
+}
+
+/// <summary>
+/// Provides a copy of the node with the object removed, or the node
+/// itself if the object is not present
+/// </summary>
+static NodePtr removeObject(const NodePtr& node, uint32_t id, uint32_t hash,
+                            uint32_t shift, bool& removed) {
+  uint32_t bit = slotBit(hash, shift);
+
+  if (node->dataMap & bit) {
+    size_t index = slotIndex(node->dataMap, bit);
+    if (node->values[index]->getId() != id) {
+      return node;
+    }
+
+    shared_ptr<HamtNode> copy = make_shared<HamtNode>(*node);
+    copy->values.erase(copy->values.begin() + index);
+    copy->dataMap &= ~bit;
+    removed = true;
+    return copy;
+  }
+
+  if (node->nodeMap & bit) {
+    size_t index = slotIndex(node->nodeMap, bit);
+    NodePtr child = removeObject(node->children[index], id, hash,
+                                 shift + BITS_PER_LEVEL, removed);
+    if (!removed) {
+      return node;
+    }
+
+    shared_ptr<HamtNode> copy = make_shared<HamtNode>(*node);
+    if (child->nodeMap == 0 && child->values.size() == 1) {
+      // Child only holds a single object, pull it up into this node
+      copy->children.erase(copy->children.begin() + index);
+      copy->nodeMap &= ~bit;
+      copy->values.insert(
+          copy->values.begin() + slotIndex(copy->dataMap, bit),
+          child->values[0]);
+      copy->dataMap |= bit;
+    } else {
+      copy->children[index] = child;
+    }
+    return copy;
+  }
+
+  return node;
+}
+
+/// <summary>
+/// Finds the object with the provided ID within the trie
+/// </summary>
+static ObjectPtr findObject(const NodePtr& root, uint32_t id) {
+  uint32_t hash = hashId(id);
+  const HamtNode* node = root.get();
+
+  for (uint32_t shift = 0; node != nullptr; shift += BITS_PER_LEVEL) {
+    uint32_t bit = slotBit(hash, shift);
+
+    if (node->dataMap & bit) {
+      const ObjectPtr& object = node->values[slotIndex(node->dataMap, bit)];
+      return object->getId() == id ? object : ObjectPtr();
+    }
+
+    if ((node->nodeMap & bit) == 0) {
+      break;
+    }
+
+    node = node->children[slotIndex(node->nodeMap, bit)].get();
+  }
+
+  return ObjectPtr();
+}
+
+/// <summary>
+/// Visits every object within the trie
+/// </summary>
+static void visitObjects(const HamtNode& node,
+                         const std::function<void(const DataObject&)>& visitor) {
+  for (const ObjectPtr& object : node.values) {
+    visitor(*object);
+  }
+  for (const NodePtr& child : node.children) {
+    visitObjects(*child, visitor);
+  }
+}
+
+/// <summary>
+/// Creates the state for an empty collection
+/// </summary>
+static shared_ptr<const PersistentState> emptyState() {
+  shared_ptr<PersistentState> state = make_shared<PersistentState>();
+  state->root = make_shared<HamtNode>();
+  state->size = 0;
+  state->nextId = 1;
+  return state;
+}
+
+PersistentSnapshot::PersistentSnapshot(shared_ptr<const PersistentState> state)
+    : state(state) {}
+
+shared_ptr<const DataObject> PersistentSnapshot::getObject(uint32_t id) const {
+  return findObject(state->root, id);
+}
+
+size_t PersistentSnapshot::getObjectCount() const {
+  return state->size;
+}
+
+uint32_t PersistentSnapshot::getNextId() const {
+  return state->nextId;
+}
+
+void PersistentSnapshot::forEach(
+    const std::function<void(const DataObject&)>& visitor) const {
+  visitObjects(*state->root, visitor);
+}
+
+void PersistentSnapshot::save(const string& path) const {
+  // Collection files store objects in ID order
+  vector<const DataObject*> objects;
+  objects.reserve(state->size);
+  forEach([&objects](const DataObject& object) { objects.push_back(&object); });
+  std::sort(objects.begin(), objects.end(),
+            [](const DataObject* a, const DataObject* b) {
+              return a->getId() < b->getId();
+            });
+
+  // Publish the file atomically so readers never see a partial file
+  FileStorageBackend storage(path);
+  storage.beginSnapshot();
+  StorageWriteBuffer buffer(storage);
+  ostream stream(&buffer);
+
+  serializeCollectionHeader(stream, state->nextId,
+                            static_cast<uint32_t>(objects.size()));
+
+  // One encoding buffer is reused for every object
+  vector<uint8_t> encoded;
+  for (const DataObject* object : objects) {
+    object->serialize(stream, encoded);
+
+    if (stream.fail()) {
+      throw std::runtime_error(
+          "Error while writing data object collection objects");
+    }
+  }
+
+  buffer.pubsync();
+  storage.publishSnapshot();
+}
+
+PersistentCollection::PersistentCollection(string path)
+    : path(path), state(emptyState()) {}
+
+void PersistentCollection::load() {
+  struct stat stats;
+
+  // Get the file path stats
+  if (stat(path.c_str(), &stats) != 0) {
+    // File doesn't exist, no loading to be done
+    return;
+  }
+
+  // Open binary stream to the file
+  ifstream stream(path, ios::binary);
+
+  if (!stream.is_open()) {
+    throw std::runtime_error(
+        "Failed to open stream to data object collection file");
+  }
+
+  shared_ptr<PersistentState> loaded = make_shared<PersistentState>();
+  uint32_t size;
+  uint32_t formatVersion =
+      deserializeCollectionHeader(stream, loaded->nextId, size);
+
+  loaded->root = make_shared<HamtNode>();
+  loaded->size = 0;
+
+  for (uint32_t i = 0; i < size; i++) {
+    shared_ptr<DataObject> object = make_shared<DataObject>();
+    object->deserialize(stream, formatVersion);
+
+    // Shared objects are never written, cache the hash before publishing
+    object->getContentHash();
+
+    if (stream.fail()) {
+      throw std::runtime_error(
+          "Error while reading data object collection objects");
+    }
+
+    bool added = false;
+    loaded->root =
+        putObject(loaded->root, object, hashId(object->id), 0, added);
+    if (added) {
+      loaded->size++;
+    }
+  }
+
+  // Close the finished stream
+  stream.close();
+
+  std::lock_guard<std::mutex> guard(writeLock);
+  std::atomic_store(&state, shared_ptr<const PersistentState>(loaded));
+}
+
+void PersistentCollection::save() {
+  std::lock_guard<std::mutex> guard(saveLock);
+  snapshot().save(path);
+}
+
+PersistentSnapshot PersistentCollection::snapshot() const {
+  return PersistentSnapshot(std::atomic_load(&state));
+}
+
+shared_ptr<const DataObject> PersistentCollection::getObject(
+    uint32_t id) const {
+  return findObject(std::atomic_load(&state)->root, id);
+}
+
+size_t PersistentCollection::getObjectCount() const {
+  return std::atomic_load(&state)->size;
+}
+
+shared_ptr<const DataObject> PersistentCollection::createObject(
+    DataObject object) {
+  std::lock_guard<std::mutex> guard(writeLock);
+  shared_ptr<const PersistentState> current = std::atomic_load(&state);
+
+  // Get and increment the next ID
+  object.id = current->nextId;
+  object.version = 1;
+  object.getContentHash();
+  shared_ptr<const DataObject> stored =
+      make_shared<DataObject>(std::move(object));
+
+  shared_ptr<PersistentState> next = make_shared<PersistentState>();
+  bool added = false;
+  next->root = putObject(current->root, stored, hashId(stored->id), 0, added);
+  next->size = current->size + 1;
+  next->nextId = current->nextId + 1;
+
+  std::atomic_store(&state, shared_ptr<const PersistentState>(next));
+  return stored;
+}
+
+shared_ptr<const DataObject> PersistentCollection::replace(DataObject object,
+                                                           bool& changed) {
+  std::lock_guard<std::mutex> guard(writeLock);
+  shared_ptr<const PersistentState> current = std::atomic_load(&state);
+
+  changed = false;
+  ObjectPtr existing = findObject(current->root, object.id);
+  if (!existing) {
+    return nullptr;
+  }
+
+  // Keep the existing object when the contents are unchanged
+  if (existing->getContentHash() == object.getContentHash() &&
+      existing->entries == object.entries) {
+    return existing;
+  }
+
+  changed = true;
+  object.version = existing->version + 1;
+  shared_ptr<const DataObject> stored =
+      make_shared<DataObject>(std::move(object));
+
+  shared_ptr<PersistentState> next = make_shared<PersistentState>(*current);
+  bool added = false;
+  next->root = putObject(current->root, stored, hashId(stored->id), 0, added);
+
+  std::atomic_store(&state, shared_ptr<const PersistentState>(next));
+  return stored;
+}
+
+bool PersistentCollection::deleteObject(uint32_t id) {
+  std::lock_guard<std::mutex> guard(writeLock);
+  shared_ptr<const PersistentState> current = std::atomic_load(&state);
+
+  bool removed = false;
+  NodePtr root = removeObject(current->root, id, hashId(id), 0, removed);
+  if (!removed) {
+    return false;
+  }
+
+  shared_ptr<PersistentState> next = make_shared<PersistentState>(*current);
+  next->root = root;
+  next->size = current->size - 1;
+
+  std::atomic_store(&state, shared_ptr<const PersistentState>(next));
+  return true;
+}
+
+shared_ptr<const DataObject> PersistentCollection::storeStruct(
+    DataObjectStructure* structure) {
+  // Populate a new object with the structure
+  DataObject object;
+  structure->populateObject(&object);
+
+  shared_ptr<const DataObject> stored = createObject(std::move(object));
+
+  // Save the collection
+  save();
+
+  return stored;
+}
+
+shared_ptr<const DataObject> PersistentCollection::saveStruct(
+    DataObjectStructure* structure) {
+  // Populate a replacement object with the structure data
+  DataObject object;
+  object.id = structure->getObjectId();
+  structure->populateObject(&object);
+
+  bool changed = false;
+  shared_ptr<const DataObject> stored = replace(std::move(object), changed);
+
+  // Object doesn't exist
+  if (!stored) {
+    return nullptr;
+  }
+
+  // Only save the collection if the object was changed
+  if (changed) {
+    save();
+  }
+
+  return stored;
+}
+
+shared_ptr<const DataObject> PersistentCollection::loadStruct(
+    DataObjectStructure* structure) {
+  shared_ptr<const DataObject> object = getObject(structure->getObjectId());
+
+  // Object doesn't exist
+  if (!object) {
+    return nullptr;
+  }
+
+  // Structures populate from a mutable object, give them a copy
+  DataObject copy(*object);
+  structure->fromObject(&copy);
+
+  return object;
+}
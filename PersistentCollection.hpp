@@ -0,0 +1,191 @@
+#ifndef PERSISTENT_COLLECTION
+#define PERSISTENT_COLLECTION 1
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+#include "DataObject.hpp"
+
+using std::shared_ptr;
+using std::string;
+using std::uint32_t;
+
+struct PersistentState;
+
+/// <summary>
+/// Immutable view of a PersistentCollection at a point in time. Taking
+/// a snapshot is O(1) and the snapshot is unaffected by later changes
+/// to the collection, so it can be read without any locking or saved on
+/// a background thread while writers continue
+/// </summary>
+class PersistentSnapshot {
+ private:
+  /// <summary>
+  /// The shared state of the collection when the snapshot was taken
+  /// </summary>
+  shared_ptr<const PersistentState> state;
+
+ public:
+  /// <summary>
+  /// Creates a snapshot of the provided state
+  /// </summary>
+  PersistentSnapshot(shared_ptr<const PersistentState> state);
+
+  /// <summary>
+  /// Provides the object with the provided ID or nullptr if the object
+  /// did not exist when the snapshot was taken
+  /// </summary>
+  /// <param name="id">The ID of the object to return</param>
+  /// <returns>The object with the provided ID or null</returns>
+  shared_ptr<const DataObject> getObject(uint32_t id) const;
+
+  /// <summary>
+  /// Provides the total number of objects in the snapshot
+  /// </summary>
+  /// <returns>The number of objects</returns>
+  size_t getObjectCount() const;
+
+  /// <summary>
+  /// Provides the ID that would have been given to the next object
+  /// </summary>
+  /// <returns>The next object ID</returns>
+  uint32_t getNextId() const;
+
+  /// <summary>
+  /// Calls the provided function for every object in the snapshot,
+  /// objects are visited in trie order rather than ID order
+  /// </summary>
+  /// <param name="visitor">The function to call</param>
+  void forEach(const std::function<void(const DataObject&)>& visitor) const;
+
+  /// <summary>
+  /// Serializes the snapshot to the file at the provided path using the
+  /// DataObjectCollection file format, with objects in ID order
+  /// </summary>
+  /// <param name="path">The path of the file to write</param>
+  void save(const string& path) const;
+};
+
+/// <summary>
+/// Collection of DataObjects stored in a persistent (immutable) hash
+/// array mapped trie keyed by object ID.
+///
+/// Changes copy only the path from the root to the changed object and
+/// share the rest of the trie with earlier versions, which makes
+/// snapshots O(1). This is an alternative to DataObjectCollection for
+/// workloads that snapshot frequently.
+///
+/// Objects are immutable once stored, updates replace the object.
+/// Writers are serialized with a lock, readers never lock.
+/// </summary>
+class PersistentCollection {
+ private:
+  /// <summary>
+  /// File path to where the collection is stored
+  /// </summary>
+  string path;
+  /// <summary>
+  /// The current state, only accessed through atomic loads and stores
+  /// </summary>
+  shared_ptr<const PersistentState> state;
+  /// <summary>
+  /// Lock held by writers while they publish a new state
+  /// </summary>
+  std::mutex writeLock;
+  /// <summary>
+  /// Lock held while the collection file is being written
+  /// </summary>
+  std::mutex saveLock;
+
+  /// <summary>
+  /// Replaces the stored object with the same ID, increasing its version.
+  /// Objects with unchanged contents are not replaced
+  /// </summary>
+  /// <param name="object">The replacement object</param>
+  /// <param name="changed">Set to whether the object was replaced</param>
+  /// <returns>The stored object or nullptr if no object has the ID</returns>
+  shared_ptr<const DataObject> replace(DataObject object, bool& changed);
+
+ public:
+  /// <summary>
+  /// Creates a new persistent collection for the provided path
+  /// </summary>
+  /// <param name="path">The path to the data object file</param>
+  PersistentCollection(string path);
+
+  /// <summary>
+  /// Deserializes the collection from the file at the path for this
+  /// collection, replacing the current state.
+  ///
+  /// If the file does not exist then the default state is applied.
+  /// </summary>
+  void load();
+
+  /// <summary>
+  /// Takes a snapshot of the collection and saves it to the file at the
+  /// path for this collection. Writers are not blocked while saving
+  /// </summary>
+  void save();
+
+  /// <summary>
+  /// Takes an O(1) snapshot of the current state of the collection
+  /// </summary>
+  /// <returns>The snapshot</returns>
+  PersistentSnapshot snapshot() const;
+
+  /// <summary>
+  /// Provides the object with the provided ID from the current state
+  /// or nullptr if it does not exist
+  /// </summary>
+  /// <param name="id">The ID of the object to return</param>
+  /// <returns>The object with the provided ID or null</returns>
+  shared_ptr<const DataObject> getObject(uint32_t id) const;
+
+  /// <summary>
+  /// Provides the total number of objects stored in this collection
+  /// </summary>
+  /// <returns>The number of objects</returns>
+  size_t getObjectCount() const;
+
+  /// <summary>
+  /// Stores the provided object as a new object, allocating the next ID
+  /// </summary>
+  /// <param name="object">The object entries to store</param>
+  /// <returns>The stored object</returns>
+  shared_ptr<const DataObject> createObject(DataObject object);
+
+  /// <summary>
+  /// Deletes an object with the provided ID if one is present
+  /// </summary>
+  /// <param name="id">The ID of the object to delete</param>
+  /// <returns>Whether an object was deleted</returns>
+  bool deleteObject(uint32_t id);
+
+  /// <summary>
+  /// Stores the provided structure in object form within the collection.
+  ///
+  /// Saves the collection automatically
+  /// </summary>
+  /// <returns>The object that was created and saved</returns>
+  shared_ptr<const DataObject> storeStruct(DataObjectStructure* structure);
+
+  /// <summary>
+  /// Saves an existing data object structure back to the collection
+  /// with its new changes.
+  ///
+  /// Saves the collection automatically when the contents changed
+  /// </summary>
+  /// <returns>The updated object or nullptr if none</returns>
+  shared_ptr<const DataObject> saveStruct(DataObjectStructure* structure);
+
+  /// <summary>
+  /// Loads an existing structure from the current state
+  /// </summary>
+  /// <returns>The object loaded from or nullptr if none</returns>
+  shared_ptr<const DataObject> loadStruct(DataObjectStructure* structure);
+};
+
+#endif
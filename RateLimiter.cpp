@@ -0,0 +1,78 @@
+#include "RateLimiter.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+using std::uint64_t;
+
+RateLimiter::RateLimiter(uint64_t bytesPerSecond, uint64_t burstBytes)
+    : bytesPerSecond(0),
+      burstBytes(0),
+      tokens(0),
+      refilled(std::chrono::steady_clock::now()) {
+  setRate(bytesPerSecond, burstBytes);
+  tokens = static_cast<double>(RateLimiter::burstBytes);
+}
+
+void RateLimiter::refill() {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  double elapsed = std::chrono::duration<double>(now - refilled).count();
+  refilled = now;
+
+  tokens = std::min(static_cast<double>(burstBytes),
+                    tokens + elapsed * static_cast<double>(bytesPerSecond));
+}
+
+void RateLimiter::acquire(uint64_t bytes) {
+  double wait = 0;
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (bytesPerSecond == 0) {
+      return;
+    }
+
+    // Tokens are taken immediately, going into debt that this caller
+    // waits out so concurrent callers queue behind each other fairly
+    refill();
+    tokens -= static_cast<double>(bytes);
+    if (tokens < 0) {
+      wait = -tokens / static_cast<double>(bytesPerSecond);
+    }
+  }
+
+  if (wait > 0) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+  }
+}
+
+bool RateLimiter::tryAcquire(uint64_t bytes) {
+  std::lock_guard<std::mutex> guard(lock);
+  if (bytesPerSecond == 0) {
+    return true;
+  }
+
+  refill();
+  if (tokens < static_cast<double>(bytes)) {
+    return false;
+  }
+  tokens -= static_cast<double>(bytes);
+  return true;
+}
+
+void RateLimiter::setRate(uint64_t bytesPerSecond, uint64_t burstBytes) {
+  std::lock_guard<std::mutex> guard(lock);
+  refill();
+
+  RateLimiter::bytesPerSecond = bytesPerSecond;
+  RateLimiter::burstBytes =
+      burstBytes != 0 ? burstBytes : std::max<uint64_t>(bytesPerSecond / 10, 1);
+  tokens = std::min(tokens, static_cast<double>(RateLimiter::burstBytes));
+}
+
+uint64_t RateLimiter::getRate() {
+  std::lock_guard<std::mutex> guard(lock);
+  return bytesPerSecond;
+}
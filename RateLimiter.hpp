@@ -0,0 +1,80 @@
+#ifndef RATE_LIMITER
+#define RATE_LIMITER 1
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+using std::uint64_t;
+
+/// <summary>
+/// Token bucket limiting the rate of background I/O such as snapshots
+/// and checkpoints so it doesn't starve foreground requests of disk
+/// bandwidth. A single limiter can be shared by several writers to give
+/// them one combined budget. Thread safe
+/// </summary>
+class RateLimiter {
+ private:
+  std::mutex lock;
+  /// <summary>
+  /// The rate tokens are added at, 0 for no limit
+  /// </summary>
+  uint64_t bytesPerSecond;
+  /// <summary>
+  /// The most tokens that can accumulate while idle
+  /// </summary>
+  uint64_t burstBytes;
+  /// <summary>
+  /// The available tokens, negative while acquirers are waiting
+  /// </summary>
+  double tokens;
+  /// <summary>
+  /// The time tokens were last added
+  /// </summary>
+  std::chrono::steady_clock::time_point refilled;
+
+  /// <summary>
+  /// Adds the tokens accumulated since the last refill. The lock must
+  /// be held
+  /// </summary>
+  void refill();
+
+ public:
+  /// <summary>
+  /// Creates a limiter for the provided rate
+  /// </summary>
+  /// <param name="bytesPerSecond">The rate, 0 for no limit</param>
+  /// <param name="burstBytes">The most bytes that can be written at
+  /// once after being idle, 0 for a tenth of a second</param>
+  RateLimiter(uint64_t bytesPerSecond, uint64_t burstBytes = 0);
+
+  /// <summary>
+  /// Takes tokens for the provided number of bytes, sleeping until the
+  /// rate allows them to be written
+  /// </summary>
+  /// <param name="bytes">The number of bytes about to be written</param>
+  void acquire(uint64_t bytes);
+
+  /// <summary>
+  /// Takes tokens for the provided number of bytes only if they are
+  /// available now
+  /// </summary>
+  /// <param name="bytes">The number of bytes about to be written</param>
+  /// <returns>Whether the tokens were taken</returns>
+  bool tryAcquire(uint64_t bytes);
+
+  /// <summary>
+  /// Changes the rate, taking effect for the next acquire
+  /// </summary>
+  /// <param name="bytesPerSecond">The rate, 0 for no limit</param>
+  /// <param name="burstBytes">The burst size, 0 for a tenth of a
+  /// second</param>
+  void setRate(uint64_t bytesPerSecond, uint64_t burstBytes = 0);
+
+  /// <summary>
+  /// Provides the rate, 0 when there is no limit
+  /// </summary>
+  uint64_t getRate();
+};
+
+#endif
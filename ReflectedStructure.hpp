@@ -0,0 +1,172 @@
+#ifndef REFLECTED_STRUCTURE
+#define REFLECTED_STRUCTURE 1
+
+#include <stdint.h>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "DataKey.hpp"
+#include "DataObject.hpp"
+#include "DataSchema.hpp"
+
+using std::string;
+using std::uint32_t;
+
+/// <summary>
+/// Member of a structure stored as an entry, created by DATA_FIELD
+/// </summary>
+template <typename S, typename M>
+struct DataField {
+  DataKey key;
+  M S::*member;
+};
+
+template <typename S, typename M>
+constexpr DataField<S, M> makeDataField(DataKey key, M S::*member) {
+  return DataField<S, M>{key, member};
+}
+
+/// <summary>
+/// Provides the type of value a member of type M is stored as
+/// </summary>
+template <typename M>
+constexpr DataValue::Type dataValueType() {
+  if constexpr (std::is_same<M, string>::value) {
+    return DataValue::STRING;
+  } else if constexpr (std::is_same<M, int32_t>::value) {
+    return DataValue::INTEGER;
+  } else if constexpr (std::is_same<M, float>::value) {
+    return DataValue::FLOAT;
+  } else {
+    static_assert(UnsupportedValueType<M>::value,
+                  "Fields are string, int32_t or float members");
+  }
+}
+
+/// <summary>
+/// Provides the type of value a field is stored as
+/// </summary>
+template <typename S, typename M>
+constexpr DataValue::Type getFieldType(const DataField<S, M>&) {
+  return dataValueType<M>();
+}
+
+/// <summary>
+/// Declares a member as a field stored under an entry with the name of
+/// the member
+/// </summary>
+#define DATA_FIELD(Structure, member) \
+  makeDataField(DataKey(#member, sizeof(#member) - 1), &Structure::member)
+
+/// <summary>
+/// Declares the fields of a ReflectedStructure, placed in the body of
+/// the structure
+/// </summary>
+#define DATA_FIELDS(...) \
+  static constexpr auto fields() { return std::make_tuple(__VA_ARGS__); }
+
+/// <summary>
+/// DataObjectStructure implemented from a list of fields, replacing
+/// hand written populateObject and fromObject functions:
+///
+///   struct User : ReflectedStructure<User> {
+///     string name;
+///     int32_t age;
+///     DATA_FIELDS(DATA_FIELD(User, name), DATA_FIELD(User, age))
+///   };
+///
+/// The field list is expanded at compile time, each key is a DataKey
+/// found without constructing a string and each member is copied once
+/// into its entry, or assigned from its entry. Members must be string,
+/// int32_t or float
+/// </summary>
+template <typename T>
+class ReflectedStructure : public DataObjectStructure {
+ private:
+  /// <summary>
+  /// Assigns the member from the entry when the object has the entry
+  /// with the type of the member, otherwise the member is unchanged
+  /// </summary>
+  template <typename M>
+  static void readField(const EntryMap& entries, DataKey key, M& member) {
+    EntryMap::const_iterator entry = entries.find(key.getView());
+    if (entry == entries.end()) {
+      return;
+    }
+
+    if (const M* value = entry->second.template as<M>()) {
+      member = *value;
+    }
+  }
+
+ protected:
+  /// <summary>
+  /// The ID of the object the structure was loaded from, zero until the
+  /// structure is loaded or assigned an object
+  /// </summary>
+  uint32_t objectId = 0;
+  /// <summary>
+  /// The version of the object the structure was loaded from, used with
+  /// saveStructIfVersion
+  /// </summary>
+  uint32_t objectVersion = 0;
+
+ public:
+  uint32_t getObjectId() override { return objectId; }
+
+  /// <summary>
+  /// Sets the object the structure is saved to, such as the object
+  /// returned by storeStruct
+  /// </summary>
+  void setObjectId(uint32_t id) { objectId = id; }
+
+  /// <summary>
+  /// Provides the version of the object the structure was loaded from
+  /// </summary>
+  uint32_t getObjectVersion() const { return objectVersion; }
+
+  void populateObject(DataObject* object) override {
+    const T& self = static_cast<const T&>(*this);
+    std::apply(
+        [object, &self](const auto&... field) {
+          (object->set(field.key.getView(), self.*field.member), ...);
+        },
+        T::fields());
+  }
+
+  void fromObject(DataObject* object) override {
+    T& self = static_cast<T&>(*this);
+    objectId = object->getId();
+    objectVersion = object->getVersion();
+
+    const EntryMap& entries = object->getEntries();
+    std::apply(
+        [&entries, &self](const auto&... field) {
+          (readField(entries, field.key, self.*field.member), ...);
+        },
+        T::fields());
+  }
+
+  /// <summary>
+  /// Provides the schema of the structure, the entries every object
+  /// stored from the structure has. Built once on first use
+  /// </summary>
+  static const DataSchema& getSchema() {
+    static const DataSchema schema = [] {
+      DataSchema fields;
+      std::apply(
+          [&fields](const auto&... field) {
+            (fields.addField(string(field.key.getView()),
+                             getFieldType(field)),
+             ...);
+          },
+          T::fields());
+      return fields;
+    }();
+    return schema;
+  }
+};
+
+#endif
@@ -0,0 +1,1048 @@
+#include "StorageBackend.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#include <windows.h>
+#define FILE_OPEN_FLAGS (_O_RDWR | _O_APPEND | _O_BINARY)
+#define FILE_CREATE_FLAG _O_CREAT
+#define FILE_PERMISSIONS (_S_IREAD | _S_IWRITE)
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#define FILE_OPEN_FLAGS (O_RDWR | O_APPEND)
+#define FILE_CREATE_FLAG O_CREAT
+#define FILE_PERMISSIONS 0644
+#endif
+
+#ifdef STORAGE_IO_URING
+#include <liburing.h>
+#endif
+
+using std::size_t;
+using std::string;
+using std::uint64_t;
+using std::uint8_t;
+using std::vector;
+
+/// <summary>
+/// Size of the chunks written by the stream buffer
+/// </summary>
+static const size_t STORAGE_BUFFER_SIZE = 64 * 1024;
+
+/// <summary>
+/// Size of the chunks read by the stream buffer, large enough that
+/// loading is limited by the disk rather than the number of reads
+/// </summary>
+static const size_t STORAGE_READ_CHUNK_SIZE = 1024 * 1024;
+
+/// <summary>
+/// The last snapshot generation started by any file storage
+/// </summary>
+static std::atomic<uint64_t> lastGeneration(0);
+
+/// <summary>
+/// Opens the file at the path for reading and appending
+/// </summary>
+/// <returns>The descriptor, negative on failure</returns>
+static int openFile(const string& path, bool create) {
+  int flags = FILE_OPEN_FLAGS | (create ? FILE_CREATE_FLAG : 0);
+#ifdef _WIN32
+  return ::_open(path.c_str(), flags, FILE_PERMISSIONS);
+#else
+  return ::open(path.c_str(), flags, FILE_PERMISSIONS);
+#endif
+}
+
+static void closeFile(int descriptor) {
+#ifdef _WIN32
+  ::_close(descriptor);
+#else
+  ::close(descriptor);
+#endif
+}
+
+/// <summary>
+/// Reads from the offset without moving the append position
+/// </summary>
+/// <returns>The number of bytes read, negative on failure</returns>
+static int64_t readFileAt(int descriptor, void* out, size_t size,
+                          uint64_t offset) {
+#ifdef _WIN32
+  // Appends always write at the end, so moving the position is harmless
+  if (::_lseeki64(descriptor, static_cast<__int64>(offset), SEEK_SET) < 0) {
+    return -1;
+  }
+  return ::_read(descriptor, out, static_cast<unsigned>(size));
+#else
+  return ::pread(descriptor, out, size, static_cast<off_t>(offset));
+#endif
+}
+
+/// <summary>
+/// Appends the bytes to the file
+/// </summary>
+/// <returns>The number of bytes written, negative on failure</returns>
+static int64_t appendFile(int descriptor, const void* data, size_t size) {
+#ifdef _WIN32
+  return ::_write(descriptor, data, static_cast<unsigned>(size));
+#else
+  return ::write(descriptor, data, size);
+#endif
+}
+
+static bool truncateFile(int descriptor, uint64_t size) {
+#ifdef _WIN32
+  return ::_chsize_s(descriptor, static_cast<__int64>(size)) == 0;
+#else
+  return ::ftruncate(descriptor, static_cast<off_t>(size)) == 0;
+#endif
+}
+
+static bool syncFile(int descriptor) {
+#ifdef _WIN32
+  return ::_commit(descriptor) == 0;
+#else
+  return ::fsync(descriptor) == 0;
+#endif
+}
+
+static bool getFileSize(int descriptor, uint64_t& size) {
+#ifdef _WIN32
+  struct _stat64 stats;
+  if (::_fstat64(descriptor, &stats) != 0) {
+    return false;
+  }
+#else
+  struct stat stats;
+  if (::fstat(descriptor, &stats) != 0) {
+    return false;
+  }
+#endif
+  size = static_cast<uint64_t>(stats.st_size);
+  return true;
+}
+
+bool replaceFile(const string& source, const string& target) {
+#ifdef _WIN32
+  return MoveFileExA(source.c_str(), target.c_str(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+  if (::rename(source.c_str(), target.c_str()) != 0) {
+    return false;
+  }
+
+  // Sync the directory so the rename itself is durable
+  size_t separator = target.find_last_of('/');
+  string directory =
+      separator == string::npos ? "." : target.substr(0, separator + 1);
+  int directoryDescriptor = ::open(directory.c_str(), O_RDONLY);
+  if (directoryDescriptor < 0) {
+    return false;
+  }
+  bool synced = ::fsync(directoryDescriptor) == 0;
+  ::close(directoryDescriptor);
+  return synced;
+#endif
+}
+
+static unsigned long getProcessId() {
+#ifdef _WIN32
+  return static_cast<unsigned long>(::_getpid());
+#else
+  return static_cast<unsigned long>(::getpid());
+#endif
+}
+
+#ifndef _WIN32
+/// <summary>
+/// Alignment of the offsets, sizes and buffers of direct writes
+/// </summary>
+static const size_t DIRECT_ALIGNMENT = 4096;
+
+/// <summary>
+/// Rounds the value down to the direct write alignment
+/// </summary>
+static uint64_t alignDown(uint64_t value) {
+  return value & ~static_cast<uint64_t>(DIRECT_ALIGNMENT - 1);
+}
+
+/// <summary>
+/// Rounds the value up to the direct write alignment
+/// </summary>
+static size_t alignUp(size_t value) {
+  return (value + DIRECT_ALIGNMENT - 1) & ~(DIRECT_ALIGNMENT - 1);
+}
+
+/// <summary>
+/// Allocates a buffer aligned for direct writes
+/// </summary>
+static uint8_t* allocateAligned(size_t size) {
+  void* buffer = nullptr;
+  if (posix_memalign(&buffer, DIRECT_ALIGNMENT, size) != 0) {
+    throw std::bad_alloc();
+  }
+  return reinterpret_cast<uint8_t*>(buffer);
+}
+#endif
+
+FileStorageBackend::FileStorageBackend(string path)
+    : path(path), writePath(path), descriptor(-1), generation(0) {}
+
+FileStorageBackend::~FileStorageBackend() {
+  if (descriptor >= 0) {
+    closeFile(descriptor);
+  }
+
+  // Remove a snapshot that was never published
+  if (writePath != path) {
+    std::remove(writePath.c_str());
+  }
+}
+
+bool FileStorageBackend::open(bool create) {
+  if (descriptor >= 0) {
+    return true;
+  }
+
+  descriptor = openFile(writePath, create);
+  if (descriptor < 0) {
+    if (!create && errno == ENOENT) {
+      return false;
+    }
+    throw std::runtime_error("Failed to open storage file");
+  }
+  return true;
+}
+
+uint64_t FileStorageBackend::size() {
+  if (!open(false)) {
+    return 0;
+  }
+
+  uint64_t size;
+  if (!getFileSize(descriptor, size)) {
+    throw std::runtime_error("Failed to read storage file size");
+  }
+  return size;
+}
+
+size_t FileStorageBackend::read(uint64_t offset, void* out, size_t size) {
+  if (!open(false)) {
+    return 0;
+  }
+
+  char* buffer = reinterpret_cast<char*>(out);
+  size_t total = 0;
+  while (total < size) {
+    int64_t count =
+        readFileAt(descriptor, buffer + total, size - total, offset + total);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("Failed to read storage file");
+    }
+    if (count == 0) {
+      break;
+    }
+    total += static_cast<size_t>(count);
+  }
+  return total;
+}
+
+void FileStorageBackend::append(const void* data, size_t size) {
+  open(true);
+
+  const char* buffer = reinterpret_cast<const char*>(data);
+  size_t total = 0;
+  while (total < size) {
+    int64_t count = appendFile(descriptor, buffer + total, size - total);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("Failed to write storage file");
+    }
+    total += static_cast<size_t>(count);
+  }
+}
+
+void FileStorageBackend::truncate(uint64_t size) {
+  open(true);
+
+  if (!truncateFile(descriptor, size)) {
+    throw std::runtime_error("Failed to truncate storage file");
+  }
+}
+
+void FileStorageBackend::sync() {
+  if (open(false) && !syncFile(descriptor)) {
+    throw std::runtime_error("Failed to sync storage file");
+  }
+}
+
+const uint8_t* FileStorageBackend::map() {
+  return nullptr;
+}
+
+void FileStorageBackend::close() {
+  if (descriptor >= 0) {
+    closeFile(descriptor);
+    descriptor = -1;
+  }
+}
+
+void FileStorageBackend::beginSnapshot() {
+  close();
+
+  // Discard the file of a snapshot that failed to publish
+  if (writePath != path) {
+    std::remove(writePath.c_str());
+  }
+
+  // Generations are numbered across the process and the file name
+  // includes the process ID, so any number of storages can write
+  // snapshots of the same file
+  generation = ++lastGeneration;
+  writePath = path + "." + std::to_string(getProcessId()) + "-" +
+              std::to_string(generation) + ".tmp";
+  open(true);
+  truncate(0);
+}
+
+void FileStorageBackend::publishSnapshot() {
+  if (writePath == path) {
+    flush();
+    return;
+  }
+
+  open(true);
+  sync();
+
+  // Windows can't replace a file that is open
+  close();
+  if (!replaceFile(writePath, path)) {
+    throw std::runtime_error("Failed to publish storage snapshot");
+  }
+  writePath = path;
+}
+
+uint64_t FileStorageBackend::getGeneration() const {
+  return generation;
+}
+
+void FileStorageBackend::advise(uint64_t offset, uint64_t size,
+                                Advice advice) {
+  if (!open(false)) {
+    return;
+  }
+
+  // Hints are best effort so failures are ignored
+#ifdef __linux__
+  if (advice == WILL_NEED && size > 0) {
+    ::readahead(descriptor, static_cast<off64_t>(offset),
+                static_cast<size_t>(size));
+    return;
+  }
+#endif
+#ifdef POSIX_FADV_SEQUENTIAL
+  int hint = POSIX_FADV_SEQUENTIAL;
+  if (advice == WILL_NEED) {
+    hint = POSIX_FADV_WILLNEED;
+  } else if (advice == DONT_NEED) {
+    hint = POSIX_FADV_DONTNEED;
+  }
+  posix_fadvise(descriptor, static_cast<off_t>(offset),
+                static_cast<off_t>(size), hint);
+#endif
+}
+
+MmapStorageBackend::MmapStorageBackend(string path)
+    : FileStorageBackend(path),
+      mapping(nullptr),
+      mappingSize(0),
+      mappingHandle(nullptr) {}
+
+MmapStorageBackend::~MmapStorageBackend() {
+  unmap();
+}
+
+void MmapStorageBackend::unmap() {
+  if (mapping != nullptr) {
+#ifdef _WIN32
+    UnmapViewOfFile(mapping);
+    CloseHandle(reinterpret_cast<HANDLE>(mappingHandle));
+    mappingHandle = nullptr;
+#else
+    munmap(mapping, mappingSize);
+#endif
+    mapping = nullptr;
+    mappingSize = 0;
+  }
+}
+
+const uint8_t* MmapStorageBackend::map() {
+  size_t length = static_cast<size_t>(size());
+  if (length == 0) {
+    return nullptr;
+  }
+
+  // Reuse the mapping while the file hasn't changed size
+  if (mapping != nullptr && mappingSize == length) {
+    return reinterpret_cast<const uint8_t*>(mapping);
+  }
+
+  unmap();
+#ifdef _WIN32
+  HANDLE handle =
+      CreateFileMappingA(reinterpret_cast<HANDLE>(_get_osfhandle(descriptor)),
+                         nullptr, PAGE_READONLY, 0, 0, nullptr);
+  void* mapped = handle == nullptr
+                     ? nullptr
+                     : MapViewOfFile(handle, FILE_MAP_READ, 0, 0, length);
+  if (mapped == nullptr) {
+    if (handle != nullptr) {
+      CloseHandle(handle);
+    }
+    throw std::runtime_error("Failed to map storage file");
+  }
+  mappingHandle = handle;
+#else
+  void* mapped = mmap(nullptr, length, PROT_READ, MAP_SHARED, descriptor, 0);
+  if (mapped == MAP_FAILED) {
+    throw std::runtime_error("Failed to map storage file");
+  }
+#endif
+
+  mapping = mapped;
+  mappingSize = length;
+  return reinterpret_cast<const uint8_t*>(mapping);
+}
+
+size_t MmapStorageBackend::read(uint64_t offset, void* out, size_t size) {
+  const uint8_t* data = map();
+  if (data == nullptr || offset >= mappingSize) {
+    return 0;
+  }
+
+  size_t count = std::min<size_t>(size, mappingSize - offset);
+  memcpy(out, data + offset, count);
+  return count;
+}
+
+void MmapStorageBackend::close() {
+  unmap();
+  FileStorageBackend::close();
+}
+
+void MmapStorageBackend::advise(uint64_t offset, uint64_t size,
+                                Advice advice) {
+  FileStorageBackend::advise(offset, size, advice);
+
+  // Sequential access applies to the whole mapping
+#ifndef _WIN32
+  if (advice == SEQUENTIAL && mapping != nullptr) {
+    madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+  }
+#endif
+}
+
+void MmapStorageBackend::append(const void* data, size_t size) {
+  unmap();
+  FileStorageBackend::append(data, size);
+}
+
+void MmapStorageBackend::truncate(uint64_t size) {
+  unmap();
+  FileStorageBackend::truncate(size);
+}
+
+#ifndef _WIN32
+DirectStorageBackend::DirectStorageBackend(string path, size_t bufferSize,
+                                           uint64_t bytesPerSecond,
+                                           uint64_t syncInterval)
+    : FileStorageBackend(path),
+      bufferSize(alignUp(std::max(bufferSize, DIRECT_ALIGNMENT))),
+      bytesPerSecond(bytesPerSecond),
+      syncInterval(syncInterval),
+      writeDescriptor(-1),
+      direct(false),
+      active(nullptr),
+      spare(nullptr),
+      activeSize(0),
+      activeOffset(0),
+      activeFlushed(0),
+      pending(nullptr),
+      pendingSize(0),
+      pendingOffset(0),
+      stopping(false),
+      failed(false),
+      syncOffset(0),
+      syncedOffset(0) {
+  active = allocateAligned(this->bufferSize);
+  spare = allocateAligned(this->bufferSize);
+}
+
+DirectStorageBackend::~DirectStorageBackend() {
+  try {
+    flush();
+  } catch (const std::exception&) {
+    // Destructors can't report the failure
+  }
+
+  if (writer.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(writerLock);
+      stopping = true;
+    }
+    writerCondition.notify_all();
+    writer.join();
+  }
+
+  if (writeDescriptor >= 0) {
+    ::close(writeDescriptor);
+  }
+  free(active);
+  free(spare);
+}
+
+void DirectStorageBackend::openWriter() {
+  if (writeDescriptor >= 0) {
+    return;
+  }
+
+  open(true);
+#ifdef O_DIRECT
+  writeDescriptor = ::open(writePath.c_str(), O_WRONLY | O_DIRECT);
+  direct = writeDescriptor >= 0;
+#endif
+  // Fall back to buffered writes where O_DIRECT is unsupported
+  if (writeDescriptor < 0) {
+    writeDescriptor = ::open(writePath.c_str(), O_WRONLY);
+  }
+  if (writeDescriptor < 0) {
+    throw std::runtime_error("Failed to open storage file for writing");
+  }
+
+  position(FileStorageBackend::size());
+  nextWrite = std::chrono::steady_clock::now();
+  if (!writer.joinable()) {
+    writer = std::thread(&DirectStorageBackend::run, this);
+  }
+}
+
+void DirectStorageBackend::position(uint64_t size) {
+  activeOffset = alignDown(size);
+  activeSize = static_cast<size_t>(size - activeOffset);
+  activeFlushed = activeSize;
+  syncOffset = activeOffset;
+  syncedOffset = activeOffset;
+
+  // Later writes rewrite the whole partial block
+  if (activeSize > 0 &&
+      FileStorageBackend::read(activeOffset, active, activeSize) !=
+          activeSize) {
+    throw std::runtime_error("Failed to read storage file");
+  }
+}
+
+void DirectStorageBackend::waitIdle(std::unique_lock<std::mutex>& lock) {
+  writerCondition.wait(lock, [this] { return pending == nullptr; });
+
+  // Failures are reported once
+  if (failed) {
+    failed = false;
+    throw std::runtime_error("Failed to write storage file");
+  }
+}
+
+void DirectStorageBackend::submit() {
+  {
+    std::unique_lock<std::mutex> lock(writerLock);
+    waitIdle(lock);
+    pending = active;
+    pendingSize = bufferSize;
+    pendingOffset = activeOffset;
+  }
+  writerCondition.notify_all();
+
+  // Fill the other buffer while the writer thread writes this one
+  std::swap(active, spare);
+  activeOffset += bufferSize;
+  activeSize = 0;
+  activeFlushed = 0;
+}
+
+void DirectStorageBackend::write(const uint8_t* data, size_t size,
+                                 uint64_t offset) {
+  size_t total = 0;
+  while (total < size) {
+    ssize_t count = ::pwrite(writeDescriptor, data + total, size - total,
+                             static_cast<off_t>(offset + total));
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+#ifdef O_DIRECT
+      // Some file systems accept O_DIRECT when opening but not writing
+      if (errno == EINVAL && direct) {
+        int flags = fcntl(writeDescriptor, F_GETFL);
+        if (flags >= 0 &&
+            fcntl(writeDescriptor, F_SETFL, flags & ~O_DIRECT) == 0) {
+          direct = false;
+          continue;
+        }
+      }
+#endif
+      throw std::runtime_error("Failed to write storage file");
+    }
+    total += static_cast<size_t>(count);
+  }
+
+#ifdef __linux__
+  // Buffered writes start writeback every sync interval, then wait for
+  // the previous interval and drop it from the page cache so dirty
+  // pages never build up into a writeback storm
+  uint64_t end = offset + size;
+  if (!direct && syncInterval > 0 && end > syncOffset &&
+      end - syncOffset >= syncInterval) {
+    sync_file_range(writeDescriptor, static_cast<off_t>(syncOffset),
+                    static_cast<off_t>(end - syncOffset),
+                    SYNC_FILE_RANGE_WRITE);
+    if (syncOffset > syncedOffset) {
+      sync_file_range(writeDescriptor, static_cast<off_t>(syncedOffset),
+                      static_cast<off_t>(syncOffset - syncedOffset),
+                      SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                          SYNC_FILE_RANGE_WAIT_AFTER);
+      posix_fadvise(writeDescriptor, static_cast<off_t>(syncedOffset),
+                    static_cast<off_t>(syncOffset - syncedOffset),
+                    POSIX_FADV_DONTNEED);
+    }
+    syncedOffset = syncOffset;
+    syncOffset = end;
+  }
+#endif
+
+  // Spread the writes out evenly at the configured rate
+  if (bytesPerSecond > 0) {
+    std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+    if (nextWrite < now) {
+      nextWrite = now;
+    }
+    nextWrite += std::chrono::nanoseconds(size * 1000000000ull /
+                                          bytesPerSecond);
+    std::this_thread::sleep_until(nextWrite);
+  }
+}
+
+void DirectStorageBackend::run() {
+  std::unique_lock<std::mutex> lock(writerLock);
+  while (true) {
+    writerCondition.wait(lock,
+                         [this] { return pending != nullptr || stopping; });
+    if (pending == nullptr) {
+      return;
+    }
+
+    // The buffer belongs to this thread until pending is cleared
+    lock.unlock();
+    bool written = true;
+    try {
+      write(pending, pendingSize, pendingOffset);
+    } catch (const std::exception&) {
+      written = false;
+    }
+    lock.lock();
+
+    failed = failed || !written;
+    pending = nullptr;
+    writerCondition.notify_all();
+  }
+}
+
+void DirectStorageBackend::close() {
+  flush();
+  if (writeDescriptor >= 0) {
+    ::close(writeDescriptor);
+    writeDescriptor = -1;
+  }
+  FileStorageBackend::close();
+}
+
+uint64_t DirectStorageBackend::size() {
+  flush();
+  return FileStorageBackend::size();
+}
+
+size_t DirectStorageBackend::read(uint64_t offset, void* out, size_t size) {
+  flush();
+  return FileStorageBackend::read(offset, out, size);
+}
+
+void DirectStorageBackend::append(const void* data, size_t size) {
+  openWriter();
+
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+  while (size > 0) {
+    size_t count = std::min(size, bufferSize - activeSize);
+    memcpy(active + activeSize, bytes, count);
+    activeSize += count;
+    bytes += count;
+    size -= count;
+
+    if (activeSize == bufferSize) {
+      submit();
+    }
+  }
+}
+
+void DirectStorageBackend::truncate(uint64_t size) {
+  flush();
+  FileStorageBackend::truncate(size);
+  if (writeDescriptor >= 0) {
+    position(size);
+  }
+}
+
+void DirectStorageBackend::sync() {
+  flush();
+  if (writeDescriptor < 0) {
+    FileStorageBackend::sync();
+  } else if (::fsync(writeDescriptor) != 0) {
+    throw std::runtime_error("Failed to sync storage file");
+  }
+}
+
+void DirectStorageBackend::flush() {
+  if (writeDescriptor < 0) {
+    return;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(writerLock);
+    waitIdle(lock);
+  }
+  if (activeFlushed == activeSize) {
+    return;
+  }
+
+  // Direct writes are whole blocks, the padding is truncated away
+  size_t padded = alignUp(activeSize);
+  memset(active + activeSize, 0, padded - activeSize);
+  write(active, padded, activeOffset);
+  if (padded != activeSize &&
+      ::ftruncate(writeDescriptor,
+                  static_cast<off_t>(activeOffset + activeSize)) != 0) {
+    throw std::runtime_error("Failed to truncate storage file");
+  }
+
+  // Keep only the partial block, it is rewritten by the next flush
+  size_t full = static_cast<size_t>(alignDown(activeSize));
+  memmove(active, active + full, activeSize - full);
+  activeOffset += full;
+  activeSize -= full;
+  activeFlushed = activeSize;
+}
+
+bool DirectStorageBackend::isDirect() const {
+  return direct;
+}
+#endif
+
+#ifdef STORAGE_IO_URING
+/// <summary>
+/// Number of entries in the io_uring submission queue
+/// </summary>
+static const unsigned IO_URING_DEPTH = 8;
+
+IoUringStorageBackend::IoUringStorageBackend(string path)
+    : FileStorageBackend(path), ring(new io_uring) {
+  if (io_uring_queue_init(IO_URING_DEPTH, ring, 0) < 0) {
+    delete ring;
+    throw std::runtime_error("Failed to create io_uring");
+  }
+}
+
+IoUringStorageBackend::~IoUringStorageBackend() {
+  io_uring_queue_exit(ring);
+  delete ring;
+}
+
+int IoUringStorageBackend::submit() {
+  if (io_uring_submit(ring) < 0) {
+    return -EIO;
+  }
+
+  io_uring_cqe* completion;
+  int result = io_uring_wait_cqe(ring, &completion);
+  if (result < 0) {
+    return result;
+  }
+
+  result = completion->res;
+  io_uring_cqe_seen(ring, completion);
+  return result;
+}
+
+size_t IoUringStorageBackend::read(uint64_t offset, void* out, size_t size) {
+  if (!open(false)) {
+    return 0;
+  }
+
+  char* buffer = reinterpret_cast<char*>(out);
+  size_t total = 0;
+  while (total < size) {
+    io_uring_sqe* request = io_uring_get_sqe(ring);
+    io_uring_prep_read(request, descriptor, buffer + total,
+                       static_cast<unsigned>(size - total), offset + total);
+
+    int count = submit();
+    if (count == -EINTR || count == -EAGAIN) {
+      continue;
+    }
+    if (count < 0) {
+      throw std::runtime_error("Failed to read storage file");
+    }
+    if (count == 0) {
+      break;
+    }
+    total += static_cast<size_t>(count);
+  }
+  return total;
+}
+
+void IoUringStorageBackend::append(const void* data, size_t size) {
+  open(true);
+
+  // The file is opened for appending so the offset is ignored
+  const char* buffer = reinterpret_cast<const char*>(data);
+  size_t total = 0;
+  while (total < size) {
+    io_uring_sqe* request = io_uring_get_sqe(ring);
+    io_uring_prep_write(request, descriptor, buffer + total,
+                        static_cast<unsigned>(size - total), 0);
+
+    int count = submit();
+    if (count == -EINTR || count == -EAGAIN) {
+      continue;
+    }
+    if (count <= 0) {
+      throw std::runtime_error("Failed to write storage file");
+    }
+    total += static_cast<size_t>(count);
+  }
+}
+
+void IoUringStorageBackend::sync() {
+  if (!open(false)) {
+    return;
+  }
+
+  io_uring_sqe* request = io_uring_get_sqe(ring);
+  io_uring_prep_fsync(request, descriptor, 0);
+  if (submit() < 0) {
+    throw std::runtime_error("Failed to sync storage file");
+  }
+}
+#endif
+
+MemoryStorageBackend::MemoryStorageBackend() : data{} {}
+
+const vector<uint8_t>& MemoryStorageBackend::getData() const {
+  return data;
+}
+
+uint64_t MemoryStorageBackend::size() {
+  return data.size();
+}
+
+size_t MemoryStorageBackend::read(uint64_t offset, void* out, size_t size) {
+  if (offset >= data.size()) {
+    return 0;
+  }
+
+  size_t count = std::min<size_t>(size, data.size() - offset);
+  memcpy(out, data.data() + offset, count);
+  return count;
+}
+
+void MemoryStorageBackend::append(const void* bytes, size_t size) {
+  const uint8_t* begin = reinterpret_cast<const uint8_t*>(bytes);
+  data.insert(data.end(), begin, begin + size);
+}
+
+void MemoryStorageBackend::truncate(uint64_t size) {
+  if (size < data.size()) {
+    data.resize(static_cast<size_t>(size));
+  }
+}
+
+void MemoryStorageBackend::sync() {}
+
+const uint8_t* MemoryStorageBackend::map() {
+  return data.empty() ? nullptr : data.data();
+}
+
+RateLimitedStorageBackend::RateLimitedStorageBackend(
+    std::unique_ptr<StorageBackend> storage,
+    std::shared_ptr<RateLimiter> limiter)
+    : storage(std::move(storage)), limiter(limiter) {}
+
+uint64_t RateLimitedStorageBackend::size() {
+  return storage->size();
+}
+
+size_t RateLimitedStorageBackend::read(uint64_t offset, void* out,
+                                       size_t size) {
+  return storage->read(offset, out, size);
+}
+
+void RateLimitedStorageBackend::append(const void* data, size_t size) {
+  limiter->acquire(size);
+  storage->append(data, size);
+}
+
+void RateLimitedStorageBackend::truncate(uint64_t size) {
+  storage->truncate(size);
+}
+
+void RateLimitedStorageBackend::sync() {
+  storage->sync();
+}
+
+const uint8_t* RateLimitedStorageBackend::map() {
+  return storage->map();
+}
+
+void RateLimitedStorageBackend::flush() {
+  storage->flush();
+}
+
+void RateLimitedStorageBackend::beginSnapshot() {
+  storage->beginSnapshot();
+}
+
+void RateLimitedStorageBackend::publishSnapshot() {
+  storage->publishSnapshot();
+}
+
+void RateLimitedStorageBackend::advise(uint64_t offset, uint64_t size,
+                                       Advice advice) {
+  storage->advise(offset, size, advice);
+}
+
+StorageReadBuffer::StorageReadBuffer(StorageBackend& storage, bool release)
+    : storage(storage), release(release), offset(0), buffer{}, next{} {
+  // Mapped storage is exposed as a single buffer
+  const uint8_t* mapped = storage.map();
+  storage.advise(0, 0, StorageBackend::SEQUENTIAL);
+  if (mapped != nullptr) {
+    char* begin = const_cast<char*>(reinterpret_cast<const char*>(mapped));
+    offset = storage.size();
+    setg(begin, begin, begin + offset);
+    return;
+  }
+
+  buffer.resize(STORAGE_READ_CHUNK_SIZE);
+  next.resize(STORAGE_READ_CHUNK_SIZE);
+  setg(buffer.data(), buffer.data(), buffer.data());
+  startPrefetch();
+}
+
+void StorageReadBuffer::startPrefetch() {
+  // The storage is only used by the prefetch thread until it finishes
+  uint64_t start = offset;
+  prefetch = std::async(std::launch::async, [this, start] {
+    storage.advise(start + next.size(), next.size(),
+                   StorageBackend::WILL_NEED);
+    return storage.read(start, next.data(), next.size());
+  });
+}
+
+StorageReadBuffer::int_type StorageReadBuffer::underflow() {
+  if (gptr() < egptr()) {
+    return traits_type::to_int_type(*gptr());
+  }
+
+  // Mapped storage has no more chunks
+  if (buffer.empty()) {
+    return traits_type::eof();
+  }
+
+  size_t consumed = static_cast<size_t>(egptr() - eback());
+  size_t count = prefetch.valid() ? prefetch.get() : 0;
+  if (release && consumed > 0) {
+    storage.advise(offset - consumed, consumed, StorageBackend::DONT_NEED);
+  }
+
+  if (count == 0) {
+    setg(buffer.data(), buffer.data(), buffer.data());
+    return traits_type::eof();
+  }
+
+  // Parse the prefetched chunk while the one after it is read, a short
+  // read means the end of the storage has been reached
+  std::swap(buffer, next);
+  offset += count;
+  setg(buffer.data(), buffer.data(), buffer.data() + count);
+  if (count == buffer.size()) {
+    startPrefetch();
+  }
+  return traits_type::to_int_type(*gptr());
+}
+
+StorageWriteBuffer::StorageWriteBuffer(StorageBackend& storage)
+    : storage(storage), buffer(STORAGE_BUFFER_SIZE) {
+  setp(buffer.data(), buffer.data() + buffer.size());
+}
+
+void StorageWriteBuffer::flushBuffer() {
+  size_t count = static_cast<size_t>(pptr() - pbase());
+  if (count > 0) {
+    storage.append(pbase(), count);
+  }
+  setp(buffer.data(), buffer.data() + buffer.size());
+}
+
+StorageWriteBuffer::int_type StorageWriteBuffer::overflow(int_type value) {
+  flushBuffer();
+
+  if (!traits_type::eq_int_type(value, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(value);
+    pbump(1);
+  }
+  return traits_type::not_eof(value);
+}
+
+std::streamsize StorageWriteBuffer::xsputn(const char* data,
+                                           std::streamsize size) {
+  // Large writes bypass the buffer
+  if (static_cast<size_t>(size) >= buffer.size()) {
+    flushBuffer();
+    storage.append(data, static_cast<size_t>(size));
+    return size;
+  }
+
+  return std::streambuf::xsputn(data, size);
+}
+
+int StorageWriteBuffer::sync() {
+  flushBuffer();
+  return 0;
+}
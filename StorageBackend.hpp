@@ -0,0 +1,550 @@
+#ifndef STORAGE_BACKEND
+#define STORAGE_BACKEND 1
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "RateLimiter.hpp"
+
+using std::size_t;
+using std::string;
+using std::uint64_t;
+using std::uint8_t;
+using std::vector;
+
+/// <summary>
+/// Atomically replaces the file at the target path with the source file
+/// and makes the replacement durable
+/// </summary>
+/// <param name="source">The path of the replacing file</param>
+/// <param name="target">The path of the file to replace</param>
+/// <returns>Whether the file was replaced durably</returns>
+bool replaceFile(const string& source, const string& target);
+
+/// <summary>
+/// Byte storage that a collection is loaded from and saved to. Storage
+/// is a single growable sequence of bytes that is read at offsets and
+/// written by appending, new engines only need to implement this
+/// interface to be usable by DataObjectCollection
+/// </summary>
+class StorageBackend {
+ public:
+  /// <summary>
+  /// Hints about how a range of the storage is about to be accessed
+  /// </summary>
+  enum Advice { SEQUENTIAL, WILL_NEED, DONT_NEED };
+
+  virtual ~StorageBackend() {}
+
+  /// <summary>
+  /// Provides the number of stored bytes, storage that doesn't exist
+  /// yet is empty
+  /// </summary>
+  virtual uint64_t size() = 0;
+
+  /// <summary>
+  /// Reads up to size bytes starting at the provided offset
+  /// </summary>
+  /// <param name="offset">The offset to read from</param>
+  /// <param name="out">The buffer to read into</param>
+  /// <param name="size">The number of bytes to read</param>
+  /// <returns>The number of bytes read, less than size only at the end
+  /// of the storage</returns>
+  virtual size_t read(uint64_t offset, void* out, size_t size) = 0;
+
+  /// <summary>
+  /// Appends the bytes to the end of the storage
+  /// </summary>
+  /// <param name="data">The bytes to append</param>
+  /// <param name="size">The number of bytes</param>
+  virtual void append(const void* data, size_t size) = 0;
+
+  /// <summary>
+  /// Shrinks the storage to the provided size
+  /// </summary>
+  /// <param name="size">The new size</param>
+  virtual void truncate(uint64_t size) = 0;
+
+  /// <summary>
+  /// Makes the appended bytes durable
+  /// </summary>
+  virtual void sync() = 0;
+
+  /// <summary>
+  /// Writes any appended bytes the backend holds in its own buffers to
+  /// the storage, without making them durable
+  /// </summary>
+  virtual void flush() {}
+
+  /// <summary>
+  /// Starts replacing the entire contents of the storage, the bytes
+  /// appended until publishSnapshot form the new contents. Backends that
+  /// can't publish atomically simply truncate the storage
+  /// </summary>
+  virtual void beginSnapshot() { truncate(0); }
+
+  /// <summary>
+  /// Makes the snapshot started by beginSnapshot durable and replaces
+  /// the previous contents with it
+  /// </summary>
+  virtual void publishSnapshot() { flush(); }
+
+  /// <summary>
+  /// Hints how a range of the storage is about to be accessed so the
+  /// backend can read ahead or release cached pages. Backends that
+  /// can't use the hint ignore it
+  /// </summary>
+  /// <param name="offset">The start of the range</param>
+  /// <param name="size">The size of the range, 0 for the rest of the
+  /// storage</param>
+  /// <param name="advice">How the range will be accessed</param>
+  virtual void advise(uint64_t /*offset*/, uint64_t /*size*/,
+                      Advice /*advice*/) {}
+
+  /// <summary>
+  /// Provides direct read access to all of the stored bytes, valid until
+  /// the storage is next modified. Backends that can't map their storage
+  /// return nullptr and are read with read instead
+  /// </summary>
+  virtual const uint8_t* map() = 0;
+};
+
+/// <summary>
+/// Storage backed by a file, read with pread and appended with write.
+/// Direct storage is only available on POSIX systems
+/// </summary>
+class FileStorageBackend : public StorageBackend {
+ protected:
+  /// <summary>
+  /// The path to the file
+  /// </summary>
+  string path;
+  /// <summary>
+  /// The path of the file being used, the generation numbered
+  /// temporary file while a snapshot is being written
+  /// </summary>
+  string writePath;
+  /// <summary>
+  /// The open file descriptor, -1 until the file is first used. Files
+  /// are only created once written to
+  /// </summary>
+  int descriptor;
+  /// <summary>
+  /// The generation of the last snapshot started, 0 if none has been
+  /// </summary>
+  uint64_t generation;
+
+  /// <summary>
+  /// Opens the file if it isn't already open
+  /// </summary>
+  /// <param name="create">Whether to create the file if it doesn't
+  /// exist</param>
+  /// <returns>Whether the file is open</returns>
+  bool open(bool create);
+
+  /// <summary>
+  /// Closes the file, it is opened again on next use
+  /// </summary>
+  virtual void close();
+
+ public:
+  FileStorageBackend(string path);
+  ~FileStorageBackend();
+
+  uint64_t size() override;
+  size_t read(uint64_t offset, void* out, size_t size) override;
+  void append(const void* data, size_t size) override;
+  void truncate(uint64_t size) override;
+  void sync() override;
+  const uint8_t* map() override;
+  void advise(uint64_t offset, uint64_t size, Advice advice) override;
+
+  /// <summary>
+  /// Starts writing the next generation to a temporary file beside the
+  /// file. Readers that have the file open or mapped keep seeing the
+  /// previous generation
+  /// </summary>
+  void beginSnapshot() override;
+
+  /// <summary>
+  /// Syncs the temporary file and renames it over the file, so the file
+  /// always holds either the previous or the new generation in full
+  /// </summary>
+  void publishSnapshot() override;
+
+  /// <summary>
+  /// Provides the generation of the last snapshot started through this
+  /// storage. Generations increase across every storage in the process
+  /// </summary>
+  uint64_t getGeneration() const;
+};
+
+/// <summary>
+/// File storage that is read through a read only memory mapping of the
+/// file, loading a collection then parses the page cache directly
+/// without copying the file through a stream buffer
+/// </summary>
+class MmapStorageBackend : public FileStorageBackend {
+ private:
+  /// <summary>
+  /// The current mapping, nullptr when not mapped
+  /// </summary>
+  void* mapping;
+  /// <summary>
+  /// The size of the current mapping
+  /// </summary>
+  size_t mappingSize;
+  /// <summary>
+  /// The file mapping object of the current mapping on Windows
+  /// </summary>
+  void* mappingHandle;
+
+  /// <summary>
+  /// Removes the current mapping
+  /// </summary>
+  void unmap();
+
+ protected:
+  void close() override;
+
+ public:
+  MmapStorageBackend(string path);
+  ~MmapStorageBackend();
+
+  size_t read(uint64_t offset, void* out, size_t size) override;
+  void append(const void* data, size_t size) override;
+  void truncate(uint64_t size) override;
+  const uint8_t* map() override;
+  void advise(uint64_t offset, uint64_t size, Advice advice) override;
+};
+
+#ifndef _WIN32
+/// <summary>
+/// File storage appending through O_DIRECT so large snapshots do not
+/// evict the page cache of the host.
+///
+/// Appended bytes are gathered into two aligned buffers, a writer thread
+/// writes one buffer while the other is filled. The final partial block
+/// is written padded and the file truncated back to its real size.
+/// Writes can be limited to a number of bytes per second, and when the
+/// file system does not support O_DIRECT the writer falls back to
+/// buffered writes paced with sync_file_range, dropping the written
+/// pages from the cache as it goes.
+///
+/// Appended bytes are only visible to readers once flushed.
+/// </summary>
+class DirectStorageBackend : public FileStorageBackend {
+ private:
+  /// <summary>
+  /// Size of each of the aligned buffers
+  /// </summary>
+  size_t bufferSize;
+  /// <summary>
+  /// Maximum number of bytes written per second, 0 for no limit
+  /// </summary>
+  uint64_t bytesPerSecond;
+  /// <summary>
+  /// Number of bytes between sync_file_range calls when writing
+  /// through the page cache, 0 to never call it
+  /// </summary>
+  uint64_t syncInterval;
+
+  /// <summary>
+  /// File descriptor used for writing, -1 until the first append
+  /// </summary>
+  int writeDescriptor;
+  /// <summary>
+  /// Whether the write descriptor bypasses the page cache
+  /// </summary>
+  std::atomic<bool> direct;
+
+  /// <summary>
+  /// The buffer being filled by append
+  /// </summary>
+  uint8_t* active;
+  /// <summary>
+  /// The buffer owned by the writer thread
+  /// </summary>
+  uint8_t* spare;
+  /// <summary>
+  /// The number of bytes in the active buffer
+  /// </summary>
+  size_t activeSize;
+  /// <summary>
+  /// The aligned file offset of the start of the active buffer
+  /// </summary>
+  uint64_t activeOffset;
+  /// <summary>
+  /// The number of bytes of the active buffer already in the file
+  /// </summary>
+  size_t activeFlushed;
+
+  std::thread writer;
+  /// <summary>
+  /// Lock guarding the writer thread state
+  /// </summary>
+  std::mutex writerLock;
+  std::condition_variable writerCondition;
+  /// <summary>
+  /// The buffer waiting to be written, nullptr when the writer is idle
+  /// </summary>
+  uint8_t* pending;
+  size_t pendingSize;
+  uint64_t pendingOffset;
+  /// <summary>
+  /// Whether the writer thread should exit
+  /// </summary>
+  bool stopping;
+  /// <summary>
+  /// Whether a write failed, reported by the next flush or append
+  /// </summary>
+  bool failed;
+
+  /// <summary>
+  /// Time the next write may start when the write rate is limited
+  /// </summary>
+  std::chrono::steady_clock::time_point nextWrite;
+  /// <summary>
+  /// Start of the range written since the last sync_file_range
+  /// </summary>
+  uint64_t syncOffset;
+  /// <summary>
+  /// Start of the range passed to the last sync_file_range
+  /// </summary>
+  uint64_t syncedOffset;
+
+  /// <summary>
+  /// Opens the write descriptor and starts the writer thread if they
+  /// aren't already
+  /// </summary>
+  void openWriter();
+
+  /// <summary>
+  /// Moves the write position to the end of the first size bytes of the
+  /// file, reading the partial block at that position into the active
+  /// buffer
+  /// </summary>
+  void position(uint64_t size);
+
+  /// <summary>
+  /// Hands the full active buffer to the writer thread
+  /// </summary>
+  void submit();
+
+  /// <summary>
+  /// Waits until the writer thread is idle, throwing if a write failed
+  /// </summary>
+  void waitIdle(std::unique_lock<std::mutex>& lock);
+
+  /// <summary>
+  /// Writes the buffer at the aligned file offset, then paces the writer
+  /// </summary>
+  void write(const uint8_t* data, size_t size, uint64_t offset);
+
+  /// <summary>
+  /// Writes buffers handed over by submit until stopped
+  /// </summary>
+  void run();
+
+ protected:
+  void close() override;
+
+ public:
+  /// <summary>
+  /// Creates direct storage for the file at the provided path
+  /// </summary>
+  /// <param name="path">The path to the file</param>
+  /// <param name="bufferSize">Size of each of the two write buffers,
+  /// rounded up to the block alignment</param>
+  /// <param name="bytesPerSecond">Maximum write rate, 0 for no
+  /// limit</param>
+  /// <param name="syncInterval">Number of bytes between sync_file_range
+  /// calls when O_DIRECT is unsupported, 0 to disable</param>
+  DirectStorageBackend(string path, size_t bufferSize = 1024 * 1024,
+                       uint64_t bytesPerSecond = 0,
+                       uint64_t syncInterval = 8 * 1024 * 1024);
+  ~DirectStorageBackend();
+
+  uint64_t size() override;
+  size_t read(uint64_t offset, void* out, size_t size) override;
+  void append(const void* data, size_t size) override;
+  void truncate(uint64_t size) override;
+  void sync() override;
+  void flush() override;
+
+  /// <summary>
+  /// Provides whether appends bypass the page cache, false until the
+  /// first append or when the file system does not support O_DIRECT
+  /// </summary>
+  bool isDirect() const;
+};
+#endif
+
+#ifdef STORAGE_IO_URING
+struct io_uring;
+
+/// <summary>
+/// File storage performing reads, appends and syncs through io_uring.
+/// Requires liburing, enabled by defining STORAGE_IO_URING
+/// </summary>
+class IoUringStorageBackend : public FileStorageBackend {
+ private:
+  /// <summary>
+  /// The submission and completion rings
+  /// </summary>
+  io_uring* ring;
+
+  /// <summary>
+  /// Submits the prepared request and waits for its result
+  /// </summary>
+  int submit();
+
+ public:
+  IoUringStorageBackend(string path);
+  ~IoUringStorageBackend();
+
+  size_t read(uint64_t offset, void* out, size_t size) override;
+  void append(const void* data, size_t size) override;
+  void sync() override;
+};
+#endif
+
+/// <summary>
+/// Storage kept entirely in memory, for benchmarking and testing
+/// collections without any disk access
+/// </summary>
+class MemoryStorageBackend : public StorageBackend {
+ private:
+  vector<uint8_t> data;
+
+ public:
+  MemoryStorageBackend();
+
+  /// <summary>
+  /// Provides the stored bytes
+  /// </summary>
+  const vector<uint8_t>& getData() const;
+
+  uint64_t size() override;
+  size_t read(uint64_t offset, void* out, size_t size) override;
+  void append(const void* data, size_t size) override;
+  void truncate(uint64_t size) override;
+  void sync() override;
+  const uint8_t* map() override;
+};
+
+/// <summary>
+/// Storage limiting the rate appends are made to another storage, for
+/// writing snapshots without taking the disk bandwidth of foreground
+/// requests
+/// </summary>
+class RateLimitedStorageBackend : public StorageBackend {
+ private:
+  std::unique_ptr<StorageBackend> storage;
+  std::shared_ptr<RateLimiter> limiter;
+
+ public:
+  /// <summary>
+  /// Creates storage appending to the provided storage at the rate of
+  /// the limiter, which can be shared with other writers
+  /// </summary>
+  /// <param name="storage">The storage to write to</param>
+  /// <param name="limiter">The limiter for appends</param>
+  RateLimitedStorageBackend(std::unique_ptr<StorageBackend> storage,
+                            std::shared_ptr<RateLimiter> limiter);
+
+  uint64_t size() override;
+  size_t read(uint64_t offset, void* out, size_t size) override;
+  void append(const void* data, size_t size) override;
+  void truncate(uint64_t size) override;
+  void sync() override;
+  const uint8_t* map() override;
+  void flush() override;
+  void beginSnapshot() override;
+  void publishSnapshot() override;
+  void advise(uint64_t offset, uint64_t size, Advice advice) override;
+};
+
+/// <summary>
+/// Stream buffer reading the contents of a storage backend. Mapped
+/// storage is read in place. Other storage is read in large chunks, the
+/// next chunk is read on another thread while the current chunk is
+/// being parsed so loading is limited by the disk rather than by
+/// waiting on each read in turn
+/// </summary>
+class StorageReadBuffer : public std::streambuf {
+ private:
+  StorageBackend& storage;
+  /// <summary>
+  /// Whether consumed chunks are dropped from the page cache
+  /// </summary>
+  bool release;
+  /// <summary>
+  /// Offset of the next chunk to read
+  /// </summary>
+  uint64_t offset;
+  /// <summary>
+  /// The chunk being parsed, unused for mapped storage
+  /// </summary>
+  vector<char> buffer;
+  /// <summary>
+  /// The chunk being read ahead
+  /// </summary>
+  vector<char> next;
+  /// <summary>
+  /// The read of the next chunk, providing the number of bytes read
+  /// </summary>
+  std::future<size_t> prefetch;
+
+  /// <summary>
+  /// Starts reading the chunk at the current offset into next
+  /// </summary>
+  void startPrefetch();
+
+ protected:
+  int_type underflow() override;
+
+ public:
+  /// <summary>
+  /// Creates a buffer reading the storage from the start
+  /// </summary>
+  /// <param name="storage">The storage to read</param>
+  /// <param name="release">Whether to drop chunks from the page cache
+  /// once consumed, for storage read once</param>
+  StorageReadBuffer(StorageBackend& storage, bool release = false);
+};
+
+/// <summary>
+/// Stream buffer appending to a storage backend in chunks. Buffered
+/// bytes are only appended when the buffer fills or is synced
+/// </summary>
+class StorageWriteBuffer : public std::streambuf {
+ private:
+  StorageBackend& storage;
+  vector<char> buffer;
+
+  /// <summary>
+  /// Appends the buffered bytes to the storage
+  /// </summary>
+  void flushBuffer();
+
+ protected:
+  int_type overflow(int_type value) override;
+  std::streamsize xsputn(const char* data, std::streamsize size) override;
+  int sync() override;
+
+ public:
+  StorageWriteBuffer(StorageBackend& storage);
+};
+
+#endif
@@ -0,0 +1,583 @@
+#include "TimeSeriesCollection.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "StorageBackend.hpp"
+
+using std::ifstream;
+using std::int32_t;
+using std::int64_t;
+using std::ios;
+using std::ostream;
+using std::string;
+using std::uint32_t;
+using std::uint64_t;
+using std::vector;
+
+/// <summary>
+/// Magic value written at the start of time series files ("DOTS")
+/// </summary>
+static const uint32_t TIME_SERIES_MAGIC = 0x53544F44;
+
+/// <summary>
+/// Time series file format version
+/// </summary>
+static const uint32_t TIME_SERIES_FORMAT_VERSION = 1;
+
+/// <summary>
+/// Marks the XOR window of a field as not yet set
+/// </summary>
+static const uint32_t NO_WINDOW = 0xFFFFFFFF;
+
+const char* const TimeSeriesCollection::TIMESTAMP_KEY = "ts";
+
+/// <summary>
+/// Counts the leading zero bits of a non zero value
+/// </summary>
+static uint32_t leadingZeros(uint32_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+  return static_cast<uint32_t>(__builtin_clz(value));
+#else
+  uint32_t count = 0;
+  while ((value & 0x80000000u) == 0) {
+    value <<= 1;
+    count++;
+  }
+  return count;
+#endif
+}
+
+/// <summary>
+/// Counts the trailing zero bits of a non zero value
+/// </summary>
+static uint32_t trailingZeros(uint32_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+  return static_cast<uint32_t>(__builtin_ctz(value));
+#else
+  uint32_t count = 0;
+  while ((value & 1u) == 0) {
+    value >>= 1;
+    count++;
+  }
+  return count;
+#endif
+}
+
+static uint32_t floatBits(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+static float bitsFloat(uint32_t bits) {
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+BitWriter::BitWriter() : bytes{}, length(0) {}
+
+void BitWriter::write(uint64_t value, uint32_t count) {
+  while (count > 0) {
+    if (length % 8 == 0) {
+      bytes.push_back(0);
+    }
+
+    // Fill the remaining bits of the last byte
+    uint32_t free = 8 - static_cast<uint32_t>(length % 8);
+    uint32_t take = std::min(free, count);
+    uint8_t bits =
+        static_cast<uint8_t>((value >> (count - take)) & ((1u << take) - 1));
+    bytes.back() |= static_cast<uint8_t>(bits << (free - take));
+
+    length += take;
+    count -= take;
+  }
+}
+
+const vector<uint8_t>& BitWriter::getBytes() const {
+  return bytes;
+}
+
+uint64_t BitWriter::getLength() const {
+  return length;
+}
+
+BitReader::BitReader(const vector<uint8_t>& bytes)
+    : bytes(bytes), position(0) {}
+
+uint64_t BitReader::read(uint32_t count) {
+  uint64_t result = 0;
+  while (count > 0) {
+    size_t byte = static_cast<size_t>(position / 8);
+    if (byte >= bytes.size()) {
+      throw std::runtime_error("Time series chunk is truncated");
+    }
+
+    uint32_t available = 8 - static_cast<uint32_t>(position % 8);
+    uint32_t take = std::min(available, count);
+    uint8_t bits = static_cast<uint8_t>((bytes[byte] >> (available - take)) &
+                                        ((1u << take) - 1));
+    result = (result << take) | bits;
+
+    position += take;
+    count -= take;
+  }
+  return result;
+}
+
+double TimeSeriesBucket::mean() const {
+  return count == 0 ? 0.0 : sum / count;
+}
+
+TimeSeriesCollection::TimeSeriesCollection(string path, vector<string> fields,
+                                           uint32_t chunkSize)
+    : path(path),
+      fields(fields),
+      chunkSize(chunkSize == 0 ? 1 : chunkSize),
+      chunks{},
+      chunkOpen(false),
+      previousDelta(0),
+      previousValues{},
+      previousLeading{},
+      previousTrailing{} {}
+
+const vector<string>& TimeSeriesCollection::getFields() const {
+  return fields;
+}
+
+size_t TimeSeriesCollection::getFieldIndex(const string& field) const {
+  for (size_t i = 0; i < fields.size(); i++) {
+    if (fields[i] == field) {
+      return i;
+    }
+  }
+  throw std::invalid_argument("Unknown time series field \"" + field + "\"");
+}
+
+void TimeSeriesCollection::append(int32_t timestamp,
+                                  const vector<float>& values) {
+  if (values.size() != fields.size()) {
+    throw std::invalid_argument("Time series sample has the wrong number of "
+                                "values");
+  }
+
+  if (!chunks.empty() && timestamp < chunks.back().lastTimestamp) {
+    throw std::invalid_argument("Time series samples must be appended in "
+                                "timestamp order");
+  }
+
+  // Start a new chunk when the current one is full or was loaded
+  if (!chunkOpen || chunks.back().count >= chunkSize) {
+    TimeSeriesChunk chunk;
+    chunk.count = 0;
+    chunk.firstTimestamp = timestamp;
+    chunk.lastTimestamp = timestamp;
+    chunk.values.resize(fields.size());
+    chunks.push_back(chunk);
+    chunkOpen = true;
+
+    previousDelta = 0;
+    previousValues.assign(fields.size(), 0);
+    previousLeading.assign(fields.size(), NO_WINDOW);
+    previousTrailing.assign(fields.size(), 0);
+  }
+
+  TimeSeriesChunk& chunk = chunks.back();
+
+  if (chunk.count == 0) {
+    // First sample of the chunk is stored in full
+    chunk.timestamps.write(static_cast<uint32_t>(timestamp), 32);
+    for (size_t i = 0; i < fields.size(); i++) {
+      uint32_t bits = floatBits(values[i]);
+      chunk.values[i].write(bits, 32);
+      previousValues[i] = bits;
+    }
+  } else {
+    // Timestamps store the change in the delta between samples
+    int64_t delta = static_cast<int64_t>(timestamp) - chunk.lastTimestamp;
+    int64_t deltaOfDelta = delta - previousDelta;
+    previousDelta = delta;
+
+    if (deltaOfDelta == 0) {
+      chunk.timestamps.write(0, 1);
+    } else if (deltaOfDelta >= -63 && deltaOfDelta <= 64) {
+      chunk.timestamps.write(0x2, 2);
+      chunk.timestamps.write(static_cast<uint64_t>(deltaOfDelta + 63), 7);
+    } else if (deltaOfDelta >= -255 && deltaOfDelta <= 256) {
+      chunk.timestamps.write(0x6, 3);
+      chunk.timestamps.write(static_cast<uint64_t>(deltaOfDelta + 255), 9);
+    } else if (deltaOfDelta >= -2047 && deltaOfDelta <= 2048) {
+      chunk.timestamps.write(0xE, 4);
+      chunk.timestamps.write(static_cast<uint64_t>(deltaOfDelta + 2047), 12);
+    } else {
+      chunk.timestamps.write(0xF, 4);
+      chunk.timestamps.write(static_cast<uint64_t>(deltaOfDelta), 64);
+    }
+
+    // Values store the meaningful bits of the XOR with the previous value
+    for (size_t i = 0; i < fields.size(); i++) {
+      uint32_t bits = floatBits(values[i]);
+      uint32_t xored = bits ^ previousValues[i];
+      previousValues[i] = bits;
+      BitWriter& writer = chunk.values[i];
+
+      if (xored == 0) {
+        writer.write(0, 1);
+        continue;
+      }
+
+      uint32_t leading = std::min<uint32_t>(leadingZeros(xored), 31);
+      uint32_t trailing = trailingZeros(xored);
+
+      if (previousLeading[i] != NO_WINDOW && leading >= previousLeading[i] &&
+          trailing >= previousTrailing[i]) {
+        // Meaningful bits fit within the previous window
+        uint32_t meaningful = 32 - previousLeading[i] - previousTrailing[i];
+        writer.write(0x2, 2);
+        writer.write(xored >> previousTrailing[i], meaningful);
+      } else {
+        uint32_t meaningful = 32 - leading - trailing;
+        writer.write(0x3, 2);
+        writer.write(leading, 5);
+        writer.write(meaningful - 1, 5);
+        writer.write(xored >> trailing, meaningful);
+        previousLeading[i] = leading;
+        previousTrailing[i] = trailing;
+      }
+    }
+  }
+
+  chunk.lastTimestamp = timestamp;
+  chunk.count++;
+}
+
+void TimeSeriesCollection::appendObject(const DataObject& object) {
+  const EntryMap& entries = object.getEntries();
+
+  EntryMap::const_iterator timestamp = entries.find(TIMESTAMP_KEY);
+  if (timestamp == entries.end() || timestamp->second.asInt() == nullptr) {
+    throw std::invalid_argument("Time series object is missing its INTEGER "
+                                "timestamp");
+  }
+
+  vector<float> values(fields.size(), std::numeric_limits<float>::quiet_NaN());
+  for (size_t i = 0; i < fields.size(); i++) {
+    EntryMap::const_iterator value = entries.find(fields[i]);
+    if (value != entries.end() && value->second.asFloat() != nullptr) {
+      values[i] = *value->second.asFloat();
+    }
+  }
+
+  append(*timestamp->second.asInt(), values);
+}
+
+size_t TimeSeriesCollection::getSampleCount() const {
+  size_t count = 0;
+  for (const TimeSeriesChunk& chunk : chunks) {
+    count += chunk.count;
+  }
+  return count;
+}
+
+size_t TimeSeriesCollection::getEncodedSize() const {
+  size_t size = 0;
+  for (const TimeSeriesChunk& chunk : chunks) {
+    size += chunk.timestamps.getBytes().size();
+    for (const BitWriter& values : chunk.values) {
+      size += values.getBytes().size();
+    }
+  }
+  return size;
+}
+
+void TimeSeriesCollection::decodeChunk(
+    const TimeSeriesChunk& chunk, const vector<size_t>& selected,
+    const std::function<void(int32_t, const vector<float>&)>& visitor) const {
+  BitReader timestamps(chunk.timestamps.getBytes());
+  vector<BitReader> readers;
+  readers.reserve(selected.size());
+  for (size_t field : selected) {
+    readers.push_back(BitReader(chunk.values[field].getBytes()));
+  }
+
+  int64_t timestamp = 0;
+  int64_t delta = 0;
+  vector<uint32_t> bits(selected.size(), 0);
+  vector<uint32_t> leading(selected.size(), 0);
+  vector<uint32_t> trailing(selected.size(), 0);
+  vector<float> values(selected.size(), 0.0f);
+
+  for (uint32_t sample = 0; sample < chunk.count; sample++) {
+    if (sample == 0) {
+      timestamp = static_cast<int32_t>(timestamps.read(32));
+      for (size_t i = 0; i < readers.size(); i++) {
+        bits[i] = static_cast<uint32_t>(readers[i].read(32));
+      }
+    } else {
+      int64_t deltaOfDelta;
+      if (timestamps.read(1) == 0) {
+        deltaOfDelta = 0;
+      } else if (timestamps.read(1) == 0) {
+        deltaOfDelta = static_cast<int64_t>(timestamps.read(7)) - 63;
+      } else if (timestamps.read(1) == 0) {
+        deltaOfDelta = static_cast<int64_t>(timestamps.read(9)) - 255;
+      } else if (timestamps.read(1) == 0) {
+        deltaOfDelta = static_cast<int64_t>(timestamps.read(12)) - 2047;
+      } else {
+        deltaOfDelta = static_cast<int64_t>(timestamps.read(64));
+      }
+      delta += deltaOfDelta;
+      timestamp += delta;
+
+      for (size_t i = 0; i < readers.size(); i++) {
+        BitReader& reader = readers[i];
+        if (reader.read(1) == 0) {
+          continue;
+        }
+
+        if (reader.read(1) == 1) {
+          leading[i] = static_cast<uint32_t>(reader.read(5));
+          uint32_t meaningful = static_cast<uint32_t>(reader.read(5)) + 1;
+          trailing[i] = 32 - leading[i] - meaningful;
+        }
+
+        uint32_t meaningful = 32 - leading[i] - trailing[i];
+        bits[i] ^= static_cast<uint32_t>(reader.read(meaningful)) << trailing[i];
+      }
+    }
+
+    for (size_t i = 0; i < readers.size(); i++) {
+      values[i] = bitsFloat(bits[i]);
+    }
+    visitor(static_cast<int32_t>(timestamp), values);
+  }
+}
+
+void TimeSeriesCollection::scan(
+    int32_t from, int32_t to,
+    const std::function<void(int32_t, const vector<float>&)>& visitor) const {
+  vector<size_t> selected;
+  for (size_t i = 0; i < fields.size(); i++) {
+    selected.push_back(i);
+  }
+
+  for (const TimeSeriesChunk& chunk : chunks) {
+    // Chunks are in timestamp order, stop after the range
+    if (chunk.firstTimestamp > to) {
+      break;
+    }
+    if (chunk.lastTimestamp < from) {
+      continue;
+    }
+
+    decodeChunk(chunk, selected,
+                [&](int32_t timestamp, const vector<float>& values) {
+                  if (timestamp >= from && timestamp <= to) {
+                    visitor(timestamp, values);
+                  }
+                });
+  }
+}
+
+vector<TimeSeriesBucket> TimeSeriesCollection::downsample(
+    const string& field, int32_t from, int32_t to, int32_t bucketWidth) const {
+  if (bucketWidth <= 0) {
+    throw std::invalid_argument("Time series bucket width must be positive");
+  }
+
+  vector<size_t> selected(1, getFieldIndex(field));
+  vector<TimeSeriesBucket> buckets;
+
+  for (const TimeSeriesChunk& chunk : chunks) {
+    if (chunk.firstTimestamp > to) {
+      break;
+    }
+    if (chunk.lastTimestamp < from) {
+      continue;
+    }
+
+    decodeChunk(
+        chunk, selected, [&](int32_t timestamp, const vector<float>& values) {
+          float value = values[0];
+          if (timestamp < from || timestamp > to || std::isnan(value)) {
+            return;
+          }
+
+          int64_t index =
+              (static_cast<int64_t>(timestamp) - from) / bucketWidth;
+          int32_t start = static_cast<int32_t>(from + index * bucketWidth);
+
+          if (buckets.empty() || buckets.back().start != start) {
+            TimeSeriesBucket bucket;
+            bucket.start = start;
+            bucket.count = 0;
+            bucket.min = value;
+            bucket.max = value;
+            bucket.sum = 0;
+            bucket.first = value;
+            bucket.last = value;
+            buckets.push_back(bucket);
+          }
+
+          TimeSeriesBucket& bucket = buckets.back();
+          bucket.count++;
+          bucket.min = std::min(bucket.min, value);
+          bucket.max = std::max(bucket.max, value);
+          bucket.sum += value;
+          bucket.last = value;
+        });
+  }
+
+  return buckets;
+}
+
+/// <summary>
+/// Serializes a bit stream writing its length followed by its bytes
+/// </summary>
+static void serializeBits(ostream& stream, const BitWriter& bits) {
+  uint64_t length = bits.getLength();
+  stream.write(reinterpret_cast<const char*>(&length), sizeof(length));
+  stream.write(reinterpret_cast<const char*>(bits.getBytes().data()),
+               bits.getBytes().size());
+}
+
+/// <summary>
+/// Deserializes a bit stream by replaying its bytes into a writer
+/// </summary>
+static void deserializeBits(ifstream& stream, BitWriter& bits) {
+  uint64_t length = 0;
+  stream.read(reinterpret_cast<char*>(&length), sizeof(length));
+
+  vector<uint8_t> bytes(static_cast<size_t>((length + 7) / 8));
+  stream.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+  if (stream.fail()) {
+    return;
+  }
+
+  for (size_t i = 0; i < bytes.size(); i++) {
+    uint32_t count = i + 1 < bytes.size()
+                         ? 8
+                         : static_cast<uint32_t>(length - 8 * (bytes.size() - 1));
+    bits.write(static_cast<uint64_t>(bytes[i] >> (8 - count)), count);
+  }
+}
+
+void TimeSeriesCollection::load() {
+  struct stat stats;
+
+  // Get the file path stats
+  if (stat(path.c_str(), &stats) != 0) {
+    // File doesn't exist, no loading to be done
+    return;
+  }
+
+  // Open binary stream to the file
+  ifstream stream(path, ios::binary);
+
+  if (!stream.is_open()) {
+    throw std::runtime_error("Failed to open stream to time series file");
+  }
+
+  uint32_t magic;
+  uint32_t formatVersion;
+  stream.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+  stream.read(reinterpret_cast<char*>(&formatVersion), sizeof(formatVersion));
+
+  if (stream.fail() || magic != TIME_SERIES_MAGIC ||
+      formatVersion > TIME_SERIES_FORMAT_VERSION) {
+    throw std::runtime_error("Unsupported time series file");
+  }
+
+  // Read the field names
+  uint32_t size;
+  stream.read(reinterpret_cast<char*>(&size), sizeof(size));
+  fields.clear();
+  for (uint32_t i = 0; i < size && !stream.fail(); i++) {
+    string field;
+    deserializeString(stream, field);
+    fields.push_back(field);
+  }
+
+  // Read the chunks
+  stream.read(reinterpret_cast<char*>(&size), sizeof(size));
+  chunks.clear();
+  for (uint32_t i = 0; i < size && !stream.fail(); i++) {
+    TimeSeriesChunk chunk;
+    stream.read(reinterpret_cast<char*>(&chunk.count), sizeof(chunk.count));
+    stream.read(reinterpret_cast<char*>(&chunk.firstTimestamp),
+                sizeof(chunk.firstTimestamp));
+    stream.read(reinterpret_cast<char*>(&chunk.lastTimestamp),
+                sizeof(chunk.lastTimestamp));
+    deserializeBits(stream, chunk.timestamps);
+    chunk.values.resize(fields.size());
+    for (BitWriter& values : chunk.values) {
+      deserializeBits(stream, values);
+    }
+    chunks.push_back(chunk);
+  }
+
+  if (stream.fail()) {
+    throw std::runtime_error("Error while reading time series chunks");
+  }
+
+  // Close the finished stream
+  stream.close();
+
+  // The encoder state is not stored, new samples start a new chunk
+  chunkOpen = false;
+}
+
+void TimeSeriesCollection::save() const {
+  // Publish the file atomically so a crash never leaves a partial file
+  FileStorageBackend storage(path);
+  storage.beginSnapshot();
+  StorageWriteBuffer buffer(storage);
+  ostream stream(&buffer);
+
+  stream.write(reinterpret_cast<const char*>(&TIME_SERIES_MAGIC),
+               sizeof(TIME_SERIES_MAGIC));
+  stream.write(reinterpret_cast<const char*>(&TIME_SERIES_FORMAT_VERSION),
+               sizeof(TIME_SERIES_FORMAT_VERSION));
+
+  // Write the field names
+  uint32_t size = static_cast<uint32_t>(fields.size());
+  stream.write(reinterpret_cast<const char*>(&size), sizeof(size));
+  for (const string& field : fields) {
+    serializeString(stream, field);
+  }
+
+  // Write the chunks
+  size = static_cast<uint32_t>(chunks.size());
+  stream.write(reinterpret_cast<const char*>(&size), sizeof(size));
+  for (const TimeSeriesChunk& chunk : chunks) {
+    stream.write(reinterpret_cast<const char*>(&chunk.count),
+                 sizeof(chunk.count));
+    stream.write(reinterpret_cast<const char*>(&chunk.firstTimestamp),
+                 sizeof(chunk.firstTimestamp));
+    stream.write(reinterpret_cast<const char*>(&chunk.lastTimestamp),
+                 sizeof(chunk.lastTimestamp));
+    serializeBits(stream, chunk.timestamps);
+    for (const BitWriter& values : chunk.values) {
+      serializeBits(stream, values);
+    }
+  }
+
+  if (stream.fail()) {
+    throw std::runtime_error("Error while writing time series chunks");
+  }
+
+  buffer.pubsync();
+  storage.publishSnapshot();
+}
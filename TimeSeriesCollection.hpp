@@ -0,0 +1,263 @@
+#ifndef TIME_SERIES_COLLECTION
+#define TIME_SERIES_COLLECTION 1
+
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "DataObject.hpp"
+
+using std::int32_t;
+using std::int64_t;
+using std::string;
+using std::uint32_t;
+using std::uint64_t;
+using std::uint8_t;
+using std::vector;
+
+/// <summary>
+/// Stream of bits written most significant bit first
+/// </summary>
+class BitWriter {
+ private:
+  /// <summary>
+  /// The written bytes, the last byte may be partially filled
+  /// </summary>
+  vector<uint8_t> bytes;
+  /// <summary>
+  /// The number of bits written
+  /// </summary>
+  uint64_t length;
+
+ public:
+  BitWriter();
+
+  /// <summary>
+  /// Writes the lowest count bits of the provided value
+  /// </summary>
+  /// <param name="value">The value to write</param>
+  /// <param name="count">The number of bits to write (0 to 64)</param>
+  void write(uint64_t value, uint32_t count);
+
+  /// <summary>
+  /// Provides the written bytes
+  /// </summary>
+  const vector<uint8_t>& getBytes() const;
+
+  /// <summary>
+  /// Provides the number of bits written
+  /// </summary>
+  uint64_t getLength() const;
+};
+
+/// <summary>
+/// Reads bits from a stream written by a BitWriter
+/// </summary>
+class BitReader {
+ private:
+  const vector<uint8_t>& bytes;
+  uint64_t position;
+
+ public:
+  BitReader(const vector<uint8_t>& bytes);
+
+  /// <summary>
+  /// Reads count bits from the stream
+  /// </summary>
+  /// <param name="count">The number of bits to read (0 to 64)</param>
+  /// <returns>The bits read</returns>
+  uint64_t read(uint32_t count);
+};
+
+/// <summary>
+/// Block of compressed samples. Timestamps and each field are stored in
+/// separate bit streams so a single field can be decoded on its own
+/// </summary>
+struct TimeSeriesChunk {
+  /// <summary>
+  /// The number of samples in the chunk
+  /// </summary>
+  uint32_t count;
+  /// <summary>
+  /// The timestamp of the first sample
+  /// </summary>
+  int32_t firstTimestamp;
+  /// <summary>
+  /// The timestamp of the last sample
+  /// </summary>
+  int32_t lastTimestamp;
+  /// <summary>
+  /// Delta-of-delta encoded timestamps
+  /// </summary>
+  BitWriter timestamps;
+  /// <summary>
+  /// XOR encoded values for each field
+  /// </summary>
+  vector<BitWriter> values;
+};
+
+/// <summary>
+/// Aggregate of the samples falling within a downsampling bucket
+/// </summary>
+struct TimeSeriesBucket {
+  /// <summary>
+  /// The first timestamp covered by the bucket
+  /// </summary>
+  int32_t start;
+  /// <summary>
+  /// The number of samples in the bucket
+  /// </summary>
+  uint32_t count;
+  float min;
+  float max;
+  double sum;
+  float first;
+  float last;
+
+  /// <summary>
+  /// Provides the mean of the samples in the bucket
+  /// </summary>
+  double mean() const;
+};
+
+/// <summary>
+/// Append-only collection of metric samples, each sample being an
+/// INTEGER timestamp (stored under the "ts" key in object form) and a
+/// fixed set of FLOAT fields.
+///
+/// Samples are compressed into chunks using Gorilla style encoding:
+/// delta-of-delta timestamps and XOR compressed floats. Regularly spaced
+/// timestamps cost a single bit and slowly changing values only a few
+/// bits, compared to the 5 bytes plus key per value of the generic
+/// DataValue serialization.
+/// </summary>
+class TimeSeriesCollection {
+ private:
+  /// <summary>
+  /// File path to where the collection is stored
+  /// </summary>
+  string path;
+  /// <summary>
+  /// Names of the FLOAT fields of each sample
+  /// </summary>
+  vector<string> fields;
+  /// <summary>
+  /// The maximum number of samples stored in a chunk
+  /// </summary>
+  uint32_t chunkSize;
+  /// <summary>
+  /// The compressed chunks, the last chunk is open for appending
+  /// </summary>
+  vector<TimeSeriesChunk> chunks;
+  /// <summary>
+  /// Whether the last chunk can be appended to, chunks that were loaded
+  /// are always closed as their encoder state is not stored
+  /// </summary>
+  bool chunkOpen;
+  /// <summary>
+  /// Encoder state for the open chunk
+  /// </summary>
+  int64_t previousDelta;
+  vector<uint32_t> previousValues;
+  vector<uint32_t> previousLeading;
+  vector<uint32_t> previousTrailing;
+
+  /// <summary>
+  /// Decodes the samples of a chunk, providing the timestamp and the
+  /// values for the selected fields to the visitor
+  /// </summary>
+  void decodeChunk(const TimeSeriesChunk& chunk, const vector<size_t>& selected,
+                   const std::function<void(int32_t, const vector<float>&)>&
+                       visitor) const;
+
+  /// <summary>
+  /// Provides the index of the field with the provided name
+  /// </summary>
+  size_t getFieldIndex(const string& field) const;
+
+ public:
+  /// <summary>
+  /// Key storing the timestamp of samples in object form
+  /// </summary>
+  static const char* const TIMESTAMP_KEY;
+
+  /// <summary>
+  /// Creates a new time series collection for the provided path
+  /// </summary>
+  /// <param name="path">The path to the collection file</param>
+  /// <param name="fields">The names of the FLOAT fields</param>
+  /// <param name="chunkSize">The maximum samples per chunk</param>
+  TimeSeriesCollection(string path, vector<string> fields,
+                       uint32_t chunkSize = 1024);
+
+  /// <summary>
+  /// Deserializes the collection from its file, replacing any current
+  /// samples. The fields stored in the file replace the fields provided
+  /// to the constructor.
+  ///
+  /// If the file does not exist then the default state is applied.
+  /// </summary>
+  void load();
+
+  /// <summary>
+  /// Serializes the collection to its file
+  /// </summary>
+  void save() const;
+
+  /// <summary>
+  /// Provides the names of the FLOAT fields of each sample
+  /// </summary>
+  const vector<string>& getFields() const;
+
+  /// <summary>
+  /// Appends a sample, timestamps must not decrease
+  /// </summary>
+  /// <param name="timestamp">The sample timestamp</param>
+  /// <param name="values">The value for each field</param>
+  void append(int32_t timestamp, const vector<float>& values);
+
+  /// <summary>
+  /// Appends a sample from object form, the timestamp is read from the
+  /// "ts" INTEGER entry and missing fields are stored as NaN
+  /// </summary>
+  /// <param name="object">The sample object</param>
+  void appendObject(const DataObject& object);
+
+  /// <summary>
+  /// Provides the total number of samples
+  /// </summary>
+  size_t getSampleCount() const;
+
+  /// <summary>
+  /// Provides the number of bytes used by the compressed samples
+  /// </summary>
+  size_t getEncodedSize() const;
+
+  /// <summary>
+  /// Visits every sample with a timestamp in the inclusive range, chunks
+  /// outside of the range are skipped without being decoded
+  /// </summary>
+  /// <param name="from">The first timestamp</param>
+  /// <param name="to">The last timestamp</param>
+  /// <param name="visitor">Function provided the timestamp and the
+  /// value of every field</param>
+  void scan(int32_t from, int32_t to,
+            const std::function<void(int32_t, const vector<float>&)>& visitor)
+      const;
+
+  /// <summary>
+  /// Aggregates a single field into fixed width buckets over the
+  /// inclusive range, only the timestamps and the field are decoded.
+  /// Empty buckets are not included and NaN values are skipped
+  /// </summary>
+  /// <param name="field">The field to aggregate</param>
+  /// <param name="from">The first timestamp</param>
+  /// <param name="to">The last timestamp</param>
+  /// <param name="bucketWidth">The width of each bucket</param>
+  /// <returns>The non empty buckets in timestamp order</returns>
+  vector<TimeSeriesBucket> downsample(const string& field, int32_t from,
+                                      int32_t to, int32_t bucketWidth) const;
+};
+
+#endif
@@ -0,0 +1,603 @@
+#include "WarmImage.hpp"
+
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "ContentHash.hpp"
+#include "DataSchema.hpp"
+#include "FrontCodedBlock.hpp"
+
+using std::int32_t;
+using std::map;
+using std::string;
+using std::uint32_t;
+using std::uint64_t;
+using std::uint8_t;
+using std::vector;
+
+// The image is written using the native byte order, like the collection
+// file format it assumes a little endian host. Every record has a fixed
+// size without implicit padding and is copied in and out of the mapping
+// so the mapping needs no particular alignment
+
+/// <summary>
+/// Magic value written at the start of warm images ("DOWI")
+/// </summary>
+static const uint32_t IMAGE_MAGIC = 0x49574F44;
+
+/// <summary>
+/// Warm image format versions
+///   1: Initial format
+/// </summary>
+static const uint32_t IMAGE_VERSION = 1;
+
+/// <summary>
+/// Size objects are encoded in before being appended to the image
+/// </summary>
+static const size_t WRITE_CHUNK_SIZE = 1 << 20;
+
+/// <summary>
+/// Header at the start of the image. The sections follow in the order
+/// of their offsets, the metadata sections from the index up to the
+/// data are covered by the hash
+/// </summary>
+struct ImageHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t nextId;
+  uint32_t objectCount;
+  uint32_t keyCount;
+  uint32_t shapeCount;
+  uint64_t entryCount;
+  uint64_t indexOffset;
+  uint64_t keysOffset;
+  uint64_t namesOffset;
+  uint64_t shapesOffset;
+  uint64_t shapeKeysOffset;
+  uint64_t dataOffset;
+  uint64_t dataSize;
+  uint64_t metadataHash;
+};
+
+/// <summary>
+/// Entry of the ID index, sorted by ID
+/// </summary>
+struct ImageIndexRecord {
+  uint32_t id;
+  uint32_t version;
+  uint32_t shape;
+  uint32_t size;
+  uint64_t offset;
+};
+
+/// <summary>
+/// Entry of the key dictionary, sorted by key. The key ID is the
+/// position within the dictionary
+/// </summary>
+struct ImageKeyRecord {
+  uint64_t nameOffset;
+  uint32_t nameLength;
+  uint32_t objects;
+  uint32_t strings;
+  uint32_t integers;
+  uint32_t floats;
+  int32_t minInteger;
+  int32_t maxInteger;
+  uint32_t reserved;
+};
+
+/// <summary>
+/// Entry of the shape table, the keys of the shape are stored as an
+/// ascending run of key IDs
+/// </summary>
+struct ImageShapeRecord {
+  uint64_t keysOffset;
+  uint32_t keyCount;
+  uint32_t objects;
+};
+
+static_assert(sizeof(ImageHeader) == 96, "Image header must not be padded");
+static_assert(sizeof(ImageIndexRecord) == 24,
+              "Index record must not be padded");
+static_assert(sizeof(ImageKeyRecord) == 40, "Key record must not be padded");
+static_assert(sizeof(ImageShapeRecord) == 16,
+              "Shape record must not be padded");
+
+/// <summary>
+/// Rounds the offset up to a multiple of 8
+/// </summary>
+static uint64_t align8(uint64_t offset) {
+  return (offset + 7) & ~static_cast<uint64_t>(7);
+}
+
+/// <summary>
+/// Provides the offset of the record at the position within a section
+/// </summary>
+static uint64_t recordOffset(uint64_t section, uint64_t position,
+                             size_t recordSize) {
+  return section + position * recordSize;
+}
+
+/// <summary>
+/// Copies a record out of the image
+/// </summary>
+template <typename T>
+static T readRecord(const uint8_t* data, uint64_t offset) {
+  T record;
+  std::memcpy(&record, data + offset, sizeof(T));
+  return record;
+}
+
+/// <summary>
+/// Key dictionary entry gathered while writing an image
+/// </summary>
+struct ImageKeyBuild {
+  uint32_t id;
+  WarmImageKeyStats stats;
+};
+
+WarmImage::WarmImage(string path)
+    : storage(new MmapStorageBackend(path)),
+      data(nullptr),
+      size(0),
+      nextId(0),
+      objectCount(0),
+      keyCount(0),
+      shapeCount(0),
+      entryCount(0),
+      indexOffset(0),
+      keysOffset(0),
+      namesOffset(0),
+      shapesOffset(0),
+      shapeKeysOffset(0),
+      dataOffset(0) {
+  // The image is only mapped here, reads use the mapping in place
+  data = storage->map();
+  size = storage->size();
+  if (data == nullptr || size < sizeof(ImageHeader)) {
+    throw std::runtime_error("Warm image is missing or truncated");
+  }
+
+  ImageHeader header = readRecord<ImageHeader>(data, 0);
+  if (header.magic != IMAGE_MAGIC || header.version != IMAGE_VERSION) {
+    throw std::runtime_error("Unsupported warm image format");
+  }
+
+  // Sections must be in order and the counts must fit their sections
+  if (header.indexOffset < sizeof(ImageHeader) ||
+      header.keysOffset < recordOffset(header.indexOffset, header.objectCount,
+                                       sizeof(ImageIndexRecord)) ||
+      header.namesOffset < recordOffset(header.keysOffset, header.keyCount,
+                                        sizeof(ImageKeyRecord)) ||
+      header.shapesOffset < header.namesOffset ||
+      header.shapeKeysOffset < recordOffset(header.shapesOffset,
+                                            header.shapeCount,
+                                            sizeof(ImageShapeRecord)) ||
+      header.dataOffset < header.shapeKeysOffset ||
+      header.dataOffset > size || size - header.dataOffset != header.dataSize) {
+    throw std::runtime_error("Warm image is truncated");
+  }
+
+  if (hashBytes(data + header.indexOffset,
+                header.dataOffset - header.indexOffset) !=
+      header.metadataHash) {
+    throw std::runtime_error("Warm image metadata is corrupt");
+  }
+
+  nextId = header.nextId;
+  objectCount = header.objectCount;
+  keyCount = header.keyCount;
+  shapeCount = header.shapeCount;
+  entryCount = header.entryCount;
+  indexOffset = header.indexOffset;
+  keysOffset = header.keysOffset;
+  namesOffset = header.namesOffset;
+  shapesOffset = header.shapesOffset;
+  shapeKeysOffset = header.shapeKeysOffset;
+  dataOffset = header.dataOffset;
+}
+
+void WarmImage::write(DataObjectCollection& collection, const string& path) {
+  std::lock_guard<std::mutex> guard(collection.structLock);
+  const vector<DataObject>& objects = collection.objects;
+
+  // Gather the key dictionary and its statistics, IDs are given in key
+  // order once every key is known
+  map<string, ImageKeyBuild> keys;
+  uint64_t entryCount = 0;
+  for (const DataObject& object : objects) {
+    for (const std::pair<const string, DataValue>& entry :
+         object.getEntries()) {
+      ImageKeyBuild& key = keys[entry.first];
+      WarmImageKeyStats& stats = key.stats;
+      stats.objects++;
+      entryCount++;
+
+      switch (entry.second.getType()) {
+        case DataValue::STRING:
+          stats.strings++;
+          break;
+        case DataValue::INTEGER: {
+          int32_t value = *entry.second.asInt();
+          if (stats.integers == 0 || value < stats.minInteger) {
+            stats.minInteger = value;
+          }
+          if (stats.integers == 0 || value > stats.maxInteger) {
+            stats.maxInteger = value;
+          }
+          stats.integers++;
+          break;
+        }
+        case DataValue::FLOAT:
+          stats.floats++;
+          break;
+      }
+    }
+  }
+
+  uint32_t keyId = 0;
+  uint64_t nameBytes = 0;
+  for (std::pair<const string, ImageKeyBuild>& key : keys) {
+    key.second.id = keyId++;
+    nameBytes += key.first.size();
+  }
+
+  // Objects with the same keys share a shape, entries are ordered by key
+  // so the key IDs of a shape are ascending
+  map<vector<uint32_t>, uint32_t> shapeIds;
+  vector<const vector<uint32_t>*> shapes;
+  vector<uint32_t> shapeObjects;
+  vector<uint32_t> objectShapes;
+  objectShapes.reserve(objects.size());
+  vector<uint32_t> objectSizes;
+  objectSizes.reserve(objects.size());
+  uint64_t shapeKeyCount = 0;
+  uint64_t dataSize = 0;
+
+  vector<uint32_t> shapeKeys;
+  for (const DataObject& object : objects) {
+    shapeKeys.clear();
+    for (const std::pair<const string, DataValue>& entry :
+         object.getEntries()) {
+      shapeKeys.push_back(keys.find(entry.first)->second.id);
+    }
+
+    std::pair<map<vector<uint32_t>, uint32_t>::iterator, bool> inserted =
+        shapeIds.emplace(shapeKeys, static_cast<uint32_t>(shapes.size()));
+    if (inserted.second) {
+      shapes.push_back(&inserted.first->first);
+      shapeObjects.push_back(0);
+      shapeKeyCount += shapeKeys.size();
+    }
+    shapeObjects[inserted.first->second]++;
+    objectShapes.push_back(inserted.first->second);
+    objectSizes.push_back(static_cast<uint32_t>(object.getEncodedSize()));
+    dataSize += objectSizes.back();
+  }
+
+  ImageHeader header = {};
+  header.magic = IMAGE_MAGIC;
+  header.version = IMAGE_VERSION;
+  header.nextId = collection.nextId;
+  header.objectCount = static_cast<uint32_t>(objects.size());
+  header.keyCount = static_cast<uint32_t>(keys.size());
+  header.shapeCount = static_cast<uint32_t>(shapes.size());
+  header.entryCount = entryCount;
+  header.indexOffset = sizeof(ImageHeader);
+  header.keysOffset =
+      header.indexOffset + objects.size() * sizeof(ImageIndexRecord);
+  header.namesOffset = header.keysOffset + keys.size() * sizeof(ImageKeyRecord);
+  header.shapesOffset = align8(header.namesOffset + nameBytes);
+  header.shapeKeysOffset =
+      header.shapesOffset + shapes.size() * sizeof(ImageShapeRecord);
+  header.dataOffset =
+      align8(header.shapeKeysOffset + shapeKeyCount * sizeof(uint32_t));
+  header.dataSize = dataSize;
+
+  // Lay out the metadata sections, offsets are relative to the start
+  // of the image
+  vector<uint8_t> metadata(
+      static_cast<size_t>(header.dataOffset - header.indexOffset), 0);
+  auto at = [&](uint64_t offset) {
+    return metadata.data() + (offset - header.indexOffset);
+  };
+
+  uint64_t objectOffset = header.dataOffset;
+  for (size_t i = 0; i < objects.size(); i++) {
+    ImageIndexRecord record;
+    record.id = objects[i].getId();
+    record.version = objects[i].getVersion();
+    record.shape = objectShapes[i];
+    record.size = objectSizes[i];
+    record.offset = objectOffset;
+    std::memcpy(at(header.indexOffset + i * sizeof(ImageIndexRecord)), &record,
+                sizeof(record));
+    objectOffset += record.size;
+  }
+
+  uint64_t nameOffset = header.namesOffset;
+  for (const std::pair<const string, ImageKeyBuild>& key : keys) {
+    ImageKeyRecord record = {};
+    record.nameOffset = nameOffset;
+    record.nameLength = static_cast<uint32_t>(key.first.size());
+    record.objects = key.second.stats.objects;
+    record.strings = key.second.stats.strings;
+    record.integers = key.second.stats.integers;
+    record.floats = key.second.stats.floats;
+    record.minInteger = key.second.stats.minInteger;
+    record.maxInteger = key.second.stats.maxInteger;
+    std::memcpy(at(header.keysOffset + key.second.id * sizeof(ImageKeyRecord)),
+                &record, sizeof(record));
+    std::memcpy(at(nameOffset), key.first.data(), key.first.size());
+    nameOffset += key.first.size();
+  }
+
+  uint64_t shapeKeysOffset = header.shapeKeysOffset;
+  for (size_t i = 0; i < shapes.size(); i++) {
+    ImageShapeRecord record;
+    record.keysOffset = shapeKeysOffset;
+    record.keyCount = static_cast<uint32_t>(shapes[i]->size());
+    record.objects = shapeObjects[i];
+    std::memcpy(at(header.shapesOffset + i * sizeof(ImageShapeRecord)), &record,
+                sizeof(record));
+    if (!shapes[i]->empty()) {
+      std::memcpy(at(shapeKeysOffset), shapes[i]->data(),
+                  shapes[i]->size() * sizeof(uint32_t));
+    }
+    shapeKeysOffset += shapes[i]->size() * sizeof(uint32_t);
+  }
+
+  header.metadataHash = hashBytes(metadata.data(), metadata.size());
+
+  // Published atomically so readers mapping the previous image are
+  // unaffected
+  FileStorageBackend storage(path);
+  storage.beginSnapshot();
+  storage.append(&header, sizeof(header));
+  storage.append(metadata.data(), metadata.size());
+
+  vector<uint8_t> chunk;
+  chunk.reserve(WRITE_CHUNK_SIZE);
+  for (const DataObject& object : objects) {
+    object.encodeTo(chunk);
+    if (chunk.size() >= WRITE_CHUNK_SIZE) {
+      storage.append(chunk.data(), chunk.size());
+      chunk.clear();
+    }
+  }
+  if (!chunk.empty()) {
+    storage.append(chunk.data(), chunk.size());
+  }
+
+  storage.publishSnapshot();
+}
+
+void WarmImage::restore(DataObjectCollection& collection) const {
+  std::lock_guard<std::mutex> guard(collection.structLock);
+
+  if (collection.database != nullptr) {
+    throw std::invalid_argument(
+        "Hosted collections are restored by their database");
+  }
+  if (collection.snapshot != nullptr) {
+    throw std::runtime_error("A snapshot of the collection is in progress");
+  }
+
+  // The index is ordered by ID like the objects of a collection
+  vector<DataObject> objects(objectCount);
+  for (uint32_t position = 0; position < objectCount; position++) {
+    uint32_t encodedSize;
+    const uint8_t* encoded = getEncoded(position, encodedSize);
+    objects[position].decodeFrom(encoded, encodedSize);
+  }
+
+  collection.objects.swap(objects);
+  collection.nextId = nextId;
+
+  if (collection.schemaInference) {
+    collection.schemaReport.reset(
+        new DataSchemaReport(DataSchema::infer(collection.objects)));
+  }
+}
+
+bool WarmImage::findObject(uint32_t id, uint32_t& position) const {
+  uint32_t low = 0;
+  uint32_t high = objectCount;
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    uint32_t middleId = readRecord<uint32_t>(
+        data, recordOffset(indexOffset, middle, sizeof(ImageIndexRecord)));
+    if (middleId < id) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  if (low == objectCount ||
+      readRecord<uint32_t>(data, recordOffset(indexOffset, low,
+                                              sizeof(ImageIndexRecord))) !=
+          id) {
+    return false;
+  }
+  position = low;
+  return true;
+}
+
+string WarmImage::getKeyName(uint32_t keyId) const {
+  ImageKeyRecord record = readRecord<ImageKeyRecord>(
+      data, recordOffset(keysOffset, keyId, sizeof(ImageKeyRecord)));
+  if (record.nameOffset < namesOffset ||
+      record.nameOffset + record.nameLength > shapesOffset) {
+    throw std::runtime_error("Warm image key is out of bounds");
+  }
+  return string(reinterpret_cast<const char*>(data + record.nameOffset),
+                record.nameLength);
+}
+
+bool WarmImage::findKey(const string& key, uint32_t& keyId) const {
+  uint32_t low = 0;
+  uint32_t high = keyCount;
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    ImageKeyRecord record = readRecord<ImageKeyRecord>(
+        data, recordOffset(keysOffset, middle, sizeof(ImageKeyRecord)));
+    if (record.nameOffset < namesOffset ||
+        record.nameOffset + record.nameLength > shapesOffset) {
+      throw std::runtime_error("Warm image key is out of bounds");
+    }
+
+    int order = key.compare(
+        0, key.size(), reinterpret_cast<const char*>(data + record.nameOffset),
+        record.nameLength);
+    if (order == 0) {
+      keyId = middle;
+      return true;
+    }
+    if (order > 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return false;
+}
+
+const uint8_t* WarmImage::getEncoded(uint32_t position,
+                                     uint32_t& encodedSize) const {
+  ImageIndexRecord record = readRecord<ImageIndexRecord>(
+      data, recordOffset(indexOffset, position, sizeof(ImageIndexRecord)));
+  if (record.offset < dataOffset || record.offset > size ||
+      size - record.offset < record.size) {
+    throw std::runtime_error("Warm image object is out of bounds");
+  }
+
+  encodedSize = record.size;
+  return data + record.offset;
+}
+
+uint32_t WarmImage::getNextId() const {
+  return nextId;
+}
+
+size_t WarmImage::getObjectCount() const {
+  return objectCount;
+}
+
+uint64_t WarmImage::getEntryCount() const {
+  return entryCount;
+}
+
+bool WarmImage::getObject(uint32_t id, DataObject& out) const {
+  uint32_t position;
+  if (!findObject(id, position)) {
+    return false;
+  }
+
+  uint32_t encodedSize;
+  const uint8_t* encoded = getEncoded(position, encodedSize);
+  out.decodeFrom(encoded, encodedSize);
+  return true;
+}
+
+bool WarmImage::getEntry(uint32_t id, const string& key,
+                         DataValue& out) const {
+  uint32_t position;
+  if (!findObject(id, position)) {
+    return false;
+  }
+
+  uint32_t encodedSize;
+  const uint8_t* encoded = getEncoded(position, encodedSize);
+  size_t blockSize;
+  const uint8_t* block =
+      DataObject::getEncodedBlock(encoded, encodedSize, blockSize);
+
+  FrontCodedBlockReader reader(block, blockSize);
+  return reader.find(key, out);
+}
+
+vector<string> WarmImage::getKeys() const {
+  vector<string> keys;
+  keys.reserve(keyCount);
+  for (uint32_t keyId = 0; keyId < keyCount; keyId++) {
+    keys.push_back(getKeyName(keyId));
+  }
+  return keys;
+}
+
+bool WarmImage::getKeyStats(const string& key, WarmImageKeyStats& out) const {
+  uint32_t keyId;
+  if (!findKey(key, keyId)) {
+    return false;
+  }
+
+  ImageKeyRecord record = readRecord<ImageKeyRecord>(
+      data, recordOffset(keysOffset, keyId, sizeof(ImageKeyRecord)));
+  out.objects = record.objects;
+  out.strings = record.strings;
+  out.integers = record.integers;
+  out.floats = record.floats;
+  out.minInteger = record.minInteger;
+  out.maxInteger = record.maxInteger;
+  return true;
+}
+
+size_t WarmImage::getShapeCount() const {
+  return shapeCount;
+}
+
+vector<string> WarmImage::getShapeKeys(uint32_t shape) const {
+  if (shape >= shapeCount) {
+    throw std::out_of_range("Warm image shape does not exist");
+  }
+
+  ImageShapeRecord record = readRecord<ImageShapeRecord>(
+      data, recordOffset(shapesOffset, shape, sizeof(ImageShapeRecord)));
+  if (record.keysOffset < shapeKeysOffset ||
+      record.keysOffset + static_cast<uint64_t>(record.keyCount) *
+                              sizeof(uint32_t) >
+          dataOffset) {
+    throw std::runtime_error("Warm image shape is out of bounds");
+  }
+
+  vector<string> keys;
+  keys.reserve(record.keyCount);
+  for (uint32_t i = 0; i < record.keyCount; i++) {
+    uint32_t keyId = readRecord<uint32_t>(
+        data, recordOffset(record.keysOffset, i, sizeof(uint32_t)));
+    if (keyId >= keyCount) {
+      throw std::runtime_error("Warm image shape is out of bounds");
+    }
+    keys.push_back(getKeyName(keyId));
+  }
+  return keys;
+}
+
+uint32_t WarmImage::getShapeObjectCount(uint32_t shape) const {
+  if (shape >= shapeCount) {
+    throw std::out_of_range("Warm image shape does not exist");
+  }
+
+  return readRecord<ImageShapeRecord>(
+             data, recordOffset(shapesOffset, shape, sizeof(ImageShapeRecord)))
+      .objects;
+}
+
+bool WarmImage::getObjectShape(uint32_t id, uint32_t& shape) const {
+  uint32_t position;
+  if (!findObject(id, position)) {
+    return false;
+  }
+
+  shape = readRecord<ImageIndexRecord>(
+              data,
+              recordOffset(indexOffset, position, sizeof(ImageIndexRecord)))
+              .shape;
+  return true;
+}
@@ -0,0 +1,206 @@
+#ifndef WARM_IMAGE
+#define WARM_IMAGE 1
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "DataObject.hpp"
+#include "StorageBackend.hpp"
+
+using std::int32_t;
+using std::string;
+using std::uint32_t;
+using std::uint64_t;
+using std::vector;
+
+/// <summary>
+/// Statistics of a key across every object of a warm image
+/// </summary>
+struct WarmImageKeyStats {
+  /// <summary>
+  /// The number of objects with the key
+  /// </summary>
+  uint32_t objects;
+  /// <summary>
+  /// The number of values of each type
+  /// </summary>
+  uint32_t strings;
+  uint32_t integers;
+  uint32_t floats;
+  /// <summary>
+  /// The range of the integer values, only valid when integers is not 0
+  /// </summary>
+  int32_t minInteger;
+  int32_t maxInteger;
+};
+
+/// <summary>
+/// Read only image of a DataObjectCollection that a restarted process
+/// serves reads from straight away. The image is memory mapped and
+/// used in place, nothing is parsed or rebuilt when it is opened.
+///
+/// Alongside the encoded objects the image stores an ID index, a
+/// dictionary of every key with its statistics, and the distinct
+/// shapes (sets of keys) of the objects. Every reference within the
+/// image is a file offset so the image can be mapped at any address.
+///
+/// Reads are served by the image itself, and restore decodes the whole
+/// image into a collection to open the collection from the image.
+///
+/// The image is never modified once written, so reads are thread safe
+/// </summary>
+class WarmImage {
+ private:
+  /// <summary>
+  /// The mapped image file
+  /// </summary>
+  std::unique_ptr<MmapStorageBackend> storage;
+  /// <summary>
+  /// The start of the mapping
+  /// </summary>
+  const uint8_t* data;
+  /// <summary>
+  /// The size of the mapping
+  /// </summary>
+  uint64_t size;
+
+  uint32_t nextId;
+  uint32_t objectCount;
+  uint32_t keyCount;
+  uint32_t shapeCount;
+  uint64_t entryCount;
+  /// <summary>
+  /// Offsets of the image sections
+  /// </summary>
+  uint64_t indexOffset;
+  uint64_t keysOffset;
+  uint64_t namesOffset;
+  uint64_t shapesOffset;
+  uint64_t shapeKeysOffset;
+  uint64_t dataOffset;
+
+  /// <summary>
+  /// Finds the index position of the object with the provided ID
+  /// </summary>
+  /// <returns>Whether the object exists</returns>
+  bool findObject(uint32_t id, uint32_t& position) const;
+
+  /// <summary>
+  /// Finds the key ID of the provided key
+  /// </summary>
+  /// <returns>Whether the key exists</returns>
+  bool findKey(const string& key, uint32_t& keyId) const;
+
+  /// <summary>
+  /// Provides the key with the provided key ID
+  /// </summary>
+  string getKeyName(uint32_t keyId) const;
+
+  /// <summary>
+  /// Provides the encoded object at the index position, checking it
+  /// lies within the image
+  /// </summary>
+  const uint8_t* getEncoded(uint32_t position, uint32_t& encodedSize) const;
+
+ public:
+  /// <summary>
+  /// Opens and validates the image at the provided path
+  /// </summary>
+  /// <param name="path">The path to the image file</param>
+  WarmImage(string path);
+
+  /// <summary>
+  /// Writes an image of the collection to the provided path. The image
+  /// is published atomically so an open image is never overwritten, and
+  /// the collection is locked while it is written so the image is
+  /// consistent
+  /// </summary>
+  /// <param name="collection">The collection to write</param>
+  /// <param name="path">The path to the image file</param>
+  static void write(DataObjectCollection& collection,
+                    const string& path);
+
+  /// <summary>
+  /// Replaces the objects and next ID of the collection with those of
+  /// the image, as load does with the collection file. Collections
+  /// hosted by a Database and collections with a snapshot in progress
+  /// can't be restored
+  /// </summary>
+  /// <param name="collection">The collection to restore</param>
+  void restore(DataObjectCollection& collection) const;
+
+  /// <summary>
+  /// Provides the next ID of the collection
+  /// </summary>
+  uint32_t getNextId() const;
+
+  /// <summary>
+  /// Provides the number of objects
+  /// </summary>
+  size_t getObjectCount() const;
+
+  /// <summary>
+  /// Provides the number of entries across every object
+  /// </summary>
+  uint64_t getEntryCount() const;
+
+  /// <summary>
+  /// Decodes the object with the provided ID
+  /// </summary>
+  /// <param name="id">The ID of the object</param>
+  /// <param name="out">The object to decode into</param>
+  /// <returns>Whether the object exists</returns>
+  bool getObject(uint32_t id, DataObject& out) const;
+
+  /// <summary>
+  /// Provides a single entry of an object without decoding the rest of
+  /// the object
+  /// </summary>
+  /// <param name="id">The ID of the object</param>
+  /// <param name="key">The key of the entry</param>
+  /// <param name="out">The value of the entry</param>
+  /// <returns>Whether the object and entry exist</returns>
+  bool getEntry(uint32_t id, const string& key, DataValue& out) const;
+
+  /// <summary>
+  /// Provides every key in the image in order
+  /// </summary>
+  vector<string> getKeys() const;
+
+  /// <summary>
+  /// Provides the statistics of a key
+  /// </summary>
+  /// <param name="key">The key</param>
+  /// <param name="out">The statistics of the key</param>
+  /// <returns>Whether any object has the key</returns>
+  bool getKeyStats(const string& key, WarmImageKeyStats& out) const;
+
+  /// <summary>
+  /// Provides the number of distinct object shapes
+  /// </summary>
+  size_t getShapeCount() const;
+
+  /// <summary>
+  /// Provides the keys of a shape in order
+  /// </summary>
+  /// <param name="shape">The shape, less than getShapeCount</param>
+  vector<string> getShapeKeys(uint32_t shape) const;
+
+  /// <summary>
+  /// Provides the number of objects with a shape
+  /// </summary>
+  /// <param name="shape">The shape, less than getShapeCount</param>
+  uint32_t getShapeObjectCount(uint32_t shape) const;
+
+  /// <summary>
+  /// Provides the shape of the object with the provided ID
+  /// </summary>
+  /// <param name="id">The ID of the object</param>
+  /// <param name="shape">The shape of the object</param>
+  /// <returns>Whether the object exists</returns>
+  bool getObjectShape(uint32_t id, uint32_t& shape) const;
+};
+
+#endif